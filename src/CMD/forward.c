@@ -0,0 +1,423 @@
+// RT_EXE to client forwarding, split out of main.c so it can be benchmarked
+#define _GNU_SOURCE // recvmmsg
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "forward.h"
+#include "xcp_utils.h"
+
+int forwarder_init(Forwarder *fwd)
+{
+    memset(fwd, 0, sizeof(*fwd));
+    packet_queue_init(&fwd->daq_queue);
+    packet_queue_init(&fwd->cmd_queue);
+    return packet_pool_init(&fwd->pool, PACKET_POOL_BLOCKS);
+}
+
+void forwarder_free(Forwarder *fwd)
+{
+    packet_queue_clear(&fwd->pool, &fwd->daq_queue);
+    packet_queue_clear(&fwd->pool, &fwd->cmd_queue);
+    if (fwd->rx)
+        packet_block_release(&fwd->pool, fwd->rx);
+    packet_pool_free(&fwd->pool);
+}
+
+void forwarder_reset(Forwarder *fwd)
+{
+    fwd->rx_start = 0;
+    fwd->rx_end = 0;
+    fwd->have_ctr = false;
+    fwd->resyncing = false;
+    if (fwd->rx)
+    {
+        packet_block_release(&fwd->pool, fwd->rx);
+        fwd->rx = NULL;
+    }
+}
+
+void forwarder_resync(Forwarder *fwd)
+{
+    fwd->have_ctr = false;
+    fwd->resyncing = true;
+}
+
+// Make room for at least min_space bytes at the end of the rx block.
+static uint8_t *rx_reserve(Forwarder *fwd, size_t min_space, size_t *space)
+{
+    if (fwd->rx && PACKET_BLOCK_SIZE - fwd->rx_end < min_space)
+    {
+        // Out of room for a whole frame. Only the unfinished frame at the end
+        // moves: in place if nobody else holds the block, else to a new one.
+        uint32_t partial = fwd->rx_end - fwd->rx_start;
+        PacketBlock *block = fwd->rx;
+        if (block->refs > 1)
+        {
+            block = packet_block_alloc(&fwd->pool);
+            if (!block)
+                return NULL;
+        }
+        memmove(block->data, fwd->rx->data + fwd->rx_start, partial);
+        if (block != fwd->rx)
+            packet_block_release(&fwd->pool, fwd->rx);
+        fwd->rx = block;
+        fwd->rx_start = 0;
+        fwd->rx_end = partial;
+    }
+    if (!fwd->rx)
+    {
+        fwd->rx = packet_block_alloc(&fwd->pool);
+        if (!fwd->rx)
+            return NULL;
+        fwd->rx_start = 0;
+        fwd->rx_end = 0;
+    }
+
+    *space = PACKET_BLOCK_SIZE - fwd->rx_end;
+    return fwd->rx->data + fwd->rx_end;
+}
+
+uint8_t *forwarder_rx_tail(Forwarder *fwd, size_t *space)
+{
+    return rx_reserve(fwd, XCP_MAX_FRAME_SIZE, space);
+}
+
+// Store a run of frames in the cache, counting them as lost if it is full.
+static void cache_run(Forwarder *fwd, XcpSessionState *daq_cache, const uint8_t *data, size_t len, uint32_t frames)
+{
+    if (cache_xcp_packet(daq_cache, data, len) == 0)
+        fwd->stats.cached_frames += frames;
+    else
+        fwd->stats.cache_dropped += frames;
+}
+
+// Copy queued DAQ frames into the cache, in runs that fit a cache slot, and
+// save the cache file once for the lot. Frames the client already received
+// in full are skipped.
+static void spool_to_cache(Forwarder *fwd, XcpSessionState *daq_cache)
+{
+    PacketQueue *queue = &fwd->daq_queue;
+    int packets = daq_cache->packet_count;
+    uint64_t dropped = fwd->stats.cache_dropped;
+    for (uint32_t i = 0; i < queue->count; i++)
+    {
+        const PacketRef *ref = &queue->refs[(queue->head + i) % PACKET_QUEUE_SIZE];
+        const uint8_t *data = packet_ref_data(ref);
+        uint32_t sent = i == 0 ? queue->sent : 0;
+        size_t off = 0, run = 0;
+        uint32_t run_frames = 0;
+        XcpFrame frame;
+        int n;
+        while (off + run < ref->len && (n = xcp_parse_frame(data + off + run, ref->len - off - run, &frame)) > 0)
+        {
+            if (off + run + (size_t)n <= sent)
+            {
+                off += (size_t)n;
+                continue;
+            }
+            if (run > 0 && run + (size_t)n > MAX_PACKET_SIZE)
+            {
+                cache_run(fwd, daq_cache, data + off, run, run_frames);
+                off += run;
+                run = 0;
+                run_frames = 0;
+            }
+            run += (size_t)n;
+            run_frames++;
+        }
+        if (run > 0)
+            cache_run(fwd, daq_cache, data + off, run, run_frames);
+    }
+    packet_queue_clear(&fwd->pool, queue);
+    if (daq_cache->packet_count != packets)
+        save_xcp_state(daq_cache, XCP_DAQ_CACHE_FILE);
+
+    if (fwd->stats.cache_dropped != dropped)
+        fprintf(stderr, "DAQ cache full (%d packets), %llu frame(s) lost.\n", MAX_XCP_PACKETS,
+                (unsigned long long)(fwd->stats.cache_dropped - dropped));
+}
+
+static int flush_daq(Forwarder *fwd, SocketHandles *sockets, XcpSessionState *daq_cache)
+{
+    if (fwd->daq_queue.count == 0)
+        return 0;
+
+    if (sockets->xcp_daq_fd >= 0)
+    {
+        ssize_t n = packet_queue_send(&fwd->pool, &fwd->daq_queue, sockets->xcp_daq_fd);
+        if (n < 0)
+        {
+            perror("send to XCP_DAQ failed");
+            close(sockets->xcp_daq_fd);
+            sockets->xcp_daq_fd = -1;
+        }
+        else
+        {
+            printf("Forwarded %zd bytes to XCP_DAQ.\n", n);
+        }
+    }
+
+    if (fwd->daq_queue.count == 0)
+        return 0;
+    if (sockets->xcp_daq_fd < 0)
+    {
+        printf("XCP_DAQ socket is not connected, caching DAQ packets.\n");
+        spool_to_cache(fwd, daq_cache);
+    }
+    return -1;
+}
+
+static int flush_cmd(Forwarder *fwd, SocketHandles *sockets)
+{
+    if (fwd->cmd_queue.count == 0)
+        return 0;
+
+    if (sockets->xcp_cmd_fd >= 0)
+    {
+        ssize_t n = packet_queue_send(&fwd->pool, &fwd->cmd_queue, sockets->xcp_cmd_fd);
+        if (n < 0)
+        {
+            perror("send to XCP_CMD failed");
+            close(sockets->xcp_cmd_fd);
+            sockets->xcp_cmd_fd = -1;
+        }
+        else
+        {
+            printf("Forwarded %zd bytes to XCP_CMD.\n", n);
+        }
+    }
+
+    if (fwd->cmd_queue.count == 0)
+        return 0;
+    if (sockets->xcp_cmd_fd < 0)
+        packet_queue_clear(&fwd->pool, &fwd->cmd_queue);
+    return -1;
+}
+
+static int flush_clients(Forwarder *fwd, SocketHandles *sockets, XcpSessionState *daq_cache, int result)
+{
+    if (flush_daq(fwd, sockets, daq_cache) < 0)
+        result = -1;
+    if (flush_cmd(fwd, sockets) < 0)
+        result = -1;
+    return result;
+}
+
+int forwarder_flush(Forwarder *fwd, SocketHandles *sockets, XcpSessionState *daq_cache)
+{
+    return flush_clients(fwd, sockets, daq_cache, 0);
+}
+
+void forwarder_reclaim(Forwarder *fwd, SocketHandles *sockets, XcpSessionState *daq_cache)
+{
+    flush_clients(fwd, sockets, daq_cache, 0);
+    if (fwd->pool.in_use < fwd->pool.block_count)
+        return;
+
+    // The clients took nothing, so they are the ones holding every block.
+    if (fwd->daq_queue.count > 0)
+    {
+        if (sockets->xcp_daq_fd >= 0)
+        {
+            fprintf(stderr, "XCP_DAQ is not keeping up, disconnecting it and caching DAQ packets.\n");
+            close(sockets->xcp_daq_fd);
+            sockets->xcp_daq_fd = -1;
+        }
+        spool_to_cache(fwd, daq_cache);
+    }
+    if (fwd->cmd_queue.count > 0)
+    {
+        fprintf(stderr, "XCP_CMD is not keeping up, discarding %u queued packet(s).\n", fwd->cmd_queue.count);
+        if (fwd->cmd_queue.sent > 0 && sockets->xcp_cmd_fd >= 0)
+        {
+            // It has part of a frame, the rest of its stream would not line up.
+            close(sockets->xcp_cmd_fd);
+            sockets->xcp_cmd_fd = -1;
+        }
+        fwd->stats.discarded_frames += fwd->cmd_queue.count;
+        packet_queue_clear(&fwd->pool, &fwd->cmd_queue);
+    }
+}
+
+// Over UDP the RT_EXE's CTR counts every frame it sends, so a jump means
+// frames were lost on the way.
+static void check_ctr(Forwarder *fwd, uint16_t ctr)
+{
+    if (fwd->have_ctr && ctr != fwd->next_ctr)
+    {
+        uint16_t gap = (uint16_t)(ctr - fwd->next_ctr);
+        if (gap >= 0x8000)
+        {
+            fwd->stats.reordered++;
+            return;
+        }
+        fprintf(stderr, "Lost %u frame(s) from RT_EXE (CTR %u, expected %u).\n", gap, ctr, fwd->next_ctr);
+        fwd->stats.lost_frames += gap;
+    }
+    fwd->next_ctr = (uint16_t)(ctr + 1);
+    fwd->have_ctr = true;
+}
+
+// Step over bytes until a plausible frame header. Returns the offset of the
+// header, or of the first byte still to be checked once more data arrives.
+static uint32_t resync(Forwarder *fwd, uint32_t start, uint32_t end)
+{
+    while (start < end)
+    {
+        int r = xcp_plausible_header(fwd->rx->data + start, end - start, fwd->have_ctr, fwd->next_ctr);
+        if (r == 0)
+            return start;
+        if (r > 0)
+        {
+            fwd->resyncing = false;
+            return start;
+        }
+        start++;
+        fwd->stats.skipped++;
+    }
+    return start;
+}
+
+// Queue the whole frames in rx->data[start, end) to their clients.
+// Returns the offset of the first byte not taken as a frame.
+static uint32_t route_frames(Forwarder *fwd, SocketHandles *sockets, uint32_t start, uint32_t end, bool udp,
+                             int *result)
+{
+    XcpFrame frame;
+    int len;
+    while (start < end)
+    {
+        if (fwd->resyncing && !udp)
+        {
+            start = resync(fwd, start, end);
+            if (fwd->resyncing)
+                break;
+        }
+
+        len = xcp_parse_frame(fwd->rx->data + start, end - start, &frame);
+        if (len == 0)
+            break;
+        if (len < 0 && udp)
+        {
+            fprintf(stderr, "Corrupt XCP frame from RT_EXE, dropping %u bytes.\n", end - start);
+            fwd->stats.corrupt++;
+            *result = -1;
+            return end;
+        }
+        if (len < 0)
+        {
+            // A TCP stream goes on, find where the next frame starts in it.
+            fprintf(stderr, "Corrupt XCP frame from RT_EXE, resynchronising.\n");
+            fwd->stats.corrupt++;
+            fwd->resyncing = true;
+            *result = -1;
+            continue;
+        }
+
+        PacketRef ref = {.block = fwd->rx, .offset = start, .len = (uint32_t)len};
+        start += (uint32_t)len;
+        fwd->stats.frames++;
+        if (udp)
+        {
+            check_ctr(fwd, frame.ctr);
+        }
+        else
+        {
+            fwd->next_ctr = (uint16_t)(frame.ctr + 1);
+            fwd->have_ctr = true;
+        }
+
+        if (is_daq_packet(packet_ref_data(&ref), ref.len))
+        {
+            fwd->stats.daq_frames++;
+            if (packet_queue_push(&fwd->daq_queue, ref) < 0)
+                *result = -1;
+        }
+        else if (sockets->xcp_cmd_fd >= 0)
+        {
+            if (packet_queue_push(&fwd->cmd_queue, ref) < 0)
+                *result = -1;
+        }
+        else
+        {
+            // TODO - what should we do for orphaned / unexpected / unsolicited packets?
+            printf("XCP_CMD socket is not connected, discarding packet.\n");
+            fwd->stats.discarded_frames++;
+            *result = -1;
+        }
+    }
+    return start;
+}
+
+int forward_rt_exe_data(Forwarder *fwd, SocketHandles *sockets, XcpSessionState *daq_cache, size_t n)
+{
+    int result = 0;
+    fwd->rx_end += (uint32_t)n;
+    fwd->stats.bytes += n;
+    fwd->rx_start = route_frames(fwd, sockets, fwd->rx_start, fwd->rx_end, false, &result);
+    return flush_clients(fwd, sockets, daq_cache, result);
+}
+
+int forward_rt_exe_udp(Forwarder *fwd, SocketHandles *sockets, XcpSessionState *daq_cache)
+{
+    size_t space;
+    uint8_t *buf = rx_reserve(fwd, XCP_UDP_MAX_DATAGRAM, &space);
+    if (!buf)
+    {
+        forwarder_reclaim(fwd, sockets, daq_cache);
+        buf = rx_reserve(fwd, XCP_UDP_MAX_DATAGRAM, &space);
+    }
+    if (!buf)
+    {
+        fprintf(stderr, "Packet pool exhausted, deferring RT_EXE read.\n");
+        return 0;
+    }
+
+    // Datagrams land XCP_UDP_MAX_DATAGRAM apart in the rx block and stay
+    // there, the gaps between them are simply never referenced.
+    struct mmsghdr msgs[FORWARD_UDP_BATCH];
+    struct iovec iov[FORWARD_UDP_BATCH];
+    unsigned int batch = 0;
+    while (batch < FORWARD_UDP_BATCH && space >= (batch + 1) * XCP_UDP_MAX_DATAGRAM)
+    {
+        iov[batch] = (struct iovec){buf + batch * XCP_UDP_MAX_DATAGRAM, XCP_UDP_MAX_DATAGRAM};
+        msgs[batch].msg_hdr = (struct msghdr){.msg_iov = &iov[batch], .msg_iovlen = 1};
+        batch++;
+    }
+
+    int n = recvmmsg(sockets->rt_exe_fd, msgs, batch, MSG_DONTWAIT, NULL);
+    if (n < 0)
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+    int result = 0;
+    for (int i = 0; i < n; i++)
+    {
+        uint32_t start = fwd->rx_end + (uint32_t)i * XCP_UDP_MAX_DATAGRAM;
+        uint32_t len = msgs[i].msg_len;
+        fwd->stats.datagrams++;
+        fwd->stats.bytes += len;
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+        {
+            fprintf(stderr, "Oversized datagram from RT_EXE, dropped.\n");
+            fwd->stats.corrupt++;
+            continue;
+        }
+        if (route_frames(fwd, sockets, start, start + len, true, &result) != start + len)
+        {
+            fprintf(stderr, "Datagram from RT_EXE ends mid-frame, dropping the rest.\n");
+            fwd->stats.corrupt++;
+            result = -1;
+        }
+    }
+    if (n > 0)
+    {
+        fwd->rx_end += (uint32_t)(n - 1) * XCP_UDP_MAX_DATAGRAM + msgs[n - 1].msg_len;
+        fwd->rx_start = fwd->rx_end;
+    }
+
+    flush_clients(fwd, sockets, daq_cache, result);
+    return n;
+}
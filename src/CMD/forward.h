@@ -0,0 +1,123 @@
+// Forwarding of RT_EXE traffic to the XCP_CMD / XCP_DAQ clients
+#ifndef FORWARD_H
+#define FORWARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "state.h"
+#include "packet_pool.h"
+
+// Files that store the cached outgoing XCP command and incoming DAQ packets.
+#define XCP_CMD_CACHE_FILE "xcp_cmd_cached.bin"
+#define XCP_DAQ_CACHE_FILE "xcp_daq_cached.bin"
+
+// Most datagrams taken from the RT_EXE per recvmmsg() call
+#define FORWARD_UDP_BATCH 16
+
+typedef struct
+{
+    int rt_exe_fd;
+    int xcp_cmd_fd;
+    int xcp_daq_fd;
+    int client_server_fd;
+} SocketHandles;
+
+typedef struct
+{
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t daq_frames;
+    uint64_t cached_frames;    // DAQ frames spooled to the cache file
+    uint64_t cache_dropped;    // DAQ frames lost because the cache was full
+    uint64_t discarded_frames; // Non-DAQ frames with no XCP_CMD to take them
+    uint64_t corrupt;          // Invalid frame headers
+    uint64_t skipped;          // XCP on TCP only, bytes stepped over to find the next frame
+    uint64_t datagrams;        // XCP on UDP only
+    uint64_t lost_frames;      // XCP on UDP only, gaps in the RT_EXE's CTR
+    uint64_t reordered;        // XCP on UDP only, frames with an earlier CTR than expected
+} ForwardStats;
+
+// RT_EXE data is received straight into pool blocks and split into frames in
+// place. Each frame is routed by queueing a reference to it, so a frame is
+// never copied on its way to a client.
+typedef struct
+{
+    PacketPool pool;
+    PacketBlock *rx;   // Block the next recv() lands in
+    uint32_t rx_start; // First byte not yet taken as a frame
+    uint32_t rx_end;   // One past the last received byte
+    PacketQueue daq_queue;
+    PacketQueue cmd_queue;
+    uint16_t next_ctr; // CTR expected from the RT_EXE
+    bool have_ctr;
+    bool resyncing; // XCP on TCP only, looking for a frame header
+    ForwardStats stats;
+} Forwarder;
+
+/**
+ * @brief Allocate the packet pool, the only allocation the forwarder makes.
+ * @return 0 on success, -1 if out of memory.
+ */
+int forwarder_init(Forwarder *fwd);
+void forwarder_free(Forwarder *fwd);
+
+/**
+ * @brief Drop a partially received frame, e.g. after reconnecting to the RT_EXE.
+ */
+void forwarder_reset(Forwarder *fwd);
+
+/**
+ * @brief Look for the next plausible frame header before routing anything,
+ * e.g. after taking over an RT_EXE connection mid-frame.
+ */
+void forwarder_resync(Forwarder *fwd);
+
+/**
+ * @brief Where to recv() RT_EXE data into.
+ * @param space Output, number of bytes that may be received.
+ * @return Pointer to receive into, or NULL if the pool is exhausted.
+ */
+uint8_t *forwarder_rx_tail(Forwarder *fwd, size_t *space);
+
+/**
+ * @brief Push the queues to the clients, e.g. once poll() reports a client
+ * that could not take everything writable again. Sends never block, what a
+ * client does not take stays queued until it does or forwarder_reclaim()
+ * gives up on it.
+ * @return 0 if the queues are empty, -1 otherwise.
+ */
+int forwarder_flush(Forwarder *fwd, SocketHandles *sockets, XcpSessionState *daq_cache);
+
+/**
+ * @brief Free pool blocks when forwarder_rx_tail() found none: push the
+ * queues to the clients, and if every block is still queued, close a
+ * stalled XCP_DAQ and spool its frames to the cache, and drop the queued
+ * XCP_CMD frames. Reading from the RT_EXE can then go on.
+ */
+void forwarder_reclaim(Forwarder *fwd, SocketHandles *sockets, XcpSessionState *daq_cache);
+
+/**
+ * @brief Route the n bytes just received into forwarder_rx_tail() to
+ * XCP_DAQ or XCP_CMD, one complete frame at a time.
+ * @param sockets Client sockets, a client whose send fails is closed and set to -1.
+ * @param daq_cache DAQ frames are cached here while XCP_DAQ is disconnected.
+ * @return 0 if everything was forwarded, -1 if anything was cached, dropped
+ * or a client connection failed.
+ */
+int forward_rt_exe_data(Forwarder *fwd, SocketHandles *sockets, XcpSessionState *daq_cache, size_t n);
+
+/**
+ * @brief Receive up to FORWARD_UDP_BATCH XCP on UDP datagrams from the RT_EXE
+ * with one recvmmsg() and route the frames in them like forward_rt_exe_data().
+ * @note Each datagram holds one or more whole frames, a datagram that does
+ * not is dropped. Frames missing from the RT_EXE's CTR sequence are counted
+ * as lost, nothing asks for them again.
+ * @return Number of datagrams received, 0 if none were waiting or the pool
+ * is exhausted even after forwarder_reclaim(), -1 if the socket failed
+ * (errno is set, e.g. ECONNREFUSED while nothing listens on the RT_EXE port).
+ */
+int forward_rt_exe_udp(Forwarder *fwd, SocketHandles *sockets, XcpSessionState *daq_cache);
+
+#endif // FORWARD_H
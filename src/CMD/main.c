@@ -9,29 +9,29 @@
 #include <signal.h>
 #include <sys/select.h>
 #include <poll.h>
+#include <stdbool.h>
 
 #include "state.h"
+#include "forward.h"
+#include "replica.h"
 #include "networking.h"
+#include "a2l.h"
+#include "time_utils.h"
+#include "realtime.h"
 #include "xcp_utils.h"
 
 #define CLIENT_PORT CMD_PORT
 #define RECONNECT_DELAY_SEC 2
 
-// Files that store the cached outgoing XCP command and incoming DAQ packets.
-#define XCP_CMD_CACHE_FILE "xcp_cmd_cached.bin"
-#define XCP_DAQ_CACHE_FILE "xcp_daq_cached.bin"
-
-typedef struct
-{
-    int rt_exe_fd;
-    int xcp_cmd_fd;
-    int xcp_daq_fd;
-    int client_server_fd;
-} SocketHandles;
-
 static volatile int keep_running = 1;
 XcpSessionState xcp_cmd_state;
 XcpSessionState xcp_daq_state;
+static Forwarder forwarder;
+static Replica replica;
+static A2lTransport rt_exe_transport = A2L_TRANSPORT_TCP;
+static Realtime realtime;
+static XcpFrameReader xcp_cmd_reader; // XCP on UDP only, XCP_CMD bytes not yet sent as whole frames
+static uint64_t rt_exe_retry_ns;      // XCP on UDP only, when to reopen the RT_EXE socket
 
 void handle_sigint(int sig)
 {
@@ -41,41 +41,18 @@ void handle_sigint(int sig)
     keep_running = 0;
 }
 
-int setup_tcp_server(int port)
+static void usage(const char *prog)
 {
-    int sock;
-    struct sockaddr_in addr;
-
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0)
-    {
-        perror("socket");
-        return -1;
-    }
-
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY; // Listen on all interfaces
-    addr.sin_port = htons(port);
-
-    int yes = 1;
-    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
-
-    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-    {
-        perror("bind");
-        close(sock);
-        return -1;
-    }
-
-    if (listen(sock, 5) < 0)
-    {
-        perror("listen");
-        close(sock);
-        return -1;
-    }
-
-    return sock;
+    printf("Usage: %s [-a a2l_file] [-T tcp|udp] [-s] [-r replica_socket] [-R cpu[:priority[:spin_us]]]\n"
+           "  -a  A2L of the RT_EXE, its XCP_ON_TCP_IP / XCP_ON_UDP_IP block picks the transport\n"
+           "  -T  Talk XCP on TCP or XCP on UDP to the RT_EXE, overriding the A2L\n"
+           "  -s  Run as a hot standby: mirror the active CMD and take over its\n"
+           "      connections if it dies.\n"
+           "  -r  Replication socket, default %s\n"
+           "  -R  Low-latency mode: pin to a core (-1 for any), run SCHED_FIFO at priority\n"
+           "      (default %d, 0 to keep the normal scheduler), lock memory and spin spin_us\n"
+           "      (default %d) before sleeping on the RT_EXE socket.\n",
+           prog, CMD_REPLICA_PATH, REALTIME_DEFAULT_PRIORITY, REALTIME_DEFAULT_SPIN_US);
 }
 
 static void cleanup_sockets(SocketHandles *sockets)
@@ -90,6 +67,13 @@ static void cleanup_sockets(SocketHandles *sockets)
         close(sockets->client_server_fd);
 }
 
+static void close_xcp_cmd(SocketHandles *sockets)
+{
+    close(sockets->xcp_cmd_fd);
+    sockets->xcp_cmd_fd = -1;
+    xcp_reader_init(&xcp_cmd_reader); // Drop a frame it did not finish
+}
+
 static void handle_new_client(SocketHandles *sockets)
 {
     struct sockaddr_in client_addr;
@@ -137,7 +121,7 @@ static void handle_new_client(SocketHandles *sockets)
     {
         // Close previous connection if it exists, and assign to xcp_cmd_fd
         if (sockets->xcp_cmd_fd >= 0)
-            close(sockets->xcp_cmd_fd);
+            close_xcp_cmd(sockets);
         sockets->xcp_cmd_fd = client_fd;
         printf("Client assigned as XCP_CMD.\n");
         return;
@@ -175,15 +159,66 @@ static void handle_new_client(SocketHandles *sockets)
     }
 }
 
+static void close_rt_exe(SocketHandles *sockets)
+{
+    close(sockets->rt_exe_fd);
+    sockets->rt_exe_fd = -1;
+    forwarder_reset(&forwarder);
+}
+
+// XCP on UDP: close the RT_EXE socket and reopen it after RECONNECT_DELAY_SEC,
+// the main loop goes on serving the clients meanwhile.
+static void retry_rt_exe_later(SocketHandles *sockets)
+{
+    close_rt_exe(sockets);
+    rt_exe_retry_ns = time_now_ns() + RECONNECT_DELAY_SEC * 1000000000ULL;
+}
+
+static int handle_rt_exe_udp(SocketHandles *sockets)
+{
+    // Drain what is waiting in batches, but give the clients a turn after a
+    // few so a flood of DAQ cannot starve them.
+    for (int batch = 0; batch < 4; batch++)
+    {
+        int n = forward_rt_exe_udp(&forwarder, sockets, &xcp_daq_state);
+        if (n < 0)
+        {
+            // An ICMP port unreachable, nothing is listening on the RT_EXE port.
+            perror("recv from RT_EXE");
+            retry_rt_exe_later(sockets);
+            return -1;
+        }
+        if (n < FORWARD_UDP_BATCH)
+            break;
+    }
+    return 0;
+}
+
 static int handle_rt_exe(SocketHandles *sockets)
 {
-    char buf[256];
-    ssize_t n = recv(sockets->rt_exe_fd, buf, sizeof(buf), 0);
+    if (rt_exe_transport == A2L_TRANSPORT_UDP)
+        return handle_rt_exe_udp(sockets);
+
+    size_t space;
+    uint8_t *buf = forwarder_rx_tail(&forwarder, &space);
+    if (!buf)
+    {
+        // Every buffer is still queued to a client, get them moving.
+        forwarder_reclaim(&forwarder, sockets, &xcp_daq_state);
+        buf = forwarder_rx_tail(&forwarder, &space);
+    }
+    if (!buf)
+    {
+        // Leave the data in the socket.
+        fprintf(stderr, "Packet pool exhausted, deferring RT_EXE read.\n");
+        return 0;
+    }
+
+    ssize_t n = recv(sockets->rt_exe_fd, buf, space, 0);
     if (n == 0)
     {
         printf("RT_EXE closed connection. Reconnecting...\n");
-        close(sockets->rt_exe_fd);
-        sockets->rt_exe_fd = -1;
+        close_rt_exe(sockets);
         return -1;
     }
     else if (n < 0)
@@ -191,52 +226,93 @@ static int handle_rt_exe(SocketHandles *sockets)
         if (errno == EINTR)
             return 0;
         perror("recv");
-        close(sockets->rt_exe_fd);
-        sockets->rt_exe_fd = -1;
+        close_rt_exe(sockets);
         return -1;
     }
 
-    if (is_daq_packet((uint8_t *)buf, n))
-    {
-        if (sockets->xcp_daq_fd < 0)
-        {
-            printf("XCP_DAQ socket is not connected, caching DAQ packet.\n");
+    forward_rt_exe_data(&forwarder, sockets, &xcp_daq_state, (size_t)n);
+    return 0;
+}
 
-            add_xcp_packet(&xcp_daq_state, (uint8_t *)buf, n, XCP_DAQ_CACHE_FILE);
-            return -1;
-        }
+// Skip the complete frames in the reader, keeping an unfinished one.
+static void drop_frames(XcpFrameReader *reader)
+{
+    XcpFrame frame;
+    while (xcp_reader_next(reader, &frame) != 0)
+        ;
+}
 
-        if (send(sockets->xcp_daq_fd, buf, n, 0) != n)
+static int send_datagram(int fd, const uint8_t *data, size_t len)
+{
+    if (send(fd, data, len, 0) == (ssize_t)len)
+        return 0;
+    perror("send to RT_EXE failed");
+    return -1;
+}
+
+// XCP on UDP needs every frame whole within one datagram. Send the complete
+// frames in the reader, as many per datagram as fit.
+// Returns -1 if a send failed, the frames not sent are dropped then.
+static int send_udp_frames(int fd, XcpFrameReader *reader)
+{
+    uint8_t datagram[XCP_UDP_MAX_DATAGRAM];
+    size_t len = 0;
+    XcpFrame frame;
+    int r;
+    while ((r = xcp_reader_next(reader, &frame)) != 0)
+    {
+        if (r < 0)
+            continue; // The reader steps over the corrupt bytes
+        size_t size = XCP_TCP_HEADER_SIZE + frame.len;
+        if (len + size > sizeof(datagram))
         {
-            perror("send to XCP_DAQ failed");
-            close(sockets->xcp_daq_fd);
-            sockets->xcp_daq_fd = -1;
-            return -1;
+            if (send_datagram(fd, datagram, len) < 0)
+            {
+                drop_frames(reader);
+                return -1;
+            }
+            len = 0;
         }
-        printf("Forwarded %zd bytes to XCP_DAQ.\n", n);
+        memcpy(datagram + len, frame.packet - XCP_TCP_HEADER_SIZE, size);
+        len += size;
     }
-    else
-    {
-        // Must be a CMD packet - shoot it off to XCP_CMD
-        // TODO - are all non-DAQ packets CMD packets?
-        if (sockets->xcp_cmd_fd < 0)
-        {
-            // TODO - what should we do for orphaned / unexpected / unsolicited packets?
-            printf("XCP_CMD socket is not connected, discarding packet.\n");
+    if (len > 0 && send_datagram(fd, datagram, len) < 0)
+        return -1;
+    return 0;
+}
 
-            return -1;
-        }
-        else
+// Replay the cached XCP_CMD setup to a new RT_EXE connection.
+// Returns -1 if the RT_EXE refused it, XCP on UDP only.
+static int send_saved_packets(int fd)
+{
+    if (rt_exe_transport == A2L_TRANSPORT_UDP)
+    {
+        // The cache holds XCP_CMD's bytes as received, frames may span entries.
+        static XcpFrameReader reader;
+        xcp_reader_init(&reader);
+        for (int i = 0; i < xcp_cmd_state.packet_count; ++i)
         {
-            if (send(sockets->xcp_cmd_fd, buf, n, 0) != n)
+            const uint8_t *data = xcp_cmd_state.packets[i];
+            size_t left = (size_t)xcp_cmd_state.packet_lengths[i];
+            size_t taken;
+            while ((taken = xcp_reader_push(&reader, data, left)) < left)
             {
-                perror("send to XCP_CMD failed");
-                close(sockets->xcp_cmd_fd);
-                sockets->xcp_cmd_fd = -1;
-                return -1;
+                if (send_udp_frames(fd, &reader) < 0)
+                    return -1;
+                data += taken;
+                left -= taken;
             }
-            printf("Forwarded %zd bytes to XCP_CMD.\n", n);
         }
+        if (send_udp_frames(fd, &reader) < 0)
+            return -1;
+        printf("Sent %d saved packet(s) to RT_EXE.\n", xcp_cmd_state.packet_count);
+        return 0;
+    }
+
+    for (int i = 0; i < xcp_cmd_state.packet_count; ++i)
+    {
+        send(fd, xcp_cmd_state.packets[i], xcp_cmd_state.packet_lengths[i], 0);
+        printf("Sent saved packet %ld bytes to RT_EXE.\n", xcp_cmd_state.packet_lengths[i]);
     }
     return 0;
 }
@@ -250,14 +326,12 @@ static void handle_xcp_cmd(SocketHandles *sockets)
     if (len == 0)
     {
         printf("XCP_CMD closed connection.\n");
-        close(sockets->xcp_cmd_fd);
-        sockets->xcp_cmd_fd = -1;
+        close_xcp_cmd(sockets);
     }
     else if (len < 0)
     {
         perror("recv from XCP_CMD");
-        close(sockets->xcp_cmd_fd);
-        sockets->xcp_cmd_fd = -1;
+        close_xcp_cmd(sockets);
     }
     else
     {
@@ -267,7 +341,17 @@ static void handle_xcp_cmd(SocketHandles *sockets)
         // reset / command header to each XCP_CMD packet?
         add_xcp_packet(&xcp_cmd_state, buffer, len, XCP_CMD_CACHE_FILE); // Save received packet
 
-        if (send(sockets->rt_exe_fd, buffer, len, 0) != len) // Forward to RT_EXE
+        if (rt_exe_transport == A2L_TRANSPORT_UDP)
+        {
+            xcp_reader_push(&xcp_cmd_reader, buffer, (size_t)len);
+            // Frames that do not go out now are cached and go out with the
+            // setup once the socket is back.
+            if (sockets->rt_exe_fd < 0)
+                drop_frames(&xcp_cmd_reader);
+            else if (send_udp_frames(sockets->rt_exe_fd, &xcp_cmd_reader) < 0)
+                retry_rt_exe_later(sockets);
+        }
+        else if (send(sockets->rt_exe_fd, buffer, len, 0) != len) // Forward to RT_EXE
         {
             // TODO there is a failure mode here when a setup is interrupted mid-send,
             // we could put the RT_EXE in an unknown state.
@@ -280,63 +364,78 @@ static void handle_xcp_cmd(SocketHandles *sockets)
     }
 }
 
+// Add fd to the poll set if it is open.
+// Returns its index in pfds, or -1 if it was not added.
+static int add_pollfd(struct pollfd *pfds, int *nfds, int fd)
+{
+    if (fd < 0)
+        return -1;
+    pfds[*nfds].fd = fd;
+    pfds[*nfds].events = POLLIN;
+    pfds[*nfds].revents = 0;
+    return (*nfds)++;
+}
+
 static void main_loop(SocketHandles *sockets)
 {
     while (keep_running)
     {
-        // Connect to RT_EXE if needed - blocks on this.
-        if (sockets->rt_exe_fd < 0)
+        replica_sync(&replica, sockets, &xcp_cmd_state, &xcp_daq_state);
+
+        // Connect to RT_EXE if needed - blocks on this for TCP. UDP has no
+        // connection, the socket only fails once the setup is refused.
+        // Until a retry is due the clients are served as usual.
+        int timeout_ms = 1000; // 1000 ms = 1 sec timeout
+        if (sockets->rt_exe_fd < 0 && rt_exe_transport == A2L_TRANSPORT_UDP)
         {
-            printf("Connecting to RT_EXE at %s:%d...\n", RT_EXE_ADDR, RT_EXE_PORT);
-            sockets->rt_exe_fd = connect_with_retry(RT_EXE_ADDR, RT_EXE_PORT, NULL);
-            printf("Connected to RT_EXE.\n");
-            for (int i = 0; i < xcp_cmd_state.packet_count; ++i)
+            uint64_t now = time_now_ns();
+            if (now >= rt_exe_retry_ns)
             {
-                send(sockets->rt_exe_fd,
-                     xcp_cmd_state.packets[i],
-                     xcp_cmd_state.packet_lengths[i],
-                     0);
-                printf("Sent saved packet %ld bytes to RT_EXE.\n", xcp_cmd_state.packet_lengths[i]);
+                printf("Talking XCP on UDP to RT_EXE at %s:%d.\n", RT_EXE_ADDR, RT_EXE_PORT);
+                sockets->rt_exe_fd = open_udp_socket(RT_EXE_ADDR, RT_EXE_PORT);
+                if (sockets->rt_exe_fd < 0)
+                {
+                    rt_exe_retry_ns = now + RECONNECT_DELAY_SEC * 1000000000ULL;
+                }
+                else
+                {
+                    realtime_socket(&realtime, sockets->rt_exe_fd);
+                    if (send_saved_packets(sockets->rt_exe_fd) < 0)
+                        retry_rt_exe_later(sockets);
+                }
+            }
+            if (sockets->rt_exe_fd < 0)
+            {
+                uint64_t wait_ms = (rt_exe_retry_ns - now + 999999) / 1000000;
+                if (wait_ms < (uint64_t)timeout_ms)
+                    timeout_ms = (int)wait_ms;
             }
         }
-
-        // Set up FD polling for our sockets
-        struct pollfd pfds[4];
-        int nfds = 0;
-
-        // Add RT_EXE
-        if (sockets->rt_exe_fd >= 0)
-        {
-            pfds[nfds].fd = sockets->rt_exe_fd;
-            pfds[nfds].events = POLLIN;
-            nfds++;
-        }
-
-        // Add XCP_CMD
-        if (sockets->xcp_cmd_fd >= 0)
-        {
-            pfds[nfds].fd = sockets->xcp_cmd_fd;
-            pfds[nfds].events = POLLIN;
-            nfds++;
-        }
-
-        // Add XCP_DAQ
-        if (sockets->xcp_daq_fd >= 0)
-        {
-            pfds[nfds].fd = sockets->xcp_daq_fd;
-            pfds[nfds].events = POLLIN;
-            nfds++;
-        }
-
-        // Add server socket (for new client connections)
-        if (sockets->client_server_fd >= 0)
+        else if (sockets->rt_exe_fd < 0)
         {
-            pfds[nfds].fd = sockets->client_server_fd;
-            pfds[nfds].events = POLLIN;
-            nfds++;
+            printf("Connecting to RT_EXE at %s:%d...\n", RT_EXE_ADDR, RT_EXE_PORT);
+            sockets->rt_exe_fd = connect_with_retry(RT_EXE_ADDR, RT_EXE_PORT, NULL);
+            printf("Connected to RT_EXE.\n");
+            realtime_socket(&realtime, sockets->rt_exe_fd);
+            send_saved_packets(sockets->rt_exe_fd);
         }
 
-        int ret = poll(pfds, nfds, 1000); // 1000 ms = 1 sec timeout
+        // Set up FD polling for our sockets. Each handler looks its entry up
+        // by index, as earlier handlers may close sockets.
+        struct pollfd pfds[6];
+        int nfds = 0;
+        int rt_exe_index = add_pollfd(pfds, &nfds, sockets->rt_exe_fd);
+        int xcp_cmd_index = add_pollfd(pfds, &nfds, sockets->xcp_cmd_fd);
+        int xcp_daq_index = add_pollfd(pfds, &nfds, sockets->xcp_daq_fd);
+        int server_index = add_pollfd(pfds, &nfds, sockets->client_server_fd); // New client connections
+        int standby_index = add_pollfd(pfds, &nfds, replica.peer_fd);         // Only to notice it going away
+        int replica_index = add_pollfd(pfds, &nfds, replica.listen_fd);       // A standby attaching
+        if (xcp_cmd_index >= 0 && forwarder.cmd_queue.count > 0)
+            pfds[xcp_cmd_index].events |= POLLOUT; // Still has frames queued
+        if (xcp_daq_index >= 0 && forwarder.daq_queue.count > 0)
+            pfds[xcp_daq_index].events |= POLLOUT;
+
+        int ret = realtime_poll(&realtime, pfds, nfds, timeout_ms);
 
         if (ret < 0)
         {
@@ -352,51 +451,65 @@ static void main_loop(SocketHandles *sockets)
             continue;
         }
 
-        // Handle events in order of pfds
-        int pfd_index = 0;
-
-        // RT_EXE
-        if (sockets->rt_exe_fd >= 0 && pfds[pfd_index].revents & POLLIN)
+        // RT_EXE, errors too as that is how UDP reports a refused datagram
+        if (rt_exe_index >= 0 && pfds[rt_exe_index].revents & (POLLIN | POLLERR))
         {
             if (handle_rt_exe(sockets) < 0)
                 continue; // If RT_EXE connection was closed, skip further
                           // processing and go back and wait for RT_EXE connection.
+            realtime_ingested(&realtime);
+            replica_sync(&replica, sockets, &xcp_cmd_state, &xcp_daq_state);
+        }
+
+        // A client that could not take everything now can take more
+        if ((xcp_cmd_index >= 0 && pfds[xcp_cmd_index].revents & POLLOUT) ||
+            (xcp_daq_index >= 0 && pfds[xcp_daq_index].revents & POLLOUT))
+        {
+            forwarder_flush(&forwarder, sockets, &xcp_daq_state);
+            replica_sync(&replica, sockets, &xcp_cmd_state, &xcp_daq_state);
         }
-        if (sockets->rt_exe_fd >= 0)
-            pfd_index++;
 
         // XCP_CMD
-        if (sockets->xcp_cmd_fd >= 0 && pfds[pfd_index].revents & POLLIN)
+        if (xcp_cmd_index >= 0 && sockets->xcp_cmd_fd >= 0 && pfds[xcp_cmd_index].revents & POLLIN)
         {
             handle_xcp_cmd(sockets);
+            replica_sync(&replica, sockets, &xcp_cmd_state, &xcp_daq_state);
         }
-        if (sockets->xcp_cmd_fd >= 0)
-            pfd_index++;
 
         // XCP_DAQ (if you want to handle incoming, currently unused)
-        if (sockets->xcp_daq_fd >= 0 && pfds[pfd_index].revents & POLLIN)
+        if (xcp_daq_index >= 0 && pfds[xcp_daq_index].revents & POLLIN)
         {
             // TODO: Add handler if XCP_DAQ ever sends data
         }
-        if (sockets->xcp_daq_fd >= 0)
-            pfd_index++;
 
         // New client connection
-        if (sockets->client_server_fd >= 0 && pfds[pfd_index].revents & POLLIN)
+        if (server_index >= 0 && pfds[server_index].revents & POLLIN)
         {
             handle_new_client(sockets);
+            replica_sync(&replica, sockets, &xcp_cmd_state, &xcp_daq_state);
+        }
+
+        // Standby
+        if (standby_index >= 0 && pfds[standby_index].revents & (POLLIN | POLLHUP))
+        {
+            printf("Standby CMD detached.\n");
+            replica_drop(&replica);
+        }
+
+        // Standby attaching
+        if (replica_index >= 0 && pfds[replica_index].revents & POLLIN)
+        {
+            replica_accept(&replica);
         }
     }
 }
 
-int main(void)
+static void load_cached_state(void)
 {
-    signal(SIGINT, handle_sigint);
-
     if (load_xcp_state(&xcp_cmd_state, XCP_CMD_CACHE_FILE) < 0)
     {
         fprintf(stderr, "Failed to load XCP_CMD session state, starting fresh.\n");
-        memset(&xcp_cmd_state, 0, sizeof(xcp_cmd_state));
+        clear_xcp_state(&xcp_cmd_state);
     }
     else
     {
@@ -406,26 +519,140 @@ int main(void)
     if (load_xcp_state(&xcp_daq_state, XCP_DAQ_CACHE_FILE) < 0)
     {
         fprintf(stderr, "No cached XCP_DAQ packets, starting fresh.\n");
-        memset(&xcp_daq_state, 0, sizeof(xcp_daq_state));
+        clear_xcp_state(&xcp_daq_state);
     }
     else
     {
         printf("Loaded XCP_DAQ state successfully.\n");
     }
+}
+
+// Pick XCP on TCP or UDP: the -T option, else the A2L, else TCP.
+static void select_transport(const char *a2l_file, const char *transport)
+{
+    static A2lFile a2l;
+    if (transport)
+        rt_exe_transport = strcmp(transport, "udp") == 0 ? A2L_TRANSPORT_UDP : A2L_TRANSPORT_TCP;
+    else if (a2l_load(&a2l, a2l_file) == 0 && a2l.transport != A2L_TRANSPORT_NONE)
+        rt_exe_transport = a2l.transport;
+    printf("Using XCP on %s to RT_EXE.\n", rt_exe_transport == A2L_TRANSPORT_UDP ? "UDP" : "TCP");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *replica_path = CMD_REPLICA_PATH;
+    const char *a2l_file = DEFAULT_A2L_FILE;
+    const char *transport = NULL;
+    bool standby = false;
+    RealtimeConfig realtime_config;
+    bool low_latency = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:T:sr:R:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            a2l_file = optarg;
+            break;
+        case 'T':
+            if (strcmp(optarg, "tcp") != 0 && strcmp(optarg, "udp") != 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            transport = optarg;
+            break;
+        case 's':
+            standby = true;
+            break;
+        case 'r':
+            replica_path = optarg;
+            break;
+        case 'R':
+            if (realtime_parse(optarg, &realtime_config) < 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            low_latency = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    signal(SIGINT, handle_sigint);
+    select_transport(a2l_file, transport);
+
+    if (forwarder_init(&forwarder) < 0)
+        return 1;
+    replica_init(&replica);
 
     SocketHandles sockets = {-1, -1, -1, -1};
+    uint64_t takeover_ns = 0;
+
+    if (standby)
+    {
+        // Mirror the active until it dies, then carry on with its sockets and
+        // state. With the RT_EXE connection still open the DAQ session keeps
+        // running, so nothing is replayed.
+        if (!replica_follow(replica_path, &sockets, &xcp_cmd_state, &xcp_daq_state, &keep_running))
+        {
+            forwarder_free(&forwarder);
+            return 0;
+        }
+        takeover_ns = time_now_ns();
+        forwarder_resync(&forwarder); // The active may have died mid-frame
+        printf("Active CMD gone, taking over (%d setup packets, %d cached DAQ packets).\n",
+               xcp_cmd_state.packet_count, xcp_daq_state.packet_count);
+    }
+    else
+    {
+        load_cached_state();
+    }
 
-    sockets.client_server_fd = setup_tcp_server(CLIENT_PORT);
     if (sockets.client_server_fd < 0)
     {
-        fprintf(stderr, "Failed to set up TCP server on port %d\n", CLIENT_PORT);
-        return 1;
+        sockets.client_server_fd = setup_tcp_server(CLIENT_PORT);
+        if (sockets.client_server_fd < 0)
+        {
+            fprintf(stderr, "Failed to set up TCP server on port %d\n", CLIENT_PORT);
+            return 1;
+        }
     }
     printf("TCP server listening on port %d\n", CLIENT_PORT);
 
+    if (replica_listen(&replica, replica_path) < 0)
+        fprintf(stderr, "Running without a standby.\n");
+    if (takeover_ns)
+        printf("Took over as active CMD in %.3f ms.\n", (time_now_ns() - takeover_ns) / 1e6);
+
+    // Everything the forward path touches is allocated by now, lock it in.
+    if (low_latency)
+    {
+        if (realtime_enter(&realtime, &realtime_config) < 0)
+            return 1;
+        realtime_prefault(forwarder.pool.blocks, forwarder.pool.block_count * sizeof(PacketBlock));
+    }
+
     main_loop(&sockets); // Main event loop, runs until SIGINT.
 
+    replica_close(&replica);
     cleanup_sockets(&sockets);
+    printf("Forwarded %llu frames (%llu DAQ, %llu cached, %llu lost to a full cache, %llu discarded, %llu corrupt), "
+           "%d of %d buffers at peak.\n",
+           (unsigned long long)forwarder.stats.frames, (unsigned long long)forwarder.stats.daq_frames,
+           (unsigned long long)forwarder.stats.cached_frames, (unsigned long long)forwarder.stats.cache_dropped,
+           (unsigned long long)forwarder.stats.discarded_frames,
+           (unsigned long long)forwarder.stats.corrupt, forwarder.pool.high_water, forwarder.pool.block_count);
+    if (rt_exe_transport == A2L_TRANSPORT_UDP)
+        printf("Received %llu datagrams, %llu frames lost, %llu out of order.\n",
+               (unsigned long long)forwarder.stats.datagrams, (unsigned long long)forwarder.stats.lost_frames,
+               (unsigned long long)forwarder.stats.reordered);
+    realtime_report(&realtime);
+    forwarder_free(&forwarder);
     printf("CMD exiting.\n");
     return 0;
 }
\ No newline at end of file
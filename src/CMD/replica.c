@@ -0,0 +1,386 @@
+// The active CMD streams its XCP_CMD setup journal and DAQ cache and hands
+// copies of its sockets to the standby. Because the standby holds the same
+// open connections, they survive the active dying and the standby carries on
+// using them. Nothing of the forwarder is replicated: frames the active had
+// queued are lost, and the standby finds the next frame header in the RT_EXE
+// stream itself (forwarder_resync()).
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "replica.h"
+
+#define REPLICA_RETRY_MS 100
+#define REPLICA_MAX_FDS 4
+
+void replica_init(Replica *replica)
+{
+    replica->listen_fd = -1;
+    replica->peer_fd = -1;
+    replica->sent_count[REPLICA_STATE_CMD] = -1;
+    replica->sent_count[REPLICA_STATE_DAQ] = -1;
+    replica->sent_sockets = (SocketHandles){-1, -1, -1, -1};
+}
+
+static int make_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        fprintf(stderr, "Replica socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int replica_listen(Replica *replica, const char *path)
+{
+    struct sockaddr_un addr;
+    if (make_address(path, &addr) < 0)
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd < 0)
+    {
+        perror("replica socket");
+        return -1;
+    }
+    unlink(path); // Left behind by a dead active
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0)
+    {
+        perror("replica bind");
+        close(fd);
+        return -1;
+    }
+    replica->listen_fd = fd;
+    return 0;
+}
+
+void replica_accept(Replica *replica)
+{
+    int fd = accept(replica->listen_fd, NULL, NULL);
+    if (fd < 0)
+    {
+        perror("replica accept");
+        return;
+    }
+    replica_drop(replica);
+    replica->peer_fd = fd;
+    printf("Standby CMD attached.\n");
+}
+
+void replica_drop(Replica *replica)
+{
+    if (replica->peer_fd >= 0)
+        close(replica->peer_fd);
+    replica->peer_fd = -1;
+    replica->sent_count[REPLICA_STATE_CMD] = -1;
+    replica->sent_count[REPLICA_STATE_DAQ] = -1;
+    replica->sent_sockets = (SocketHandles){-1, -1, -1, -1};
+}
+
+static int send_msg(int fd, ReplicaMsgType type, int state, const void *data, size_t len, const int *fds, int fd_count)
+{
+    ReplicaHeader header = {.type = (uint16_t)type, .state = (uint16_t)state, .len = (uint32_t)len};
+    struct iovec iov[2] = {{&header, sizeof(header)}, {(void *)data, len}};
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = len ? 2 : 1};
+
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int) * REPLICA_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    if (fd_count > 0)
+    {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+    }
+
+    // Never wait for the standby, a full socket means it fell behind.
+    return sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) < 0 ? -1 : 0;
+}
+
+static int sync_state(Replica *replica, ReplicaStateId id, const XcpSessionState *state)
+{
+    // A standby that attached again still holds its old copy, and one that
+    // missed a clear holds entries that are gone, so start it over. The
+    // count alone misses a clear followed by as many new entries.
+    int *sent = &replica->sent_count[id];
+    if (*sent < 0 || state->generation != replica->sent_generation[id])
+    {
+        if (send_msg(replica->peer_fd, REPLICA_MSG_RESET, id, NULL, 0, NULL, 0) < 0)
+            return -1;
+        *sent = 0;
+        replica->sent_generation[id] = state->generation;
+    }
+    while (*sent < state->packet_count)
+    {
+        if (send_msg(replica->peer_fd, REPLICA_MSG_PACKET, id, state->packets[*sent], state->packet_lengths[*sent],
+                     NULL, 0) < 0)
+            return -1;
+        (*sent)++;
+    }
+    return 0;
+}
+
+static int sync_sockets(Replica *replica, const SocketHandles *sockets)
+{
+    if (memcmp(sockets, &replica->sent_sockets, sizeof(*sockets)) == 0)
+        return 0;
+
+    // The payload maps each role to its descriptor's position in the message.
+    const int handles[REPLICA_MAX_FDS] = {sockets->rt_exe_fd, sockets->xcp_cmd_fd, sockets->xcp_daq_fd,
+                                          sockets->client_server_fd};
+    int fds[REPLICA_MAX_FDS];
+    int32_t slots[REPLICA_MAX_FDS];
+    int fd_count = 0;
+    for (int i = 0; i < REPLICA_MAX_FDS; i++)
+    {
+        slots[i] = handles[i] >= 0 ? fd_count : -1;
+        if (handles[i] >= 0)
+            fds[fd_count++] = handles[i];
+    }
+    if (send_msg(replica->peer_fd, REPLICA_MSG_SOCKETS, 0, slots, sizeof(slots), fds, fd_count) < 0)
+        return -1;
+    replica->sent_sockets = *sockets;
+    return 0;
+}
+
+void replica_sync(Replica *replica, const SocketHandles *sockets, const XcpSessionState *cmd_state,
+                  const XcpSessionState *daq_state)
+{
+    if (replica->peer_fd < 0)
+        return;
+    if (sync_state(replica, REPLICA_STATE_CMD, cmd_state) < 0 || sync_state(replica, REPLICA_STATE_DAQ, daq_state) < 0 ||
+        sync_sockets(replica, sockets) < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            fprintf(stderr, "Standby CMD is not keeping up, detaching it.\n");
+        else
+            perror("Replication to standby failed");
+        replica_drop(replica);
+    }
+}
+
+void replica_close(Replica *replica)
+{
+    if (replica->peer_fd >= 0 && send_msg(replica->peer_fd, REPLICA_MSG_SHUTDOWN, 0, NULL, 0, NULL, 0) < 0)
+        fprintf(stderr, "Could not tell the standby CMD about the shutdown, it will take over.\n");
+
+    // Unlink before hanging up, the standby binds the same path as it takes over.
+    if (replica->listen_fd >= 0)
+    {
+        struct sockaddr_un addr;
+        socklen_t len = sizeof(addr);
+        if (getsockname(replica->listen_fd, (struct sockaddr *)&addr, &len) == 0)
+            unlink(addr.sun_path);
+        close(replica->listen_fd);
+    }
+    replica->listen_fd = -1;
+    replica_drop(replica);
+}
+
+static void close_handles(SocketHandles *sockets)
+{
+    int *handles[REPLICA_MAX_FDS] = {&sockets->rt_exe_fd, &sockets->xcp_cmd_fd, &sockets->xcp_daq_fd,
+                                     &sockets->client_server_fd};
+    for (int i = 0; i < REPLICA_MAX_FDS; i++)
+    {
+        if (*handles[i] >= 0)
+            close(*handles[i]);
+        *handles[i] = -1;
+    }
+}
+
+static void apply_sockets(SocketHandles *sockets, const int32_t *slots, const int *fds, int fd_count)
+{
+    close_handles(sockets);
+    int *handles[REPLICA_MAX_FDS] = {&sockets->rt_exe_fd, &sockets->xcp_cmd_fd, &sockets->xcp_daq_fd,
+                                     &sockets->client_server_fd};
+    for (int i = 0; i < REPLICA_MAX_FDS; i++)
+    {
+        if (slots[i] >= 0 && slots[i] < fd_count)
+            *handles[i] = fds[slots[i]];
+    }
+}
+
+static void apply_packet(XcpSessionState *state, const uint8_t *data, size_t len)
+{
+    if (state->packet_count >= MAX_XCP_PACKETS || len > MAX_PACKET_SIZE)
+        return;
+    memcpy(state->packets[state->packet_count], data, len);
+    state->packet_lengths[state->packet_count] = len;
+    state->packet_count++;
+}
+
+typedef enum
+{
+    FOLLOW_MORE,     // Message applied
+    FOLLOW_HANGUP,   // The link closed without a shutdown message
+    FOLLOW_SHUTDOWN, // The active is stopping on purpose
+    FOLLOW_RESYNC,   // Malformed message or link error, the mirror is in doubt
+} FollowResult;
+
+// Receive and apply one message.
+static FollowResult follow_one(int fd, SocketHandles *sockets, XcpSessionState *states[2])
+{
+    uint8_t buf[sizeof(ReplicaHeader) + MAX_PACKET_SIZE];
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int) * REPLICA_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {buf, sizeof(buf)};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                         .msg_controllen = sizeof(control.buf)};
+
+    ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EINTR)
+        return FOLLOW_MORE;
+    if (n == 0 || (n < 0 && errno == ECONNRESET))
+        return FOLLOW_HANGUP;
+    if (n < 0)
+    {
+        perror("Standby: replication receive failed");
+        return FOLLOW_RESYNC;
+    }
+
+    int fds[REPLICA_MAX_FDS];
+    int fd_count = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            fd_count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * fd_count);
+        }
+    }
+
+    ReplicaHeader header;
+    memcpy(&header, buf, sizeof(header));
+    const uint8_t *payload = buf + sizeof(header);
+    if ((size_t)n < sizeof(header) || sizeof(header) + header.len != (size_t)n || header.state > REPLICA_STATE_DAQ ||
+        (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+    {
+        fprintf(stderr, "Standby: malformed replication message.\n");
+        for (int i = 0; i < fd_count; i++)
+            close(fds[i]);
+        return FOLLOW_RESYNC;
+    }
+
+    switch (header.type)
+    {
+    case REPLICA_MSG_RESET:
+        clear_xcp_state(states[header.state]);
+        break;
+    case REPLICA_MSG_PACKET:
+        apply_packet(states[header.state], payload, header.len);
+        break;
+    case REPLICA_MSG_SOCKETS:
+        if (header.len != sizeof(int32_t) * REPLICA_MAX_FDS)
+        {
+            fprintf(stderr, "Standby: malformed socket set.\n");
+            for (int i = 0; i < fd_count; i++)
+                close(fds[i]);
+            return FOLLOW_RESYNC;
+        }
+        int32_t slots[REPLICA_MAX_FDS];
+        memcpy(slots, payload, sizeof(slots));
+        apply_sockets(sockets, slots, fds, fd_count);
+        break;
+    case REPLICA_MSG_SHUTDOWN:
+        return FOLLOW_SHUTDOWN;
+    default:
+        fprintf(stderr, "Standby: unknown replication message %u.\n", header.type);
+        return FOLLOW_RESYNC;
+    }
+    return FOLLOW_MORE;
+}
+
+// One attempt to attach to the active. Returns the link, or -1.
+static int attach(const struct sockaddr_un *addr)
+{
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd >= 0 && connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0)
+        return fd;
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+static int attach_with_retry(const struct sockaddr_un *addr, volatile int *keep_running)
+{
+    int fd = -1;
+    while (*keep_running && (fd = attach(addr)) < 0)
+        usleep(REPLICA_RETRY_MS * 1000);
+    return fd;
+}
+
+bool replica_follow(const char *path, SocketHandles *sockets, XcpSessionState *cmd_state,
+                    XcpSessionState *daq_state, volatile int *keep_running)
+{
+    struct sockaddr_un addr;
+    if (make_address(path, &addr) < 0)
+        return false;
+
+    printf("Standby: waiting for an active CMD on %s\n", path);
+    int fd = attach_with_retry(&addr, keep_running);
+    if (fd < 0)
+        return false;
+    printf("Standby: attached to the active CMD.\n");
+
+    // Cleared only here. After attaching again the old copy stands until the
+    // active's reset of both states and its socket set replace it.
+    clear_xcp_state(cmd_state);
+    clear_xcp_state(daq_state);
+    XcpSessionState *states[2] = {cmd_state, daq_state};
+    while (*keep_running)
+    {
+        // poll() is interrupted by SIGINT even though recvmsg() would restart.
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (poll(&pfd, 1, -1) < 0)
+            continue;
+        FollowResult result = follow_one(fd, sockets, states);
+        if (result == FOLLOW_MORE)
+            continue;
+        close(fd);
+        fd = -1;
+
+        if (result == FOLLOW_SHUTDOWN)
+        {
+            printf("Standby: the active CMD shut down, not taking over.\n");
+            break;
+        }
+        if (result == FOLLOW_HANGUP)
+        {
+            // The active also hangs up on a standby that fell behind. Only
+            // take over if it is no longer there to attach to.
+            fd = attach(&addr);
+            if (fd < 0)
+                return true;
+        }
+        else
+        {
+            fd = attach_with_retry(&addr, keep_running);
+            if (fd < 0)
+                break;
+        }
+        printf("Standby: attached to the active CMD again.\n");
+    }
+
+    if (fd >= 0)
+        close(fd);
+    close_handles(sockets);
+    return false;
+}
@@ -0,0 +1,94 @@
+// Hot-standby replication between an active and a standby CMD on one host
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "state.h"
+#include "forward.h"
+
+#define CMD_REPLICA_PATH "/tmp/xcp_cmd_replica.sock"
+
+typedef enum
+{
+    REPLICA_MSG_RESET = 1, // Clear a session state
+    REPLICA_MSG_PACKET,    // Append a packet to a session state
+    REPLICA_MSG_SOCKETS,   // New socket set, the descriptors ride along as SCM_RIGHTS
+    REPLICA_MSG_SHUTDOWN,  // The active is stopping on purpose, do not take over
+} ReplicaMsgType;
+
+typedef enum
+{
+    REPLICA_STATE_CMD, // XCP_CMD setup journal
+    REPLICA_STATE_DAQ, // DAQ spool for a disconnected XCP_DAQ
+} ReplicaStateId;
+
+typedef struct
+{
+    uint16_t type;
+    uint16_t state;
+    uint32_t len; // Payload bytes after the header
+} ReplicaHeader;
+
+// Replication runs over a SOCK_SEQPACKET socket, one message per packet.
+typedef struct
+{
+    int listen_fd;               // Active: waits for a standby
+    int peer_fd;                 // Active: the attached standby, standby: the active
+    int sent_count[2];           // Entries of each state the standby holds, -1 until reset
+    uint32_t sent_generation[2]; // Generation of each state the standby holds
+    SocketHandles sent_sockets;  // Socket set the standby holds
+} Replica;
+
+void replica_init(Replica *replica);
+
+/**
+ * @brief Active side: accept standbys on a Unix socket.
+ * @return 0 on success, -1 on failure (the active runs on unreplicated).
+ */
+int replica_listen(Replica *replica, const char *path);
+
+/**
+ * @brief Active side: attach a connecting standby, replacing any previous one.
+ * The next replica_sync() sends it the whole state.
+ */
+void replica_accept(Replica *replica);
+
+/**
+ * @brief Active side: send the standby whatever changed since the last call.
+ * @note Sessions are compared by entry count and generation. This holds
+ * because entries are only ever appended, or the whole state is cleared,
+ * which bumps its generation.
+ */
+void replica_sync(Replica *replica, const SocketHandles *sockets, const XcpSessionState *cmd_state,
+                  const XcpSessionState *daq_state);
+
+/**
+ * @brief Active side: the standby hung up or fell behind, detach it. A
+ * standby still running notices and attaches again.
+ */
+void replica_drop(Replica *replica);
+
+/**
+ * @brief Standby side: mirror the active until it goes away. When the link
+ * closes the standby attaches again, so only an active that no longer
+ * listens counts as dead. A malformed message also makes it attach again, to
+ * get a fresh copy of the state.
+ * @param sockets Output, the active's sockets, still open, -1 where it had none.
+ * @param cmd_state Output, mirrored XCP_CMD journal.
+ * @param daq_state Output, mirrored DAQ spool.
+ * @param keep_running Returns early with false once this drops to 0.
+ * @return true if the active died and this process should take over, false
+ * if it shut down (REPLICA_MSG_SHUTDOWN) or keep_running dropped.
+ */
+bool replica_follow(const char *path, SocketHandles *sockets, XcpSessionState *cmd_state,
+                    XcpSessionState *daq_state, volatile int *keep_running);
+
+/**
+ * @brief Active side: tell the standby this is a deliberate shutdown, so it
+ * does not take over, and stop listening.
+ */
+void replica_close(Replica *replica);
+
+#endif // REPLICA_H
@@ -29,20 +29,34 @@ void save_xcp_state(const XcpSessionState *state, const char *filename)
 
 // TODO - there is a bug (?) here, if XCP_CMD wants to update the state, but
 // we already have MAX_XCP_PACKETS packets, we will not be able to add the setup.
-void add_xcp_packet(XcpSessionState *state, const uint8_t *data, size_t len, const char *filename)
+int add_xcp_packet(XcpSessionState *state, const uint8_t *data, size_t len, const char *filename)
+{
+    if (cache_xcp_packet(state, data, len) < 0)
+        return -1;
+    save_xcp_state(state, filename);
+    return 0;
+}
+
+int cache_xcp_packet(XcpSessionState *state, const uint8_t *data, size_t len)
 {
     if (state->packet_count >= MAX_XCP_PACKETS || len > MAX_PACKET_SIZE)
-        return;
+        return -1;
 
     memcpy(state->packets[state->packet_count], data, len);
     state->packet_lengths[state->packet_count] = len;
-
     state->packet_count++;
-    save_xcp_state(state, filename);
+    return 0;
 }
 
-void reset_xcp_state(XcpSessionState *state, const char *filename)
+void clear_xcp_state(XcpSessionState *state)
 {
+    uint32_t generation = state->generation;
     memset(state, 0, sizeof(XcpSessionState));
+    state->generation = generation + 1;
+}
+
+void reset_xcp_state(XcpSessionState *state, const char *filename)
+{
+    clear_xcp_state(state);
     save_xcp_state(state, filename);
 }
\ No newline at end of file
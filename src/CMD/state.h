@@ -13,11 +13,20 @@ typedef struct
     uint8_t packets[MAX_XCP_PACKETS][MAX_PACKET_SIZE];
     size_t packet_lengths[MAX_XCP_PACKETS];
     int packet_count;
+    uint32_t generation; // Bumped by every clear_xcp_state()
 } XcpSessionState;
 
 int load_xcp_state(XcpSessionState *state, const char *filename);
 void save_xcp_state(const XcpSessionState *state, const char *filename);
-void add_xcp_packet(XcpSessionState *state, const uint8_t *data, size_t len, const char *filename);
+int add_xcp_packet(XcpSessionState *state, const uint8_t *data, size_t len, const char *filename);
+
+// Like add_xcp_packet() without saving, for callers adding a batch and saving
+// once. Returns -1 if the packet did not fit.
+int cache_xcp_packet(XcpSessionState *state, const uint8_t *data, size_t len);
+
+// Empty the state and bump its generation, so whoever copied it (the standby)
+// can tell it was cleared even if it has refilled since.
+void clear_xcp_state(XcpSessionState *state);
 void reset_xcp_state(XcpSessionState *state, const char *filename);
 
 #endif
\ No newline at end of file
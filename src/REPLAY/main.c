@@ -0,0 +1,584 @@
+// Replays recorded DAQ streams for hardware-free pipeline benchmarking.
+//
+// Inputs are either an XCP_DAQ recording (xcp_data.bin, a raw XCP on TCP
+// stream) or a CMD DAQ cache file (xcp_daq_cached.bin). The stream is either
+// served to CMD in place of the RT_EXE (over XCP on TCP or UDP), served to
+// XCP_DAQ in place of CMD, or decoded and persisted in-process.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "networking.h"
+#include "xcp_utils.h"
+#include "a2l.h"
+#include "daq_plan.h"
+#include "daq_decode.h"
+#include "recorder.h"
+#include "time_utils.h"
+#include "state.h"
+
+#define DEFAULT_REPLAY_OUTPUT "replay_data.bin"
+#define SEND_BUFFER_SIZE 65536
+
+typedef enum
+{
+    REPLAY_TO_CMD,     // Act as RT_EXE, CMD connects to us
+    REPLAY_TO_XCP_DAQ, // Act as CMD, XCP_DAQ connects to us
+    REPLAY_LOCAL,      // Decode and persist in-process
+} ReplayMode;
+
+typedef struct
+{
+    FILE *file;               // Raw stream recording, or
+    XcpSessionState *cache;   // CMD cache file
+    int cache_index;
+} ReplaySource;
+
+typedef struct
+{
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t samples;
+    uint64_t undecoded;
+    uint64_t decode_ns;
+    uint64_t persist_ns;
+    uint64_t first_ts_ns;
+    uint64_t last_ts_ns;
+    uint64_t start_ns;
+    uint64_t end_ns;
+} ReplayStats;
+
+typedef struct
+{
+    ReplayMode mode;
+    bool udp;     // Serve CMD XCP on UDP, the frames are renumbered with our own CTR
+    uint16_t ctr;
+    double speed; // 0 for as fast as possible
+    int server_fd;
+    int peer_fd;
+    uint8_t out[SEND_BUFFER_SIZE];
+    size_t out_len;
+    Recorder recorder;
+    uint64_t dropped_bytes;
+} ReplayOutput;
+
+static volatile int keep_running = 1;
+
+void handle_sigint(int sig)
+{
+    (void)sig;
+    printf("Received SIGINT, shutting down...\n");
+    // Set keep_running to 0 to exit the main loop
+    keep_running = 0;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-m cmd|daq|local] [-u] [-s speed|max] [-l loops] [-c] [-a a2l_file]\n"
+           "          [-o output] [recording] [SIGNAL[@EVENT] ...]\n"
+           "  -m cmd    Serve the stream to CMD on port %d, acting as the RT_EXE (default)\n"
+           "  -u        With -m cmd, serve XCP on UDP (start CMD with -T udp)\n"
+           "  -m daq    Serve the stream to XCP_DAQ on port %d, acting as CMD\n"
+           "  -m local  Decode and persist in-process to the output file\n"
+           "  -s        Replay speed above 0, 1 = recorded rate, N = N times faster, max = as fast as possible\n"
+           "  -l        Number of passes over the recording, 0 = loop until interrupted\n"
+           "  -c        The recording is a CMD cache file rather than an XCP_DAQ recording\n"
+           "  Pacing uses the DAQ timestamps, so the signal list must match the recording.\n",
+           prog, RT_EXE_PORT, CMD_PORT);
+}
+
+static int source_open(ReplaySource *src, const char *filename, bool cache)
+{
+    memset(src, 0, sizeof(*src));
+    if (cache)
+    {
+        src->cache = malloc(sizeof(XcpSessionState));
+        if (!src->cache || load_xcp_state(src->cache, filename) < 0)
+        {
+            fprintf(stderr, "Failed to load CMD cache file %s\n", filename);
+            free(src->cache);
+            return -1;
+        }
+        return 0;
+    }
+
+    src->file = fopen(filename, "rb");
+    if (!src->file)
+    {
+        perror("Failed to open recording");
+        return -1;
+    }
+    return 0;
+}
+
+static void source_rewind(ReplaySource *src)
+{
+    if (src->file)
+        rewind(src->file);
+    src->cache_index = 0;
+}
+
+// Read the next chunk of the stream, returns 0 at the end.
+static size_t source_read(ReplaySource *src, uint8_t *buf, size_t max)
+{
+    if (src->file)
+        return fread(buf, 1, max, src->file);
+
+    if (src->cache_index >= src->cache->packet_count)
+        return 0;
+    size_t len = src->cache->packet_lengths[src->cache_index];
+    if (len > max)
+        return 0;
+    memcpy(buf, src->cache->packets[src->cache_index], len);
+    src->cache_index++;
+    return len;
+}
+
+static void source_close(ReplaySource *src)
+{
+    if (src->file)
+        fclose(src->file);
+    free(src->cache);
+}
+
+// Over UDP the consumer is whoever sends us the first datagram, CMD sends
+// the setup it has when it opens its socket.
+static int accept_udp_peer(ReplayOutput *out)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    uint8_t buf[XCP_UDP_MAX_DATAGRAM];
+    if (recvfrom(out->server_fd, buf, sizeof(buf), 0, (struct sockaddr *)&addr, &addr_len) < 0 ||
+        connect(out->server_fd, (struct sockaddr *)&addr, addr_len) < 0)
+    {
+        perror("udp peer");
+        return -1;
+    }
+    out->peer_fd = out->server_fd;
+    printf("Consumer connected over UDP.\n");
+    return 0;
+}
+
+static void drop_peer(ReplayOutput *out)
+{
+    if (out->udp)
+    {
+        // Forget the peer but keep listening on the port.
+        struct sockaddr unspec = {.sa_family = AF_UNSPEC};
+        connect(out->server_fd, &unspec, sizeof(unspec));
+    }
+    else
+    {
+        close(out->peer_fd);
+    }
+    out->peer_fd = -1;
+}
+
+// Block until the consumer (CMD or XCP_DAQ) connects.
+static int accept_peer(ReplayOutput *out)
+{
+    printf("Waiting for %s to connect...\n", out->mode == REPLAY_TO_CMD ? "CMD" : "XCP_DAQ");
+    while (keep_running)
+    {
+        struct pollfd pfd = {.fd = out->server_fd, .events = POLLIN};
+        if (poll(&pfd, 1, 1000) <= 0)
+            continue;
+        if (out->udp)
+        {
+            if (accept_udp_peer(out) == 0)
+                return 0;
+            continue;
+        }
+        out->peer_fd = accept(out->server_fd, NULL, NULL);
+        if (out->peer_fd < 0)
+        {
+            perror("accept");
+            continue;
+        }
+
+        // XCP_DAQ identifies itself the way it does to CMD.
+        if (out->mode == REPLAY_TO_XCP_DAQ)
+        {
+            char id[32] = {0};
+            struct pollfd idfd = {.fd = out->peer_fd, .events = POLLIN};
+            if (poll(&idfd, 1, 1000) > 0)
+                recv(out->peer_fd, id, sizeof(id) - 1, 0);
+            printf("Client identified as: %s\n", id);
+        }
+        printf("Consumer connected (fd: %d).\n", out->peer_fd);
+        return 0;
+    }
+    return -1;
+}
+
+// Discard whatever the consumer sends us, e.g. the setup CMD replays on
+// connect, so its socket buffer never fills up and stalls it.
+static void drain_peer(ReplayOutput *out)
+{
+    uint8_t buf[1024];
+    while (recv(out->peer_fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+        ;
+}
+
+// Whole frames from the start of data that fit one datagram.
+static size_t datagram_length(const uint8_t *data, size_t len)
+{
+    size_t total = 0;
+    XcpFrame frame;
+    int n;
+    while ((n = xcp_parse_frame(data + total, len - total, &frame)) > 0 && total + (size_t)n <= XCP_UDP_MAX_DATAGRAM)
+        total += (size_t)n;
+    return total;
+}
+
+static void flush_output(ReplayOutput *out)
+{
+    if (out->out_len == 0 || out->mode == REPLAY_LOCAL)
+        return;
+
+    if (out->peer_fd < 0 && accept_peer(out) < 0)
+    {
+        out->out_len = 0;
+        return;
+    }
+    drain_peer(out);
+
+    size_t sent = 0;
+    while (sent < out->out_len)
+    {
+        size_t len = out->out_len - sent;
+        if (out->udp)
+            len = datagram_length(out->out + sent, len);
+        ssize_t n = send(out->peer_fd, out->out + sent, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            perror("send to consumer failed");
+            drop_peer(out);
+            out->dropped_bytes += out->out_len - sent;
+            break;
+        }
+        sent += (size_t)n;
+    }
+    out->out_len = 0;
+}
+
+static void emit_frame(ReplayOutput *out, const uint8_t *frame, size_t len, ReplayStats *stats)
+{
+    if (out->mode == REPLAY_LOCAL)
+    {
+        uint64_t t0 = time_now_ns();
+        recorder_write(&out->recorder, frame, len);
+        stats->persist_ns += time_now_ns() - t0;
+        return;
+    }
+
+    if (out->out_len + len > sizeof(out->out))
+        flush_output(out);
+    memcpy(out->out + out->out_len, frame, len);
+    if (out->udp)
+    {
+        out->out[out->out_len + 2] = (uint8_t)out->ctr;
+        out->out[out->out_len + 3] = (uint8_t)(out->ctr >> 8);
+        out->ctr++;
+    }
+    out->out_len += len;
+}
+
+static void print_stats(const char *label, const ReplayStats *stats, ReplayMode mode)
+{
+    double secs = (stats->end_ns - stats->start_ns) / 1e9;
+    if (secs <= 0)
+        secs = 1e-9;
+    double recorded = (stats->last_ts_ns - stats->first_ts_ns) / 1e9;
+
+    printf("%s: %llu frames, %llu bytes in %.3f s - %.0f frames/s, %.2f MB/s",
+           label, (unsigned long long)stats->frames, (unsigned long long)stats->bytes, secs,
+           stats->frames / secs, stats->bytes / secs / 1e6);
+    if (recorded > 0)
+        printf(", %.3f s recorded (%.1fx)", recorded, recorded / secs);
+    printf("\n");
+
+    printf("  Decode: %llu samples, %llu undecoded frames, %.0f ns/frame, %.0f samples/s\n",
+           (unsigned long long)stats->samples, (unsigned long long)stats->undecoded,
+           stats->frames ? (double)stats->decode_ns / stats->frames : 0.0,
+           stats->decode_ns ? stats->samples / (stats->decode_ns / 1e9) : 0.0);
+    if (mode == REPLAY_LOCAL)
+    {
+        printf("  Persist: %.0f ns/frame, %.2f MB/s\n",
+               stats->frames ? (double)stats->persist_ns / stats->frames : 0.0,
+               stats->persist_ns ? stats->bytes / (stats->persist_ns / 1e9) / 1e6 : 0.0);
+    }
+}
+
+static void accumulate(ReplayStats *total, const ReplayStats *pass)
+{
+    if (total->frames == 0)
+    {
+        total->start_ns = pass->start_ns;
+        total->first_ts_ns = 0;
+    }
+    total->frames += pass->frames;
+    total->bytes += pass->bytes;
+    total->samples += pass->samples;
+    total->undecoded += pass->undecoded;
+    total->decode_ns += pass->decode_ns;
+    total->persist_ns += pass->persist_ns;
+    total->last_ts_ns += pass->last_ts_ns - pass->first_ts_ns;
+    total->end_ns = pass->end_ns;
+}
+
+// One pass over the recording. Frames are paced by the DAQ timestamp of
+// the first ODT of each cycle, scaled by the replay speed.
+static void replay_pass(ReplaySource *src, const DaqPlan *plan, ReplayOutput *out, ReplayStats *stats)
+{
+    XcpFrameReader reader;
+    DaqDecoder decoder;
+    DaqSample samples[DAQ_MAX_ENTRIES_PER_ODT];
+    bool have_first = false;
+    uint64_t wall_start = 0;
+
+    xcp_reader_init(&reader);
+    daq_decoder_init(&decoder, plan);
+    memset(stats, 0, sizeof(*stats));
+    stats->start_ns = time_now_ns();
+
+    while (keep_running)
+    {
+        size_t space;
+        uint8_t *tail = xcp_reader_tail(&reader, &space);
+        size_t n = source_read(src, tail, space);
+        if (n == 0)
+            break;
+        xcp_reader_commit(&reader, n);
+
+        XcpFrame frame;
+        int r;
+        while (keep_running && (r = xcp_reader_next(&reader, &frame)) != 0)
+        {
+            if (r < 0)
+            {
+                fprintf(stderr, "Corrupt XCP frame header in recording, resynchronising.\n");
+                continue;
+            }
+
+            int count = -1;
+            uint64_t t0 = time_now_ns();
+            if (plan && xcp_classify_pid(frame.packet[0]) == XCP_PACKET_DAQ)
+                count = daq_decode_dto(&decoder, frame.packet, frame.len, samples, DAQ_MAX_ENTRIES_PER_ODT);
+            stats->decode_ns += time_now_ns() - t0;
+
+            if (count < 0)
+            {
+                stats->undecoded++;
+            }
+            else
+            {
+                stats->samples += (uint64_t)count;
+                if (count > 0 && plan->timestamp_size > 0)
+                {
+                    uint64_t ts = samples[0].timestamp_ns;
+                    if (!have_first)
+                    {
+                        have_first = true;
+                        stats->first_ts_ns = ts;
+                        wall_start = time_now_ns();
+                    }
+                    stats->last_ts_ns = ts;
+
+                    if (out->speed > 0 && ts > stats->first_ts_ns)
+                    {
+                        uint64_t deadline = wall_start + (uint64_t)((ts - stats->first_ts_ns) / out->speed);
+                        if (deadline > time_now_ns())
+                        {
+                            flush_output(out);
+                            time_sleep_until_ns(deadline);
+                        }
+                    }
+                }
+            }
+
+            size_t frame_len = XCP_TCP_HEADER_SIZE + frame.len;
+            emit_frame(out, frame.packet - XCP_TCP_HEADER_SIZE, frame_len, stats);
+            stats->frames++;
+            stats->bytes += frame_len;
+        }
+    }
+
+    flush_output(out);
+    if (out->mode == REPLAY_LOCAL)
+    {
+        uint64_t t0 = time_now_ns();
+        recorder_flush(&out->recorder);
+        stats->persist_ns += time_now_ns() - t0;
+    }
+    stats->end_ns = time_now_ns();
+}
+
+int main(int argc, char *argv[])
+{
+    const char *a2l_file = DEFAULT_A2L_FILE;
+    const char *output_file = DEFAULT_REPLAY_OUTPUT;
+    const char *input_file = DEFAULT_RECORDING_FILE;
+    bool cache = false;
+    int loops = 1;
+    static ReplayOutput out = {.mode = REPLAY_TO_CMD, .speed = 1.0, .server_fd = -1, .peer_fd = -1};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:us:l:ca:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            if (strcmp(optarg, "cmd") == 0)
+                out.mode = REPLAY_TO_CMD;
+            else if (strcmp(optarg, "daq") == 0)
+                out.mode = REPLAY_TO_XCP_DAQ;
+            else if (strcmp(optarg, "local") == 0)
+                out.mode = REPLAY_LOCAL;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'u':
+            out.udp = true;
+            break;
+        case 's':
+        {
+            // 0 means unthrottled, which only "max" asks for.
+            char *end;
+            double speed = strtod(optarg, &end);
+            if (strcmp(optarg, "max") == 0)
+                speed = 0.0;
+            else if (end == optarg || *end != '\0' || !(speed > 0) || !isfinite(speed))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            out.speed = speed;
+            break;
+        }
+        case 'l':
+        {
+            char *end;
+            long count = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || count < 0 || count > INT_MAX)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            loops = (int)count;
+            break;
+        }
+        case 'c':
+            cache = true;
+            break;
+        case 'a':
+            a2l_file = optarg;
+            break;
+        case 'o':
+            output_file = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind < argc)
+        input_file = argv[optind++];
+
+    signal(SIGINT, handle_sigint);
+    signal(SIGPIPE, SIG_IGN);
+
+    static A2lFile a2l;
+    static DaqPlan plan;
+    const DaqPlan *layout = NULL;
+    DaqSignalRequest requests[DAQ_MAX_SIGNALS];
+    int request_count = daq_parse_signal_args(argc - optind, argv + optind, requests);
+    if (request_count >= 0 && a2l_load(&a2l, a2l_file) == 0 &&
+        daq_plan_layout(&plan, &a2l, requests, request_count) == 0)
+    {
+        layout = &plan;
+    }
+    else
+    {
+        fprintf(stderr, "No DAQ layout available, replaying without decoding or pacing.\n");
+    }
+
+    ReplaySource src;
+    if (source_open(&src, input_file, cache) < 0)
+        return 1;
+
+    if (out.mode == REPLAY_LOCAL)
+    {
+        if (recorder_open(&out.recorder, output_file) < 0)
+            return 1;
+    }
+    else if (out.udp)
+    {
+        if (out.mode != REPLAY_TO_CMD)
+        {
+            fprintf(stderr, "Only CMD can be served over UDP.\n");
+            return 1;
+        }
+        out.server_fd = setup_udp_server(RT_EXE_PORT);
+        if (out.server_fd < 0)
+        {
+            fprintf(stderr, "Failed to set up UDP server on port %d\n", RT_EXE_PORT);
+            return 1;
+        }
+    }
+    else
+    {
+        int port = out.mode == REPLAY_TO_CMD ? RT_EXE_PORT : CMD_PORT;
+        out.server_fd = setup_tcp_server(port);
+        if (out.server_fd < 0)
+        {
+            fprintf(stderr, "Failed to set up TCP server on port %d\n", port);
+            return 1;
+        }
+    }
+
+    ReplayStats total = {0};
+    for (int pass = 0; keep_running && (loops == 0 || pass < loops); pass++)
+    {
+        ReplayStats stats;
+        source_rewind(&src);
+        replay_pass(&src, layout, &out, &stats);
+        if (stats.frames == 0)
+        {
+            fprintf(stderr, "Recording %s contains no frames.\n", input_file);
+            break;
+        }
+
+        char label[32];
+        snprintf(label, sizeof(label), "Pass %d", pass + 1);
+        print_stats(label, &stats, out.mode);
+        accumulate(&total, &stats);
+    }
+
+    if (total.frames > 0)
+        print_stats("Total", &total, out.mode);
+    if (out.dropped_bytes > 0)
+        printf("Dropped %llu bytes while the consumer was disconnected.\n", (unsigned long long)out.dropped_bytes);
+
+    source_close(&src);
+    if (out.mode == REPLAY_LOCAL)
+        recorder_close(&out.recorder);
+    if (out.peer_fd >= 0 && out.peer_fd != out.server_fd)
+        close(out.peer_fd);
+    if (out.server_fd >= 0)
+        close(out.server_fd);
+    return 0;
+}
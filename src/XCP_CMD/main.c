@@ -3,34 +3,32 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "networking.h"
+#include "a2l.h"
+#include "daq_plan.h"
 
-// --- XCP Command Codes ---
+// --- XCP Command Codes (ASAM XCP 1.x) ---
 #define CMD_CONNECT 0xFF
 #define CMD_DISCONNECT 0xFE
 #define CMD_GET_STATUS 0xFD
-#define CMD_FREE_DAQ 0x0E // Clears all DAQ lists
-#define CMD_ALLOC_DAQ 0x00
-#define CMD_ALLOC_ODT 0x01
-#define CMD_ALLOC_ODT_ENTRY 0x02
-#define CMD_SET_DAQ_PTR 0x03
-#define CMD_WRITE_DAQ 0x04
-#define CMD_SET_DAQ_LIST_MODE 0x07
-#define CMD_START_STOP_DAQ 0x08
-#define CMD_START_STOP_SYNC 0x0A
-
-// --- XCP Data Types ---
-// For FLOAT64_IEEE, XCP uses DAQ_DTYPE_DOUBLE
-#define DAQ_DTYPE_DOUBLE 0x08
+#define CMD_SET_DAQ_PTR 0xE2
+#define CMD_WRITE_DAQ 0xE1
+#define CMD_SET_DAQ_LIST_MODE 0xE0
+#define CMD_START_STOP_DAQ_LIST 0xDE
+#define CMD_START_STOP_SYNCH 0xDD
+#define CMD_FREE_DAQ 0xD6 // Clears all dynamic DAQ lists
+#define CMD_ALLOC_DAQ 0xD5
+#define CMD_ALLOC_ODT 0xD4
+#define CMD_ALLOC_ODT_ENTRY 0xD3
 
 // --- XCP DAQ Modes/Parameters ---
-#define DAQ_MODE_DAQ 0x00        // Event-driven DAQ
-#define DAQ_MODE_BYTE_ORDER 0x00 // Assuming little-endian byte order for addresses in WRITE_DAQ
-#define START_DAQ_LIST 0x01      // For SET_DAQ_LIST_MODE: Start a specific DAQ list
-#define STOP_DAQ_LIST 0x00       // For SET_DAQ_LIST_MODE: Stop a specific DAQ list
-#define START_DAQ_ALL 0x01       // For START_STOP_DAQ: Start all DAQ lists
-#define STOP_DAQ_ALL 0x00        // For START_STOP_DAQ: Stop all DAQ lists
+// Multi-byte parameters are little-endian, the A2L's BYTE_ORDER_MSB_LAST.
+#define WRITE_DAQ_NO_BIT_OFFSET 0xFF // WRITE_DAQ: whole element, not a single bit
+#define DAQ_LIST_MODE_TIMESTAMP 0x10 // SET_DAQ_LIST_MODE: DTOs carry a timestamp in ODT 0
+#define START_STOP_SELECT 0x02       // START_STOP_DAQ_LIST: select the list for START_STOP_SYNCH
+#define SYNCH_START_SELECTED 0x01    // START_STOP_SYNCH: start all selected lists at once
 
 // --- Helper function to print command name ---
 void print_command_name(const char *name, size_t len)
@@ -38,11 +36,18 @@ void print_command_name(const char *name, size_t len)
     printf("  --- %s (%zu bytes) ---\n", name, len);
 }
 
-int main()
+static void usage(const char *prog)
 {
-    int sock = connect_with_retry(CMD_ADDR, CMD_PORT, "XCP_CMD");
-    printf("Connected to CMD at %s:%d\n", CMD_ADDR, CMD_PORT);
+    printf("Usage: %s [-a a2l_file] [-b max_bytes_per_sec] [-c max_ecu_load_percent]\n"
+           "          [-p max_prescaler] [-n] [SIGNAL[@EVENT] ...]\n"
+           "  -p  Largest prescaler the planner may use, 1..255\n"
+           "  -n  Only print the DAQ plan, do not configure the RT_EXE.\n",
+           prog);
+}
 
+// Send the DAQ setup described by the plan, one packet at a time.
+static void send_daq_setup(int sock, const DaqPlan *plan)
+{
     // --- 1. CONNECT Command ---
     // Connects to the XCP slave.
     // Format: [CMD_CONNECT] [mode]
@@ -53,142 +58,216 @@ int main()
     };
     print_command_name("CONNECT", sizeof(cmd_connect));
     send_packet(sock, cmd_connect, sizeof(cmd_connect));
-    // usleep(100000); // Simulate network delay and wait for response
 
     // --- 2. FREE_DAQ Command ---
     // Clears all existing DAQ lists on the slave.
     // This is good practice to ensure a clean state before configuring new measurements.
     // Format: [CMD_FREE_DAQ]
     uint8_t cmd_free_daq[] = {
-        CMD_FREE_DAQ // Command code (0x0E)
+        CMD_FREE_DAQ // Command code (0xD6)
     };
     print_command_name("FREE_DAQ", sizeof(cmd_free_daq));
     send_packet(sock, cmd_free_daq, sizeof(cmd_free_daq));
-    // usleep(100000); // Simulate network delay and wait for response
 
     // --- 3. ALLOC_DAQ Command ---
-    // Allocates DAQ lists on the slave. We need one DAQ list.
-    // Format: [CMD_ALLOC_DAQ] [number_of_daq_lists]
+    // Allocates one DAQ list per event channel in the plan.
+    // Format: [CMD_ALLOC_DAQ] [reserved] [daq_count (2 bytes)]
     uint8_t cmd_alloc_daq[] = {
-        CMD_ALLOC_DAQ, // Command code (0x00)
-        0x01           // Allocate 1 DAQ list
+        CMD_ALLOC_DAQ,             // Command code (0xD5)
+        0x00,                      // Reserved
+        (uint8_t)plan->list_count, // Number of DAQ lists (Little-Endian)
+        0x00                       //
     };
-    print_command_name("ALLOC_DAQ (1 list)", sizeof(cmd_alloc_daq));
+    print_command_name("ALLOC_DAQ", sizeof(cmd_alloc_daq));
     send_packet(sock, cmd_alloc_daq, sizeof(cmd_alloc_daq));
-    // usleep(100000); // Simulate network delay and wait for response
 
     // --- 4. ALLOC_ODT Command ---
-    // Allocates ODTs (Object Description Tables) within a specified DAQ list.
-    // We allocate 1 ODT in DAQ list 0.
-    // Format: [CMD_ALLOC_ODT] [daq_list_number] [number_of_odts]
-    uint8_t cmd_alloc_odt[] = {
-        CMD_ALLOC_ODT, // Command code (0x01)
-        0x00,          // DAQ list number 0
-        0x01           // Allocate 1 ODT in DAQ list 0
-    };
-    print_command_name("ALLOC_ODT (1 ODT in list 0)", sizeof(cmd_alloc_odt));
-    send_packet(sock, cmd_alloc_odt, sizeof(cmd_alloc_odt));
-    // usleep(100000); // Simulate network delay and wait for response
+    // Allocates ODTs (Object Description Tables) within each DAQ list.
+    // Format: [CMD_ALLOC_ODT] [reserved] [daq_list_number (2 bytes)] [number_of_odts]
+    for (int l = 0; l < plan->list_count; l++)
+    {
+        uint8_t cmd_alloc_odt[] = {
+            CMD_ALLOC_ODT,                     // Command code (0xD4)
+            0x00,                              // Reserved
+            (uint8_t)l, 0x00,                  // DAQ list number (Little-Endian)
+            (uint8_t)plan->lists[l].odt_count // Number of ODTs
+        };
+        print_command_name("ALLOC_ODT", sizeof(cmd_alloc_odt));
+        send_packet(sock, cmd_alloc_odt, sizeof(cmd_alloc_odt));
+    }
 
     // --- 5. ALLOC_ODT_ENTRY Command ---
-    // Allocates entries within a specified ODT.
-    // We need 2 entries for our two measurements in DAQ list 0, ODT 0.
-    // Format: [CMD_ALLOC_ODT_ENTRY] [daq_list_number] [odt_number] [number_of_entries]
-    uint8_t cmd_alloc_odt_entry[] = {
-        CMD_ALLOC_ODT_ENTRY, // Command code (0x02)
-        0x00,                // DAQ list number 0
-        0x00,                // ODT number 0
-        0x02                 // Allocate 2 entries in DAQ list 0, ODT 0
-    };
-    print_command_name("ALLOC_ODT_ENTRY (2 entries in list 0, ODT 0)", sizeof(cmd_alloc_odt_entry));
-    send_packet(sock, cmd_alloc_odt_entry, sizeof(cmd_alloc_odt_entry));
-    // usleep(100000); // Simulate network delay and wait for response
-
-    // --- 6. Configuration for SIMPLE_RT_Y.Q_1 (0x000305B0) ---
-
-    // SET_DAQ_PTR: Points to the specific ODT entry where the next measurement will be written.
-    // Format: [CMD_SET_DAQ_PTR] [daq_list_number] [odt_number] [odt_entry_address]
-    uint8_t cmd_set_daq_ptr_q1[] = {
-        CMD_SET_DAQ_PTR, // Command code (0x03)
-        0x00,            // DAQ list number 0
-        0x00,            // ODT number 0
-        0x00             // ODT entry address 0 (first entry)
-    };
-    print_command_name("SET_DAQ_PTR (Q_1)", sizeof(cmd_set_daq_ptr_q1));
-    send_packet(sock, cmd_set_daq_ptr_q1, sizeof(cmd_set_daq_ptr_q1));
-    // usleep(100000); // Simulate network delay and wait for response
-
-    // WRITE_DAQ: Writes the measurement variable's address and data type to the current ODT entry.
-    // ECU_ADDRESS: 0x000305B0 (Little-Endian: 0xB0 0x05 0x03 0x00)
-    // Data type: FLOAT64_IEEE (XCP DAQ_DTYPE_DOUBLE = 0x08)
-    // Format: [CMD_WRITE_DAQ] [daq_mode] [addr_ext] [address (4 bytes)] [data_type]
-    uint8_t cmd_write_daq_q1[] = {
-        CMD_WRITE_DAQ,          // Command code (0x04)
-        0x00,                   // DAQ mode (0x00 for event-driven, or specific settings like DAQ_MODE_BYTE_ORDER if needed)
-        0x00,                   // Address extension (typically 0x00)
-        0xB0, 0x05, 0x03, 0x00, // ECU Address 0x000305B0 (Little-Endian)
-        DAQ_DTYPE_DOUBLE        // Data type (0x08 for FLOAT64_IEEE)
-    };
-    print_command_name("WRITE_DAQ (Q_1)", sizeof(cmd_write_daq_q1));
-    send_packet(sock, cmd_write_daq_q1, sizeof(cmd_write_daq_q1));
-    // usleep(100000); // Simulate network delay and wait for response
-
-    // --- 7. Configuration for SIMPLE_RT_Y.Q_2 (0x000305B8) ---
-
-    // SET_DAQ_PTR: Points to the next ODT entry.
-    // Format: [CMD_SET_DAQ_PTR] [daq_list_number] [odt_number] [odt_entry_address]
-    uint8_t cmd_set_daq_ptr_q2[] = {
-        CMD_SET_DAQ_PTR, // Command code (0x03)
-        0x00,            // DAQ list number 0
-        0x00,            // ODT number 0
-        0x01             // ODT entry address 1 (second entry)
-    };
-    print_command_name("SET_DAQ_PTR (Q_2)", sizeof(cmd_set_daq_ptr_q2));
-    send_packet(sock, cmd_set_daq_ptr_q2, sizeof(cmd_set_daq_ptr_q2));
-    // usleep(100000); // Simulate network delay and wait for response
-
-    // WRITE_DAQ: Writes the measurement variable's address and data type.
-    // ECU_ADDRESS: 0x000305B8 (Little-Endian: 0xB8 0x05 0x03 0x00)
-    // Data type: FLOAT64_IEEE (XCP DAQ_DTYPE_DOUBLE = 0x08)
-    // Format: [CMD_WRITE_DAQ] [daq_mode] [addr_ext] [address (4 bytes)] [data_type]
-    uint8_t cmd_write_daq_q2[] = {
-        CMD_WRITE_DAQ,          // Command code (0x04)
-        0x00,                   // DAQ mode
-        0x00,                   // Address extension
-        0xB8, 0x05, 0x03, 0x00, // ECU Address 0x000305B8 (Little-Endian)
-        DAQ_DTYPE_DOUBLE        // Data type (0x08 for FLOAT64_IEEE)
-    };
-    print_command_name("WRITE_DAQ (Q_2)", sizeof(cmd_write_daq_q2));
-    send_packet(sock, cmd_write_daq_q2, sizeof(cmd_write_daq_q2));
-    // usleep(100000); // Simulate network delay and wait for response
-
-    // --- 8. SET_DAQ_LIST_MODE Command ---
-    // Configures and enables the specified DAQ list.
-    // Mode: START_DAQ_LIST (0x01) to enable measurements on this list.
-    // Event Channel: 0x00 (assuming a default or continuous event trigger)
-    // Cycle Time Factor: 0x0000 (for event-driven, or specific cycles if cyclic DAQ)
-    // Format: [CMD_SET_DAQ_LIST_MODE] [mode] [daq_list_number] [event_channel] [cycle_time_factor (2 bytes)]
-    uint8_t cmd_set_list_mode[] = {
-        CMD_SET_DAQ_LIST_MODE, // Command code (0x07)
-        START_DAQ_LIST,        // Mode (0x01 to start this DAQ list)
-        0x00,                  // DAQ list number 0
-        0x00,                  // Event channel (0x00 for generic/default)
-        0x00, 0x00             // Cycle time factor (0 for event-driven)
-    };
-    print_command_name("SET_DAQ_LIST_MODE (start list 0)", sizeof(cmd_set_list_mode));
-    send_packet(sock, cmd_set_list_mode, sizeof(cmd_set_list_mode));
-    // usleep(100000); // Simulate network delay and wait for response
-
-    // --- 9. START_STOP_DAQ Command ---
-    // Globally starts or stops all configured DAQ lists.
-    // Mode: START_DAQ_ALL (0x01) to begin the DAQ measurement.
-    // Format: [CMD_START_STOP_DAQ] [mode]
-    uint8_t cmd_start_daq_all[] = {
-        CMD_START_STOP_DAQ, // Command code (0x08)
-        START_DAQ_ALL       // Mode (0x01 to start all DAQ lists)
+    // Allocates entries within each ODT, one per measurement.
+    // Format: [CMD_ALLOC_ODT_ENTRY] [reserved] [daq_list_number (2 bytes)] [odt_number] [number_of_entries]
+    for (int l = 0; l < plan->list_count; l++)
+    {
+        for (int o = 0; o < plan->lists[l].odt_count; o++)
+        {
+            uint8_t cmd_alloc_odt_entry[] = {
+                CMD_ALLOC_ODT_ENTRY,                            // Command code (0xD3)
+                0x00,                                           // Reserved
+                (uint8_t)l, 0x00,                               // DAQ list number (Little-Endian)
+                (uint8_t)o,                                     // ODT number
+                (uint8_t)plan->lists[l].odts[o].entry_count // Number of entries
+            };
+            print_command_name("ALLOC_ODT_ENTRY", sizeof(cmd_alloc_odt_entry));
+            send_packet(sock, cmd_alloc_odt_entry, sizeof(cmd_alloc_odt_entry));
+        }
+    }
+
+    // --- 6. Configure every measurement ---
+    for (int i = 0; i < plan->signal_count; i++)
+    {
+        const DaqSignal *s = &plan->signals[i];
+
+        // SET_DAQ_PTR: Points to the specific ODT entry where the next measurement will be written.
+        // Format: [CMD_SET_DAQ_PTR] [reserved] [daq_list_number (2 bytes)] [odt_number] [odt_entry_number]
+        uint8_t cmd_set_daq_ptr[] = {
+            CMD_SET_DAQ_PTR, // Command code (0xE2)
+            0x00,            // Reserved
+            s->list, 0x00,   // DAQ list number (Little-Endian)
+            s->odt,          // ODT number
+            s->entry         // ODT entry number
+        };
+        print_command_name("SET_DAQ_PTR", sizeof(cmd_set_daq_ptr));
+        send_packet(sock, cmd_set_daq_ptr, sizeof(cmd_set_daq_ptr));
+
+        // WRITE_DAQ: Writes the measurement variable's size and address to the current ODT entry.
+        // The address comes from the A2L ECU_ADDRESS and is sent little-endian.
+        // Format: [CMD_WRITE_DAQ] [bit_offset] [size] [addr_ext] [address (4 bytes)]
+        uint8_t cmd_write_daq[] = {
+            CMD_WRITE_DAQ,               // Command code (0xE1)
+            WRITE_DAQ_NO_BIT_OFFSET,     // Bit offset (0xFF, not a bit)
+            s->size,                     // Element size (8 for FLOAT64_IEEE)
+            s->address_extension,        // Address extension
+            (uint8_t)(s->address),       // ECU Address (Little-Endian)
+            (uint8_t)(s->address >> 8),  //
+            (uint8_t)(s->address >> 16), //
+            (uint8_t)(s->address >> 24)  //
+        };
+        printf("  --- WRITE_DAQ %s (%zu bytes) ---\n", s->name, sizeof(cmd_write_daq));
+        send_packet(sock, cmd_write_daq, sizeof(cmd_write_daq));
+    }
+
+    // --- 7. SET_DAQ_LIST_MODE Command ---
+    // Puts each DAQ list on its A2L event channel with the prescaler and
+    // priority chosen by the planner. The decoder expects a timestamp in ODT 0
+    // whenever the A2L supports them, so they are always switched on then.
+    // Format: [CMD_SET_DAQ_LIST_MODE] [mode] [daq_list_number (2 bytes)] [event_channel (2 bytes)] [prescaler] [priority]
+    uint8_t list_mode = plan->timestamp_size > 0 ? DAQ_LIST_MODE_TIMESTAMP : 0x00;
+    for (int l = 0; l < plan->list_count; l++)
+    {
+        const DaqListPlan *list = &plan->lists[l];
+        uint8_t cmd_set_list_mode[] = {
+            CMD_SET_DAQ_LIST_MODE,             // Command code (0xE0)
+            list_mode,                         // Mode (0x10 timestamped, direction DAQ)
+            (uint8_t)l, 0x00,                  // DAQ list number (Little-Endian)
+            (uint8_t)list->event_channel,      // Event channel (Little-Endian)
+            (uint8_t)(list->event_channel >> 8), //
+            list->prescaler,                   // Transmission rate prescaler
+            list->priority                     // DAQ list priority (0xFF highest)
+        };
+        print_command_name("SET_DAQ_LIST_MODE", sizeof(cmd_set_list_mode));
+        send_packet(sock, cmd_set_list_mode, sizeof(cmd_set_list_mode));
+    }
+
+    // --- 8. START_STOP_DAQ_LIST Command ---
+    // Selects each DAQ list so they can all be started together.
+    // Format: [CMD_START_STOP_DAQ_LIST] [mode] [daq_list_number (2 bytes)]
+    for (int l = 0; l < plan->list_count; l++)
+    {
+        uint8_t cmd_select_list[] = {
+            CMD_START_STOP_DAQ_LIST, // Command code (0xDE)
+            START_STOP_SELECT,       // Mode (0x02 to select)
+            (uint8_t)l, 0x00         // DAQ list number (Little-Endian)
+        };
+        print_command_name("START_STOP_DAQ_LIST (select)", sizeof(cmd_select_list));
+        send_packet(sock, cmd_select_list, sizeof(cmd_select_list));
+    }
+
+    // --- 9. START_STOP_SYNCH Command ---
+    // Starts all selected DAQ lists at once.
+    // Format: [CMD_START_STOP_SYNCH] [mode]
+    uint8_t cmd_start_selected[] = {
+        CMD_START_STOP_SYNCH, // Command code (0xDD)
+        SYNCH_START_SELECTED  // Mode (0x01 to start the selected lists)
     };
-    print_command_name("START_STOP_DAQ (start all)", sizeof(cmd_start_daq_all));
-    send_packet(sock, cmd_start_daq_all, sizeof(cmd_start_daq_all));
+    print_command_name("START_STOP_SYNCH (start selected)", sizeof(cmd_start_selected));
+    send_packet(sock, cmd_start_selected, sizeof(cmd_start_selected));
+}
+
+int main(int argc, char *argv[])
+{
+    const char *a2l_file = DEFAULT_A2L_FILE;
+    bool plan_only = false;
+    DaqBudget budget;
+    daq_budget_init(&budget);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:b:c:p:nh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            a2l_file = optarg;
+            break;
+        case 'b':
+            budget.max_bytes_per_sec = atof(optarg);
+            break;
+        case 'c':
+            budget.max_cpu_load = atof(optarg) / 100.0;
+            break;
+        case 'p':
+        {
+            int prescaler = atoi(optarg);
+            if (prescaler < 1 || prescaler > 255)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            budget.max_prescaler = (uint8_t)prescaler;
+            break;
+        }
+        case 'n':
+            plan_only = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    DaqSignalRequest requests[DAQ_MAX_SIGNALS];
+    int request_count = daq_parse_signal_args(argc - optind, argv + optind, requests);
+    if (request_count < 0)
+        return 1;
+
+    static A2lFile a2l;
+    if (a2l_load(&a2l, a2l_file) < 0)
+    {
+        fprintf(stderr, "Failed to load A2L file %s\n", a2l_file);
+        return 1;
+    }
+
+    // Plan the DAQ lists before touching the RT_EXE - a plan that would
+    // overrun the link or the ECU base rate is never sent.
+    DaqPlan plan;
+    if (daq_plan_layout(&plan, &a2l, requests, request_count) < 0)
+        return 1;
+    int fits = daq_plan_fit(&plan, &budget);
+    daq_plan_print(&plan, &budget);
+    if (fits < 0)
+    {
+        fprintf(stderr, "DAQ plan refused, not configuring RT_EXE.\n");
+        return 1;
+    }
+    if (plan_only)
+        return 0;
+
+    int sock = connect_with_retry(CMD_ADDR, CMD_PORT, "XCP_CMD");
+    printf("Connected to CMD at %s:%d\n", CMD_ADDR, CMD_PORT);
+
+    send_daq_setup(sock, &plan);
 
     // TODO - we should probably wait for a response from the CMD before proceeding.
     // For now, we assume the setup is successful and proceed. In a real application,
@@ -197,4 +276,4 @@ int main()
 
     close(sock);
     return 0;
-}
\ No newline at end of file
+}
@@ -1,13 +1,49 @@
 #include <stdio.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <poll.h>
+#include <errno.h>
 
 #include "networking.h"
+#include "xcp_utils.h"
+#include "a2l.h"
+#include "daq_plan.h"
+#include "daq_decode.h"
+#include "recorder.h"
+#include "capture.h"
+#include "daq_align.h"
+#include "live_stream.h"
+#include "time_utils.h"
+#include "realtime.h"
+
+#define STATS_INTERVAL_NS 1000000000ULL
+#define DEFAULT_ROWS_FILE "xcp_rows.csv"
+
+typedef struct
+{
+    uint64_t bytes;
+    uint64_t frames;
+    uint64_t samples;
+    uint64_t decode_errors;
+    uint64_t decode_ns;
+    uint64_t persist_ns;
+    uint64_t since_ns;
+} DaqStats;
+
+// Wide rows from the aligner, as CSV
+typedef struct
+{
+    FILE *file;
+    const DaqPlan *plan;
+    bool header_written;
+} RowWriter;
 
 static volatile int keep_running = 1;
+static bool quiet = false;
 
 void handle_sigint(int sig)
 {
@@ -17,37 +53,319 @@ void handle_sigint(int sig)
     keep_running = 0;
 }
 
-void save_data_to_file(const uint8_t *data, size_t len)
+static void usage(const char *prog)
 {
-    FILE *file = fopen("xcp_data.bin", "ab");
-    if (!file)
-    {
-        perror("Failed to open xcp_data.bin");
-        return;
-    }
-    fwrite(data, 1, len, file);
-    fclose(file);
+    printf("Usage: %s [-a a2l_file] [-o recording] [-L live_socket] [-t trigger ...] [-w pre_s[:post_s]] [-B MiB]\n"
+           "          [-j master[:mode[:max_lateness_ms]]] [-J rows_file]\n"
+           "          [-R cpu[:priority[:spin_us]]] [-q] [SIGNAL[@EVENT] ...]\n"
+           "  The signal list must match the one given to XCP_CMD.\n"
+           "  -L  Socket live viewers subscribe on, default %s, \"\" to disable\n"
+           "  -t  Only record around trigger events, \"SIGNAL OP VALUE\" with OP one of\n"
+           "      > >= < <= == != rises falls. May be given up to %d times.\n"
+           "  -w  Seconds kept before and after a trigger, default %.0f:%.0f\n"
+           "  -B  Memory for the pre-trigger window, 1 to %d MiB, default %u MiB\n"
+           "  -j  Align all lists into wide rows, one per cycle of the master signal's list or per\n"
+           "      period (e.g. 10ms). mode is hold, nearest or linear, default hold. Rows wait at\n"
+           "      most max_lateness_ms of DAQ time for late lists, default %.0f.\n"
+           "  -J  File the rows are written to, default %s, - for stdout\n"
+           "  -R  Low-latency mode: pin to a core (-1 for any), run SCHED_FIFO at priority\n"
+           "      (default %d, 0 to keep the normal scheduler), lock memory and spin spin_us\n"
+           "      (default %d) before sleeping on the CMD socket.\n"
+           "  -q  Do not print every decoded sample.\n",
+           prog, LIVE_STREAM_PATH, CAPTURE_MAX_TRIGGERS, CAPTURE_DEFAULT_PRE_NS / 1e9, CAPTURE_DEFAULT_POST_NS / 1e9,
+           CAPTURE_MAX_BUFFER_MIB, CAPTURE_DEFAULT_BUFFER_BYTES >> 20, ALIGN_DEFAULT_MAX_LATENESS_NS / 1e6, DEFAULT_ROWS_FILE,
+           REALTIME_DEFAULT_PRIORITY, REALTIME_DEFAULT_SPIN_US);
 }
 
-void decode_xcp_packet(const uint8_t *data, size_t len)
+void print_raw_packet(const uint8_t *data, size_t len)
 {
-    // TODO This function should decode the XCP packet according to the XCP protocol.
-    // For now, we will just print the raw data in hex format.
     printf("XCP Packet: ");
     for (size_t i = 0; i < len; i++)
     {
         printf("%02X ", data[i]);
     }
     printf("\n");
+}
+
+int decode_xcp_packet(DaqDecoder *decoder, const XcpFrame *frame, DaqSample *samples, DaqStats *stats)
+{
+    int n = -1;
+
+    stats->frames++;
+    if (decoder->plan && xcp_classify_pid(frame->packet[0]) == XCP_PACKET_DAQ)
+        n = daq_decode_dto(decoder, frame->packet, frame->len, samples, DAQ_MAX_ENTRIES_PER_ODT);
+
+    if (n < 0)
+    {
+        // Not a DTO of our layout, e.g. no A2L was loaded or a stray response.
+        stats->decode_errors++;
+        if (!quiet)
+            print_raw_packet(frame->packet, frame->len);
+        return 0;
+    }
+
+    stats->samples += (uint64_t)n;
+    if (quiet)
+        return n;
+    for (int i = 0; i < n; i++)
+    {
+        printf("%.6f %s = %g\n", samples[i].timestamp_ns / 1e9,
+               decoder->plan->signals[samples[i].signal].name, samples[i].value);
+    }
+    return n;
+}
+
+static void write_row(void *ctx, uint64_t timestamp_ns, const double *values, const bool *valid, int count)
+{
+    RowWriter *writer = ctx;
+    if (!writer->header_written)
+    {
+        fprintf(writer->file, "daq_time");
+        for (int i = 0; i < count; i++)
+            fprintf(writer->file, ",%s", writer->plan->signals[i].name);
+        fprintf(writer->file, "\n");
+        writer->header_written = true;
+    }
+    fprintf(writer->file, "%.6f", timestamp_ns / 1e9);
+    for (int i = 0; i < count; i++)
+    {
+        if (valid[i])
+            fprintf(writer->file, ",%.17g", values[i]);
+        else
+            fprintf(writer->file, ",");
+    }
+    fprintf(writer->file, "\n");
+}
+
+// "MASTER[:MODE[:MAX_LATENESS_MS]]"
+static int open_aligner(DaqAligner *aligner, RowWriter *writer, const DaqPlan *plan, char *spec,
+                        const char *rows_file)
+{
+    char *master = strtok(spec, ":");
+    char *mode_text = strtok(NULL, ":");
+    char *lateness_text = strtok(NULL, ":");
+    AlignMode mode = ALIGN_HOLD;
+    uint64_t max_lateness_ns = ALIGN_DEFAULT_MAX_LATENESS_NS;
+    if (!master)
+    {
+        fprintf(stderr, "Alignment needs a master signal or period.\n");
+        return -1;
+    }
+    if (mode_text && daq_align_parse_mode(mode_text, &mode) < 0)
+    {
+        fprintf(stderr, "Unknown alignment mode '%s', use hold, nearest or linear.\n", mode_text);
+        return -1;
+    }
+    if (lateness_text)
+    {
+        char *end;
+        double ms = strtod(lateness_text, &end);
+        if (end == lateness_text || *end != '\0' || !(ms >= 0 && ms * 1e6 < (double)UINT64_MAX))
+        {
+            fprintf(stderr, "Invalid alignment lateness '%s', give a number of ms, 0 or more.\n", lateness_text);
+            return -1;
+        }
+        max_lateness_ns = (uint64_t)(ms * 1e6);
+    }
+    if (daq_align_init(aligner, plan, master, mode, max_lateness_ns, write_row, writer) < 0)
+        return -1;
 
-    save_data_to_file(data, len);
+    writer->plan = plan;
+    writer->header_written = false;
+    writer->file = strcmp(rows_file, "-") == 0 ? stdout : fopen(rows_file, "w");
+    if (!writer->file)
+    {
+        perror("Failed to open the rows file");
+        return -1;
+    }
+    return 0;
+}
+
+static void report_stats(DaqStats *stats)
+{
+    uint64_t now = time_now_ns();
+    uint64_t elapsed = now - stats->since_ns;
+    if (elapsed < STATS_INTERVAL_NS)
+        return;
+
+    if (stats->bytes > 0)
+    {
+        double secs = elapsed / 1e9;
+        printf("Throughput: %.0f frames/s, %.0f samples/s, %.1f kB/s persisted, decode %.0f ns/frame, persist %.0f ns/frame, %llu undecoded\n",
+               stats->frames / secs, stats->samples / secs, stats->bytes / secs / 1000.0,
+               stats->frames ? (double)stats->decode_ns / stats->frames : 0.0,
+               stats->frames ? (double)stats->persist_ns / stats->frames : 0.0,
+               (unsigned long long)stats->decode_errors);
+    }
+    *stats = (DaqStats){.since_ns = now};
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
+    const char *a2l_file = DEFAULT_A2L_FILE;
+    const char *recording_file = DEFAULT_RECORDING_FILE;
+    const char *live_path = LIVE_STREAM_PATH;
+    const char *trigger_texts[CAPTURE_MAX_TRIGGERS];
+    int trigger_count = 0;
+    double pre_s = CAPTURE_DEFAULT_PRE_NS / 1e9;
+    double post_s = CAPTURE_DEFAULT_POST_NS / 1e9;
+    size_t buffer_bytes = CAPTURE_DEFAULT_BUFFER_BYTES;
+    char *align_spec = NULL;
+    const char *rows_file = DEFAULT_ROWS_FILE;
+    RealtimeConfig realtime_config;
+    bool low_latency = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:o:L:t:w:B:j:J:R:qh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            a2l_file = optarg;
+            break;
+        case 'o':
+            recording_file = optarg;
+            break;
+        case 'L':
+            live_path = optarg;
+            break;
+        case 't':
+            if (trigger_count == CAPTURE_MAX_TRIGGERS)
+            {
+                fprintf(stderr, "At most %d triggers.\n", CAPTURE_MAX_TRIGGERS);
+                return 1;
+            }
+            trigger_texts[trigger_count++] = optarg;
+            break;
+        case 'w':
+            if (sscanf(optarg, "%lf:%lf", &pre_s, &post_s) < 1 || pre_s < 0 || post_s < 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'B':
+        {
+            int mib = atoi(optarg);
+            if (mib <= 0 || mib > CAPTURE_MAX_BUFFER_MIB)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            buffer_bytes = (size_t)mib << 20;
+            break;
+        }
+        case 'j':
+            align_spec = optarg;
+            break;
+        case 'J':
+            rows_file = optarg;
+            break;
+        case 'R':
+            if (realtime_parse(optarg, &realtime_config) < 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            low_latency = true;
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
     signal(SIGINT, handle_sigint);
 
+    // Rebuild the layout XCP_CMD configured so DTOs can be decoded. Without
+    // it we still record everything, but only print raw packets.
+    static A2lFile a2l;
+    static DaqPlan plan;
+    DaqDecoder decoder;
+    DaqSignalRequest requests[DAQ_MAX_SIGNALS];
+    int request_count = daq_parse_signal_args(argc - optind, argv + optind, requests);
+    daq_decoder_init(&decoder, NULL);
+    if (request_count >= 0 && a2l_load(&a2l, a2l_file) == 0 &&
+        daq_plan_layout(&plan, &a2l, requests, request_count) == 0)
+    {
+        daq_decoder_init(&decoder, &plan);
+    }
+    else
+    {
+        fprintf(stderr, "No DAQ layout available, packets will not be decoded.\n");
+    }
+
+    // With triggers, frames are buffered and only the windows around trigger
+    // events reach the recording, indexed as the capture writes them out.
+    static Capture capture;
+    CaptureTrigger triggers[CAPTURE_MAX_TRIGGERS];
+    bool capturing = trigger_count > 0;
+    if (capturing && !decoder.plan)
+    {
+        fprintf(stderr, "Triggers need the DAQ layout.\n");
+        return 1;
+    }
+    for (int i = 0; i < trigger_count; i++)
+    {
+        if (capture_parse_trigger(&plan, trigger_texts[i], &triggers[i]) < 0)
+            return 1;
+    }
+
+    // Wide rows across the DAQ lists, written as the lists catch up
+    static DaqAligner aligner;
+    RowWriter rows = {0};
+    bool aligning = align_spec != NULL;
+    if (aligning && !decoder.plan)
+    {
+        fprintf(stderr, "Aligning lists needs the DAQ layout.\n");
+        return 1;
+    }
+    if (aligning && open_aligner(&aligner, &rows, &plan, align_spec, rows_file) < 0)
+        return 1;
+
+    Recorder recorder;
+    if (recorder_open(&recorder, recording_file) < 0)
+        return 1;
+    if (capturing)
+    {
+        if (capture_init(&capture, &plan, &recorder, (uint64_t)(pre_s * 1e9), (uint64_t)(post_s * 1e9), buffer_bytes) < 0)
+            return 1;
+        memcpy(capture.triggers, triggers, trigger_count * sizeof(triggers[0]));
+        capture.trigger_count = trigger_count;
+        if (recorder_enable_index(&recorder, recording_file, &plan, &capture.tail, RECORDING_CLOCK_OFFSET) < 0)
+            fprintf(stderr, "Recording without a time index.\n");
+    }
+    else if (decoder.plan && recorder_enable_index(&recorder, recording_file, &plan, &decoder, RECORDING_CLOCK_HOST) < 0)
+    {
+        fprintf(stderr, "Recording without a time index.\n");
+    }
+
+    // Decoded values for live viewers, only with a layout to decode against
+    static LiveServer live;
+    live.listen_fd = -1;
+    if (decoder.plan && *live_path && live_server_open(&live, live_path, &plan) < 0)
+        fprintf(stderr, "Live viewers are not available.\n");
+
+    // Everything the ingest path touches is allocated by now, lock it in.
+    static Realtime realtime;
+    if (low_latency)
+    {
+        if (realtime_enter(&realtime, &realtime_config) < 0)
+            return 1;
+        if (capturing)
+        {
+            realtime_prefault(capture.bytes, capture.byte_capacity);
+            realtime_prefault(capture.frames, capture.frame_capacity * sizeof(CaptureFrame));
+        }
+    }
+
     int cmd_fd = -1;
+    XcpFrameReader reader;
+    DaqSample samples[DAQ_MAX_ENTRIES_PER_ODT];
+    DaqStats stats = {.since_ns = time_now_ns()};
 
     while (keep_running)
     {
@@ -55,16 +373,27 @@ int main(void)
         if (cmd_fd < 0)
         {
             cmd_fd = connect_with_retry(CMD_ADDR, CMD_PORT, "XCP_DAQ");
+            realtime_socket(&realtime, cmd_fd);
+            xcp_reader_init(&reader);
             continue;
         }
 
-        struct pollfd pfd;
-        pfd.fd = cmd_fd;
-        pfd.events = POLLIN;
+        report_stats(&stats);
+
+        // Wake up for live viewers that are due an update, else wait up to a
+        // second for data. Publishing may drop viewers, so it goes before the
+        // poll set is built.
+        int live_wait = live_server_publish(&live, time_now_ns());
+        struct pollfd pfds[1 + LIVE_MAX_CLIENTS + 1];
+        pfds[0] = (struct pollfd){.fd = cmd_fd, .events = POLLIN};
+        int live_count = live_server_pollfds(&live, pfds + 1);
+        int timeout = live_wait >= 0 && live_wait < 1000 ? live_wait : 1000;
 
-        int ret = poll(&pfd, 1, 1000); // Wait indefinitely for data
+        int ret = realtime_poll(&realtime, pfds, 1 + live_count, timeout);
         if (ret < 0)
         {
+            if (errno == EINTR)
+                continue;
             perror("poll");
             close(cmd_fd);
             cmd_fd = -1;
@@ -72,16 +401,20 @@ int main(void)
         }
         else if (ret == 0)
         {
-            printf("Timeout waiting for data.\n");
+            if (timeout == 1000)
+                printf("Timeout waiting for data.\n");
             continue; // Timeout, just retry
         }
 
-        if (pfd.revents & POLLIN)
+        live_server_handle(&live, pfds + 1, live_count);
+
+        if (pfds[0].revents & POLLIN)
         {
 
-            // Wait for data from CMD
-            uint8_t buffer[256];
-            ssize_t n = recv(cmd_fd, buffer, sizeof(buffer), 0);
+            // Wait for data from CMD, straight into the frame reader
+            size_t space;
+            uint8_t *buffer = xcp_reader_tail(&reader, &space);
+            ssize_t n = recv(cmd_fd, buffer, space, 0);
 
             if (n < 0)
             {
@@ -98,11 +431,74 @@ int main(void)
                 continue; // Retry connection
             }
 
-            // Process the received data
-            decode_xcp_packet(buffer, n);
-            printf("Received %zd bytes from CMD\n", n);
+            xcp_reader_commit(&reader, (size_t)n);
+            stats.bytes += (uint64_t)n;
+
+            // Persist every complete frame received so far, then decode it.
+            // Decoding is best effort, the raw frame is always kept. In
+            // capture mode the frame is kept in memory until a trigger.
+            XcpFrame frame;
+            int r;
+            while ((r = xcp_reader_next(&reader, &frame)) != 0)
+            {
+                if (r < 0)
+                {
+                    fprintf(stderr, "Corrupt XCP frame header, resynchronising.\n");
+                    continue;
+                }
+                const uint8_t *raw = frame.packet - XCP_TCP_HEADER_SIZE;
+                size_t raw_len = XCP_TCP_HEADER_SIZE + frame.len;
+                uint64_t t0 = time_now_ns();
+                if (!capturing)
+                    recorder_write_frame(&recorder, raw, raw_len);
+                uint64_t t1 = time_now_ns();
+                int count = decode_xcp_packet(&decoder, &frame, samples, &stats);
+                uint64_t t2 = time_now_ns();
+                if (capturing)
+                    capture_frame(&capture, raw, raw_len, samples, count);
+                else
+                    recorder_index_samples(&recorder, samples, count);
+                live_server_update(&live, samples, count);
+                if (aligning)
+                    daq_align_samples(&aligner, samples, count);
+                stats.persist_ns += t1 - t0 + time_now_ns() - t2;
+                stats.decode_ns += t2 - t1;
+            }
+            uint64_t t0 = time_now_ns();
+            recorder_flush(&recorder);
+            if (aligning)
+                fflush(rows.file);
+            uint64_t t1 = time_now_ns();
+            stats.persist_ns += t1 - t0;
+            live_server_publish(&live, t1);
+            realtime_ingested(&realtime);
+            if (!quiet)
+                printf("Received %zd bytes from CMD\n", n);
         }
     }
 
+    live_server_close(&live);
+    realtime_report(&realtime);
+    if (capturing)
+    {
+        capture_finish(&capture);
+        printf("%llu captures recorded, %llu pre-trigger frames dropped for lack of buffer.\n",
+               (unsigned long long)capture.captures, (unsigned long long)capture.truncated);
+        capture_free(&capture);
+    }
+    if (aligning)
+    {
+        daq_align_flush(&aligner);
+        printf("%llu rows aligned, %llu emitted late, %llu forced out by full buffers, %llu samples dropped.\n",
+               (unsigned long long)aligner.stats.rows, (unsigned long long)aligner.stats.late_rows,
+               (unsigned long long)aligner.stats.forced_rows, (unsigned long long)aligner.stats.dropped_samples);
+        if (rows.file != stdout)
+            fclose(rows.file);
+        else
+            fflush(stdout);
+    }
+    recorder_close(&recorder);
+    if (cmd_fd >= 0)
+        close(cmd_fd);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,395 @@
+// Time-range queries and export over indexed XCP_DAQ recordings.
+//
+// CSV output has one row per sample: wall_time,daq_time,signal,value with
+// times in seconds. Packed binary output is a stream of records, each
+// starting with a tag byte:
+//   'N' uint16 id, uint8 length, name  - defines a signal id, before its first sample
+//   'S' uint64 wall_ns, uint64 daq_ns, uint16 id, float64 value
+// All integers and floats are little-endian.
+#define _XOPEN_SOURCE 700 // strptime
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "xcp_utils.h"
+#include "a2l.h"
+#include "daq_plan.h"
+#include "daq_decode.h"
+#include "recorder.h"
+#include "recording_index.h"
+#include "time_utils.h"
+
+#define MAX_QUERY_SIGNALS DAQ_MAX_SIGNALS
+#define MAX_OUTPUT_NAMES 65536 // Binary ids are uint16
+
+typedef enum
+{
+    OUTPUT_CSV,
+    OUTPUT_BINARY,
+} OutputFormat;
+
+typedef struct
+{
+    FILE *out;
+    OutputFormat format;
+    char (*names)[A2L_MAX_NAME]; // Binary output signal ids, grown as names turn up
+    int name_count;
+    int name_capacity;
+    bool failed; // Out of signal ids or memory, samples were left out
+} QueryOutput;
+
+#pragma pack(push, 1)
+typedef struct
+{
+    uint8_t tag;
+    uint64_t wall_ns;
+    uint64_t daq_ns;
+    uint16_t id;
+    double value;
+} PackedSample;
+#pragma pack(pop)
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-f from] [-t to] [-s signal]... [-F csv|bin] [-o output] [-i index] [recording]\n"
+           "       %s -l [-i index] [recording]\n"
+           "       %s -R [-a a2l_file] [recording] [SIGNAL[@EVENT] ...]\n"
+           "  Times are 'YYYY-MM-DD HH:MM:SS[.frac]' (local time) or seconds since the epoch.\n"
+           "  -l  Summarise the index\n"
+           "  -R  Rebuild the index of a recording from scratch. Rebuilt indexes have no\n"
+           "      host times, query them with DAQ time in seconds instead.\n",
+           prog, prog, prog);
+}
+
+// Parse a time argument into nanoseconds since the epoch.
+static int parse_time(const char *s, uint64_t *ns)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *rest = strptime(s, "%Y-%m-%d %H:%M:%S", &tm);
+    if (!rest)
+        rest = strptime(s, "%Y-%m-%dT%H:%M:%S", &tm);
+    if (rest)
+    {
+        tm.tm_isdst = -1;
+        time_t secs = mktime(&tm);
+        double frac = *rest == '.' ? atof(rest) : 0.0;
+        *ns = (uint64_t)secs * 1000000000ULL + (uint64_t)(frac * 1e9);
+        return 0;
+    }
+
+    char *end;
+    double secs = strtod(s, &end);
+    if (end == s || *end != '\0' || secs < 0)
+        return -1;
+    *ns = (uint64_t)(secs * 1e9);
+    return 0;
+}
+
+// Returns 0 with the name's id, defining it in the output the first time,
+// or -1 if there is no id left for it.
+static int output_name_id(QueryOutput *output, const char *name, uint16_t *id)
+{
+    for (int i = 0; i < output->name_count; i++)
+    {
+        if (strcmp(output->names[i], name) == 0)
+        {
+            *id = (uint16_t)i;
+            return 0;
+        }
+    }
+    if (output->name_count >= MAX_OUTPUT_NAMES)
+        return -1;
+    if (output->name_count == output->name_capacity)
+    {
+        int capacity = output->name_capacity ? output->name_capacity * 2 : 64;
+        void *names = realloc(output->names, (size_t)capacity * sizeof(*output->names));
+        if (!names)
+            return -1;
+        output->names = names;
+        output->name_capacity = capacity;
+    }
+
+    *id = (uint16_t)output->name_count++;
+    snprintf(output->names[*id], A2L_MAX_NAME, "%s", name);
+    uint8_t len = (uint8_t)strlen(output->names[*id]);
+    fputc('N', output->out);
+    fwrite(id, sizeof(*id), 1, output->out);
+    fwrite(&len, sizeof(len), 1, output->out);
+    fwrite(output->names[*id], 1, len, output->out);
+    return 0;
+}
+
+static void emit_sample(void *ctx, const RecordingQuerySample *s)
+{
+    QueryOutput *output = ctx;
+    const char *name = s->plan->signals[s->sample.signal].name;
+
+    if (output->format == OUTPUT_CSV)
+    {
+        fprintf(output->out, "%llu.%09llu,%.9f,%s,%.17g\n",
+                (unsigned long long)(s->wall_ns / 1000000000ULL), (unsigned long long)(s->wall_ns % 1000000000ULL),
+                s->sample.timestamp_ns / 1e9, name, s->sample.value);
+        return;
+    }
+
+    uint16_t id;
+    if (output_name_id(output, name, &id) < 0)
+    {
+        if (!output->failed)
+            fprintf(stderr, "No binary signal id left for %s (max %d), leaving its samples out.\n", name,
+                    MAX_OUTPUT_NAMES);
+        output->failed = true;
+        return;
+    }
+    PackedSample packed = {
+        .tag = 'S',
+        .wall_ns = s->wall_ns,
+        .daq_ns = s->sample.timestamp_ns,
+        .id = id,
+        .value = s->sample.value,
+    };
+    fwrite(&packed, sizeof(packed), 1, output->out);
+}
+
+static void print_summary(const RecordingIndex *index)
+{
+    uint64_t bytes = 0;
+    for (int c = 0; c < index->chunk_count; c++)
+        bytes += index->chunks[c].length;
+    printf("%d segment(s), %d chunk(s), %llu bytes indexed\n", index->segment_count, index->chunk_count,
+           (unsigned long long)bytes);
+
+    for (int s = 0; s < index->segment_count; s++)
+    {
+        int first = -1, last = -1;
+        for (int c = 0; c < index->chunk_count; c++)
+        {
+            if (index->chunk_segment[c] != s)
+                continue;
+            if (first < 0)
+                first = c;
+            last = c;
+        }
+        RecordingClock clock = index->segment_clocks[s];
+        printf("Segment %d (%s):", s, clock == RECORDING_CLOCK_DAQ ? "DAQ time" : "host time");
+        for (int i = 0; i < index->segments[s].signal_count; i++)
+            printf(" %s", index->segments[s].signals[i].name);
+        printf("\n");
+        if (first < 0)
+            continue;
+
+        const RecordingChunk *a = &index->chunks[first];
+        const RecordingChunk *b = &index->chunks[last];
+        uint64_t end = b->wall_ns + (b->last_ts_ns - b->first_ts_ns);
+        if (clock == RECORDING_CLOCK_DAQ)
+        {
+            printf("  %.3f s for %.3f s, chunks %d-%d\n", a->wall_ns / 1e9, (end - a->wall_ns) / 1e9, first, last);
+            continue;
+        }
+        time_t start_s = (time_t)(a->wall_ns / 1000000000ULL);
+        char when[64];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&start_s));
+        printf("  %s (%.3f) for %.3f s, chunks %d-%d\n", when, a->wall_ns / 1e9, (end - a->wall_ns) / 1e9, first, last);
+    }
+
+    if (index->capture_count > 0)
+        printf("%d triggered capture(s):\n", index->capture_count);
+    for (int c = 0; c < index->capture_count; c++)
+    {
+        const RecordingCapture *capture = &index->captures[c];
+        time_t trigger_s = (time_t)(capture->trigger_wall_ns / 1000000000ULL);
+        char when[64];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&trigger_s));
+        printf("  %s (%.3f) '%s', %.3f s before and %.3f s after, %llu bytes at offset %llu\n", when,
+               capture->trigger_wall_ns / 1e9, capture->trigger,
+               (capture->trigger_ts_ns - capture->first_ts_ns) / 1e9,
+               (capture->last_ts_ns - capture->trigger_ts_ns) / 1e9, (unsigned long long)capture->length,
+               (unsigned long long)capture->offset);
+    }
+}
+
+// Scan a whole recording and write a fresh index for it.
+static int rebuild_index(const char *data_file, const char *index_file, const DaqPlan *plan)
+{
+    FILE *f = fopen(data_file, "rb");
+    if (!f)
+    {
+        perror("Failed to open recording");
+        return -1;
+    }
+    remove(index_file);
+
+    DaqDecoder decoder;
+    RecordingIndexWriter writer;
+    XcpFrameReader reader;
+    DaqSample samples[DAQ_MAX_ENTRIES_PER_ODT];
+    uint64_t offset = 0;
+    daq_decoder_init(&decoder, plan);
+    xcp_reader_init(&reader);
+    if (index_writer_open(&writer, index_file, plan, &decoder, RECORDING_CLOCK_DAQ) < 0)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    while (1)
+    {
+        size_t space;
+        uint8_t *tail = xcp_reader_tail(&reader, &space);
+        size_t n = fread(tail, 1, space, f);
+        if (n == 0)
+            break;
+        xcp_reader_commit(&reader, n);
+
+        XcpFrame frame;
+        int r;
+        while ((r = xcp_reader_next(&reader, &frame)) > 0)
+        {
+            size_t len = XCP_TCP_HEADER_SIZE + frame.len;
+            index_writer_frame(&writer, offset, len);
+            offset += len;
+            if (xcp_classify_pid(frame.packet[0]) != XCP_PACKET_DAQ)
+                continue;
+            int count = daq_decode_dto(&decoder, frame.packet, frame.len, samples, DAQ_MAX_ENTRIES_PER_ODT);
+            if (count > 0)
+                index_writer_samples(&writer, samples, count);
+        }
+        if (r < 0)
+        {
+            fprintf(stderr, "Corrupt frame near offset %llu, index stops there.\n", (unsigned long long)offset);
+            break;
+        }
+    }
+
+    index_writer_close(&writer);
+    fclose(f);
+    printf("Indexed %llu bytes of %s into %s\n", (unsigned long long)offset, data_file, index_file);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *data_file = DEFAULT_RECORDING_FILE;
+    const char *index_arg = NULL;
+    const char *a2l_file = DEFAULT_A2L_FILE;
+    const char *output_file = NULL;
+    const char *signals[MAX_QUERY_SIGNALS];
+    int signal_count = 0;
+    uint64_t from_ns = 0, to_ns = UINT64_MAX;
+    bool summary = false, rebuild = false;
+    static QueryOutput output = {.format = OUTPUT_CSV};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:t:s:F:o:i:a:lRh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+        case 't':
+            if (parse_time(optarg, opt == 'f' ? &from_ns : &to_ns) < 0)
+            {
+                fprintf(stderr, "Invalid time: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            if (signal_count < MAX_QUERY_SIGNALS)
+                signals[signal_count++] = optarg;
+            break;
+        case 'F':
+            if (strcmp(optarg, "bin") == 0)
+                output.format = OUTPUT_BINARY;
+            else if (strcmp(optarg, "csv") == 0)
+                output.format = OUTPUT_CSV;
+            else
+            {
+                fprintf(stderr, "Unknown output format '%s', use csv or bin.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            output_file = optarg;
+            break;
+        case 'i':
+            index_arg = optarg;
+            break;
+        case 'a':
+            a2l_file = optarg;
+            break;
+        case 'l':
+            summary = true;
+            break;
+        case 'R':
+            rebuild = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind < argc)
+        data_file = argv[optind++];
+
+    char index_file[512];
+    if (index_arg)
+        snprintf(index_file, sizeof(index_file), "%s", index_arg);
+    else
+        snprintf(index_file, sizeof(index_file), "%s%s", data_file, RECORDING_INDEX_SUFFIX);
+
+    if (rebuild)
+    {
+        static A2lFile a2l;
+        static DaqPlan plan;
+        DaqSignalRequest requests[DAQ_MAX_SIGNALS];
+        int request_count = daq_parse_signal_args(argc - optind, argv + optind, requests);
+        if (request_count < 0 || a2l_load(&a2l, a2l_file) < 0 ||
+            daq_plan_layout(&plan, &a2l, requests, request_count) < 0)
+        {
+            return 1;
+        }
+        return rebuild_index(data_file, index_file, &plan) < 0 ? 1 : 0;
+    }
+
+    uint64_t t0 = time_now_ns();
+    RecordingIndex index;
+    if (recording_index_load(&index, index_file) < 0)
+    {
+        fprintf(stderr, "No index for %s, create one with: %s -R %s\n", data_file, argv[0], data_file);
+        return 1;
+    }
+
+    if (summary)
+    {
+        print_summary(&index);
+        recording_index_free(&index);
+        return 0;
+    }
+
+    output.out = output_file ? fopen(output_file, output.format == OUTPUT_BINARY ? "wb" : "w") : stdout;
+    if (!output.out)
+    {
+        perror("Failed to open output");
+        recording_index_free(&index);
+        return 1;
+    }
+    if (output.format == OUTPUT_CSV)
+        fprintf(output.out, "wall_time,daq_time,signal,value\n");
+
+    RecordingQueryStats stats;
+    int result = recording_query(&index, data_file, from_ns, to_ns, signals, signal_count, emit_sample, &output, &stats);
+    fflush(output.out);
+    if (output_file)
+        fclose(output.out);
+
+    fprintf(stderr, "Read %d of %d chunk(s), %llu bytes, %llu frames decoded, %llu samples out in %.3f ms\n",
+            stats.chunks_read, stats.chunks_total, (unsigned long long)stats.bytes_read,
+            (unsigned long long)stats.frames_decoded, (unsigned long long)stats.samples_emitted,
+            (time_now_ns() - t0) / 1e6);
+    recording_index_free(&index);
+    free(output.names);
+    return result < 0 || output.failed ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+// Minimal live viewer: subscribes to signals on XCP_DAQ and prints their
+// latest values as updates arrive.
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "daq_plan.h"
+#include "live_stream.h"
+
+static volatile int keep_running = 1;
+
+void handle_sigint(int sig)
+{
+    (void)sig;
+    keep_running = 0;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-r max_rate_hz] [-L live_socket] [SIGNAL ...]\n"
+           "  Prints the latest value of each signal, at most max_rate_hz (1 to %d, default %d) times a second.\n",
+           prog, LIVE_MAX_RATE_HZ, LIVE_DEFAULT_RATE_HZ);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *live_path = LIVE_STREAM_PATH;
+    uint32_t rate_hz = LIVE_DEFAULT_RATE_HZ;
+    static const char *default_signals[] = DAQ_DEFAULT_SIGNALS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:L:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+        {
+            char *end;
+            long rate = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || rate < 1 || rate > LIVE_MAX_RATE_HZ)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            rate_hz = (uint32_t)rate;
+            break;
+        }
+        case 'L':
+            live_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    const char *const *names = (const char *const *)argv + optind;
+    int count = argc - optind;
+    if (count == 0)
+    {
+        names = default_signals;
+        count = (int)(sizeof(default_signals) / sizeof(default_signals[0]));
+    }
+    if (count > DAQ_MAX_SIGNALS)
+    {
+        fprintf(stderr, "At most %d signals.\n", DAQ_MAX_SIGNALS);
+        return 1;
+    }
+
+    signal(SIGINT, handle_sigint);
+
+    int16_t status[DAQ_MAX_SIGNALS];
+    int fd = live_subscribe(live_path, names, count, rate_hz, status);
+    if (fd < 0)
+        return 1;
+    for (int i = 0; i < count; i++)
+    {
+        if (status[i] < 0)
+            fprintf(stderr, "XCP_DAQ does not record %s.\n", names[i]);
+    }
+
+    LiveValue values[DAQ_MAX_SIGNALS];
+    double latest[DAQ_MAX_SIGNALS] = {0};
+    uint64_t updates = 0;
+    while (keep_running)
+    {
+        uint64_t publish_ns;
+        int n = live_receive(fd, values, DAQ_MAX_SIGNALS, &publish_ns);
+        if (n <= 0)
+        {
+            if (keep_running)
+                printf("XCP_DAQ closed the live stream.\n");
+            break;
+        }
+
+        uint64_t timestamp_ns = 0;
+        for (int i = 0; i < n; i++)
+        {
+            if (values[i].id >= count)
+                continue;
+            latest[values[i].id] = values[i].value;
+            if (values[i].timestamp_ns > timestamp_ns)
+                timestamp_ns = values[i].timestamp_ns;
+        }
+
+        printf("%.6f", timestamp_ns / 1e9);
+        for (int i = 0; i < count; i++)
+        {
+            if (status[i] == 0)
+                printf(" %s=%g", names[i], latest[i]);
+        }
+        printf("\n");
+        fflush(stdout);
+        updates++;
+    }
+
+    printf("%llu updates received.\n", (unsigned long long)updates);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "time_utils.h"
+
+#define BENCH_MAX_ITERATIONS (1ULL << 32)
+
+static volatile uint64_t bench_sink;
+
+void bench_consume(uint64_t value)
+{
+    bench_sink += value;
+}
+
+void bench_config_init(BenchConfig *config)
+{
+    config->warmup = 3;
+    config->repetitions = 30;
+    config->min_rep_ns = 2000000; // 2 ms
+    config->filter = NULL;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int count, double p)
+{
+    int index = (int)(p * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+int bench_run(const BenchConfig *config, const BenchCase *bench, BenchResult *result)
+{
+    void *ctx = bench->setup ? bench->setup() : NULL;
+    if (bench->setup && !ctx)
+    {
+        fprintf(stderr, "Setup failed for %s\n", bench->name);
+        return -1;
+    }
+
+    // Calibrate: grow the batch until one repetition is long enough.
+    uint64_t iterations = 1;
+    while (iterations < BENCH_MAX_ITERATIONS)
+    {
+        uint64_t t0 = time_now_ns();
+        bench->fn(ctx, iterations);
+        if (time_now_ns() - t0 >= config->min_rep_ns)
+            break;
+        iterations *= 2;
+    }
+
+    for (int i = 0; i < config->warmup; i++)
+        bench->fn(ctx, iterations);
+
+    int reps = config->repetitions;
+    if (reps < 1)
+        reps = 1;
+    if (reps > BENCH_MAX_REPS)
+        reps = BENCH_MAX_REPS;
+
+    double samples[BENCH_MAX_REPS];
+    double total = 0;
+    for (int i = 0; i < reps; i++)
+    {
+        uint64_t t0 = time_now_ns();
+        bench->fn(ctx, iterations);
+        samples[i] = (double)(time_now_ns() - t0) / (double)iterations;
+        total += samples[i];
+    }
+
+    if (bench->teardown)
+        bench->teardown(ctx);
+
+    qsort(samples, (size_t)reps, sizeof(samples[0]), compare_double);
+    memset(result, 0, sizeof(*result));
+    snprintf(result->name, sizeof(result->name), "%s", bench->name);
+    result->iterations = iterations;
+    result->repetitions = reps;
+    result->mean_ns = total / reps;
+    result->p50_ns = percentile(samples, reps, 0.50);
+    result->p90_ns = percentile(samples, reps, 0.90);
+    result->p99_ns = percentile(samples, reps, 0.99);
+    result->min_ns = samples[0];
+    result->max_ns = samples[reps - 1];
+    return 0;
+}
+
+void bench_print_header(FILE *out)
+{
+    fprintf(out, "%-28s %12s %10s %10s %10s %10s %10s\n",
+            "benchmark", "iters/rep", "mean ns", "p50 ns", "p90 ns", "p99 ns", "max ns");
+}
+
+void bench_print_result(FILE *out, const BenchResult *r)
+{
+    fprintf(out, "%-28s %12llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            r->name, (unsigned long long)r->iterations, r->mean_ns, r->p50_ns, r->p90_ns, r->p99_ns, r->max_ns);
+}
+
+int bench_write_csv(const char *filename, const BenchResult *results, int count)
+{
+    FILE *f = fopen(filename, "w");
+    if (!f)
+    {
+        perror("Failed to write benchmark results");
+        return -1;
+    }
+    fprintf(f, "name,iterations,repetitions,mean_ns,p50_ns,p90_ns,p99_ns,min_ns,max_ns\n");
+    for (int i = 0; i < count; i++)
+    {
+        const BenchResult *r = &results[i];
+        fprintf(f, "%s,%llu,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                r->name, (unsigned long long)r->iterations, r->repetitions,
+                r->mean_ns, r->p50_ns, r->p90_ns, r->p99_ns, r->min_ns, r->max_ns);
+    }
+    fclose(f);
+    return 0;
+}
+
+int bench_read_csv(const char *filename, BenchResult *results, int max)
+{
+    FILE *f = fopen(filename, "r");
+    if (!f)
+        return -1;
+
+    char line[512];
+    int count = 0;
+    if (!fgets(line, sizeof(line), f)) // header
+    {
+        fclose(f);
+        return 0;
+    }
+    while (count < max && fgets(line, sizeof(line), f))
+    {
+        BenchResult *r = &results[count];
+        unsigned long long iterations;
+        memset(r, 0, sizeof(*r));
+        if (sscanf(line, "%63[^,],%llu,%d,%lf,%lf,%lf,%lf,%lf,%lf", r->name, &iterations, &r->repetitions,
+                   &r->mean_ns, &r->p50_ns, &r->p90_ns, &r->p99_ns, &r->min_ns, &r->max_ns) == 9)
+        {
+            r->iterations = iterations;
+            count++;
+        }
+    }
+    fclose(f);
+    return count;
+}
+
+int bench_compare(const BenchResult *results, int count, const BenchResult *baseline, int baseline_count,
+                  double threshold)
+{
+    int regressions = 0;
+    printf("\n%-28s %12s %12s %9s\n", "benchmark", "base p50 ns", "p50 ns", "change");
+    for (int i = 0; i < count; i++)
+    {
+        const BenchResult *base = NULL;
+        for (int j = 0; j < baseline_count; j++)
+        {
+            if (strcmp(baseline[j].name, results[i].name) == 0)
+                base = &baseline[j];
+        }
+        if (!base || base->p50_ns <= 0)
+        {
+            printf("%-28s %12s %12.1f %9s\n", results[i].name, "-", results[i].p50_ns, "new");
+            continue;
+        }
+
+        double change = results[i].p50_ns / base->p50_ns - 1.0;
+        int regressed = change > threshold;
+        regressions += regressed;
+        printf("%-28s %12.1f %12.1f %+8.1f%%%s\n", results[i].name, base->p50_ns, results[i].p50_ns,
+               change * 100.0, regressed ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
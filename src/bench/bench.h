@@ -0,0 +1,84 @@
+// Microbenchmark harness - warmup, repetitions, percentiles and baseline comparison
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define BENCH_MAX_CASES 64
+#define BENCH_MAX_REPS 1000
+
+/**
+ * @brief Run the operation under test `iterations` times.
+ * @param ctx Context returned by the case's setup function.
+ */
+typedef void (*BenchFn)(void *ctx, uint64_t iterations);
+
+typedef struct
+{
+    const char *name;
+    void *(*setup)(void);     // Optional, result is passed to fn
+    BenchFn fn;
+    void (*teardown)(void *); // Optional
+} BenchCase;
+
+typedef struct
+{
+    int warmup;           // Untimed repetitions before measuring
+    int repetitions;      // Timed repetitions, one sample each
+    uint64_t min_rep_ns;  // Each repetition runs at least this long
+    const char *filter;   // Only run cases whose name contains this
+} BenchConfig;
+
+typedef struct
+{
+    char name[64];
+    uint64_t iterations; // Per repetition
+    int repetitions;
+    double mean_ns;      // Per operation
+    double p50_ns;
+    double p90_ns;
+    double p99_ns;
+    double min_ns;
+    double max_ns;
+} BenchResult;
+
+void bench_config_init(BenchConfig *config);
+
+/**
+ * @brief Run one case and fill in its per-operation timing.
+ * @return 0 on success, -1 if setup failed.
+ * @note The iteration count per repetition is calibrated during warmup so a
+ * repetition lasts at least min_rep_ns, keeping clock overhead negligible.
+ */
+int bench_run(const BenchConfig *config, const BenchCase *bench, BenchResult *result);
+
+void bench_print_header(FILE *out);
+void bench_print_result(FILE *out, const BenchResult *result);
+
+/**
+ * @brief Write results as CSV, one line per case after a header line.
+ * @return 0 on success, -1 if the file could not be written.
+ */
+int bench_write_csv(const char *filename, const BenchResult *results, int count);
+
+/**
+ * @brief Read results written by bench_write_csv().
+ * @return Number of results read, or -1 if the file could not be read.
+ */
+int bench_read_csv(const char *filename, BenchResult *results, int max);
+
+/**
+ * @brief Compare results against a baseline by median time per operation.
+ * @param threshold Allowed relative slowdown, e.g. 0.10 for 10%.
+ * @return Number of cases that regressed beyond the threshold.
+ */
+int bench_compare(const BenchResult *results, int count, const BenchResult *baseline, int baseline_count,
+                  double threshold);
+
+/**
+ * @brief Keep a value alive so the compiler cannot optimise the work away.
+ */
+void bench_consume(uint64_t value);
+
+#endif // BENCH_H
@@ -0,0 +1,498 @@
+// Microbenchmarks for the hot paths of CMD and XCP_DAQ
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "bench.h"
+#include "state.h"
+#include "forward.h"
+#include "xcp_utils.h"
+#include "a2l.h"
+#include "daq_plan.h"
+#include "daq_decode.h"
+#include "recorder.h"
+
+#define DEFAULT_RESULTS_FILE "bench_results.csv"
+#define DEFAULT_THRESHOLD_PERCENT 10.0
+#define FRAME_COUNT 1024
+
+// Temporary files are created here and removed after each case.
+static char tmp_dir[256] = "/tmp";
+
+static void tmp_path(char *path, size_t size, const char *name)
+{
+    snprintf(path, size, "%s/bench_%d_%s", tmp_dir, (int)getpid(), name);
+}
+
+// --- DAQ layouts built from a synthetic A2L, no file needed ---
+
+static void add_measurement(A2lFile *a2l, const char *name, A2lDataType type, uint32_t address)
+{
+    A2lMeasurement *m = &a2l->measurements[a2l->measurement_count++];
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    m->type = type;
+    m->address = address;
+}
+
+// Two FLOAT64 signals, the SIMPLE_RT layout, or 32 signals of mixed types.
+static int build_plan(DaqPlan *plan, int wide)
+{
+    static A2lFile a2l;
+    static const A2lDataType types[] = {A2L_FLOAT64_IEEE, A2L_FLOAT32_IEEE, A2L_SLONG, A2L_UWORD, A2L_UBYTE};
+    DaqSignalRequest requests[32];
+    int count = wide ? 32 : 2;
+
+    memset(&a2l, 0, sizeof(a2l));
+    a2l.max_dto = 0xFFFC;
+    a2l.timestamp_size = 4;
+    a2l.timestamp_ns_per_tick = 1000;
+    a2l.event_count = 1;
+    snprintf(a2l.events[0].name, sizeof(a2l.events[0].name), "50 ms");
+    a2l.events[0].time_cycle = 5;
+    a2l.events[0].time_unit = 7;
+
+    for (int i = 0; i < count; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "SIG_%d", i);
+        add_measurement(&a2l, name, wide ? types[i % 5] : A2L_FLOAT64_IEEE, 0x1000 + 8 * i);
+        memset(&requests[i], 0, sizeof(requests[i]));
+        snprintf(requests[i].name, sizeof(requests[i].name), "%s", name);
+    }
+    return daq_plan_layout(plan, &a2l, requests, count);
+}
+
+// Build FRAME_COUNT back to back DTO frames for the plan.
+static size_t build_stream(const DaqPlan *plan, uint8_t *stream, size_t size)
+{
+    size_t len = 0;
+    uint32_t ts = 0;
+    for (int i = 0; i < FRAME_COUNT; i++)
+    {
+        const DaqListPlan *list = &plan->lists[0];
+        int o = i % list->odt_count;
+        const DaqOdt *odt = &list->odts[o];
+        if (len + XCP_TCP_HEADER_SIZE + odt->size > size)
+            break;
+
+        uint8_t *f = stream + len;
+        f[0] = (uint8_t)odt->size;
+        f[1] = (uint8_t)(odt->size >> 8);
+        f[2] = (uint8_t)i;
+        f[3] = (uint8_t)(i >> 8);
+        uint8_t *p = f + XCP_TCP_HEADER_SIZE;
+        for (int b = 0; b < odt->size; b++)
+            p[b] = (uint8_t)(i + b);
+        p[0] = (uint8_t)(list->first_pid + o);
+        if (o == 0)
+        {
+            ts += 50000;
+            memcpy(p + 1, &ts, sizeof(ts));
+        }
+        len += XCP_TCP_HEADER_SIZE + odt->size;
+    }
+    return len;
+}
+
+// --- State persistence (CMD cache files) ---
+
+typedef struct
+{
+    XcpSessionState state;
+    char path[512];
+    uint8_t packet[25];
+} StateCtx;
+
+static void *state_setup(void)
+{
+    StateCtx *ctx = calloc(1, sizeof(StateCtx));
+    tmp_path(ctx->path, sizeof(ctx->path), "state.bin");
+    memset(ctx->packet, 0xAB, sizeof(ctx->packet));
+    return ctx;
+}
+
+static void state_teardown(void *p)
+{
+    StateCtx *ctx = p;
+    unlink(ctx->path);
+    free(ctx);
+}
+
+static void bench_state_add_packet(void *p, uint64_t iterations)
+{
+    StateCtx *ctx = p;
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        if (ctx->state.packet_count >= MAX_XCP_PACKETS)
+            ctx->state.packet_count = 0; // Full, start over without touching the file
+        add_xcp_packet(&ctx->state, ctx->packet, sizeof(ctx->packet), ctx->path);
+    }
+}
+
+static void bench_state_load(void *p, uint64_t iterations)
+{
+    StateCtx *ctx = p;
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        if (i == 0)
+            save_xcp_state(&ctx->state, ctx->path);
+        bench_consume((uint64_t)load_xcp_state(&ctx->state, ctx->path));
+    }
+}
+
+// --- Frame parsing and classification ---
+
+typedef struct
+{
+    DaqPlan plan;
+    DaqDecoder decoder;
+    uint8_t stream[FRAME_COUNT * XCP_MAX_FRAME_SIZE];
+    size_t stream_len;
+    XcpFrameReader reader;
+} StreamCtx;
+
+static void *stream_setup_narrow(void)
+{
+    StreamCtx *ctx = calloc(1, sizeof(StreamCtx));
+    if (build_plan(&ctx->plan, 0) < 0)
+    {
+        free(ctx);
+        return NULL;
+    }
+    ctx->stream_len = build_stream(&ctx->plan, ctx->stream, sizeof(ctx->stream));
+    daq_decoder_init(&ctx->decoder, &ctx->plan);
+    return ctx;
+}
+
+static void *stream_setup_wide(void)
+{
+    StreamCtx *ctx = calloc(1, sizeof(StreamCtx));
+    if (build_plan(&ctx->plan, 1) < 0)
+    {
+        free(ctx);
+        return NULL;
+    }
+    ctx->stream_len = build_stream(&ctx->plan, ctx->stream, sizeof(ctx->stream));
+    daq_decoder_init(&ctx->decoder, &ctx->plan);
+    return ctx;
+}
+
+// Parse the frame at *off and advance, wrapping around the prebuilt stream.
+static void next_frame(const StreamCtx *ctx, size_t *off, XcpFrame *frame)
+{
+    *off += (size_t)xcp_parse_frame(ctx->stream + *off, ctx->stream_len - *off, frame);
+    if (*off >= ctx->stream_len)
+        *off = 0;
+}
+
+static void bench_frame_parse(void *p, uint64_t iterations)
+{
+    StreamCtx *ctx = p;
+    XcpFrame frame;
+    size_t off = 0;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        next_frame(ctx, &off, &frame);
+        sum += frame.len;
+    }
+    bench_consume(sum);
+}
+
+static void bench_frame_reader(void *p, uint64_t iterations)
+{
+    StreamCtx *ctx = p;
+    XcpFrame frame;
+    uint64_t frames = 0;
+    size_t off = 0;
+    xcp_reader_init(&ctx->reader);
+
+    // Feed the stream in recv()-sized chunks, one iteration per frame out.
+    while (frames < iterations)
+    {
+        size_t chunk = ctx->stream_len - off < 1500 ? ctx->stream_len - off : 1500;
+        size_t taken = xcp_reader_push(&ctx->reader, ctx->stream + off, chunk);
+        off = off + taken >= ctx->stream_len ? 0 : off + taken;
+        while (frames < iterations && xcp_reader_next(&ctx->reader, &frame) > 0)
+            frames++;
+    }
+    bench_consume(frames);
+}
+
+static void bench_pid_classify(void *p, uint64_t iterations)
+{
+    (void)p;
+    uint64_t daq = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+        daq += xcp_classify_pid((uint8_t)(i * 37)) == XCP_PACKET_DAQ;
+    bench_consume(daq);
+}
+
+static void bench_dto_decode(void *p, uint64_t iterations)
+{
+    StreamCtx *ctx = p;
+    XcpFrame frame;
+    DaqSample samples[DAQ_MAX_ENTRIES_PER_ODT];
+    size_t off = 0;
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        next_frame(ctx, &off, &frame);
+        count += (uint64_t)daq_decode_dto(&ctx->decoder, frame.packet, frame.len, samples, DAQ_MAX_ENTRIES_PER_ODT);
+    }
+    bench_consume(count);
+}
+
+// --- Storage writes (xcp_data.bin) ---
+
+typedef struct
+{
+    Recorder recorder;
+    char path[512];
+    uint8_t frame[25];
+} RecorderCtx;
+
+static void *recorder_setup(void)
+{
+    RecorderCtx *ctx = calloc(1, sizeof(RecorderCtx));
+    tmp_path(ctx->path, sizeof(ctx->path), "recording.bin");
+    if (recorder_open(&ctx->recorder, ctx->path) < 0)
+    {
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+static void recorder_teardown(void *p)
+{
+    RecorderCtx *ctx = p;
+    recorder_close(&ctx->recorder);
+    unlink(ctx->path);
+    free(ctx);
+}
+
+static void bench_recorder_write(void *p, uint64_t iterations)
+{
+    RecorderCtx *ctx = p;
+    for (uint64_t i = 0; i < iterations; i++)
+        recorder_write(&ctx->recorder, ctx->frame, sizeof(ctx->frame));
+    recorder_flush(&ctx->recorder);
+}
+
+// XCP_DAQ flushes after every recv, worst case one frame per recv.
+static void bench_recorder_write_flush(void *p, uint64_t iterations)
+{
+    RecorderCtx *ctx = p;
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        recorder_write(&ctx->recorder, ctx->frame, sizeof(ctx->frame));
+        recorder_flush(&ctx->recorder);
+    }
+}
+
+// --- CMD forward path: RT_EXE -> CMD -> XCP_DAQ over socketpairs ---
+
+typedef struct
+{
+    int rt_pair[2];  // [0] is the RT_EXE end, [1] is CMD's RT_EXE socket
+    int daq_pair[2]; // [0] is CMD's XCP_DAQ socket, [1] is the XCP_DAQ end
+    SocketHandles sockets;
+    Forwarder forwarder;
+    XcpSessionState cache;
+    uint8_t frame[25];
+    int saved_stdout;
+} ForwardCtx;
+
+static void *forward_setup_type(int rt_type)
+{
+    ForwardCtx *ctx = calloc(1, sizeof(ForwardCtx));
+    if (socketpair(AF_UNIX, rt_type, 0, ctx->rt_pair) < 0 ||
+        socketpair(AF_UNIX, SOCK_STREAM, 0, ctx->daq_pair) < 0)
+    {
+        perror("socketpair");
+        free(ctx);
+        return NULL;
+    }
+    ctx->sockets = (SocketHandles){ctx->rt_pair[1], -1, ctx->daq_pair[0], -1};
+    forwarder_init(&ctx->forwarder);
+    // One DTO frame: LEN, CTR, PID 0 and 20 bytes of data
+    memset(ctx->frame, 0x11, sizeof(ctx->frame));
+    ctx->frame[0] = sizeof(ctx->frame) - XCP_TCP_HEADER_SIZE;
+    ctx->frame[1] = 0;
+    ctx->frame[4] = 0;
+
+    // CMD logs every forwarded packet, keep that cost but not the noise.
+    fflush(stdout);
+    ctx->saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+    return ctx;
+}
+
+static void *forward_setup(void)
+{
+    return forward_setup_type(SOCK_STREAM);
+}
+
+// Datagram socketpair standing in for XCP on UDP
+static void *forward_setup_udp(void)
+{
+    return forward_setup_type(SOCK_DGRAM);
+}
+
+static void forward_teardown(void *p)
+{
+    ForwardCtx *ctx = p;
+    fflush(stdout);
+    dup2(ctx->saved_stdout, STDOUT_FILENO);
+    close(ctx->saved_stdout);
+    close(ctx->rt_pair[0]);
+    close(ctx->rt_pair[1]);
+    close(ctx->daq_pair[0]);
+    close(ctx->daq_pair[1]);
+    forwarder_free(&ctx->forwarder);
+    free(ctx);
+}
+
+static void bench_cmd_forward(void *p, uint64_t iterations)
+{
+    ForwardCtx *ctx = p;
+    uint8_t buf[256];
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        size_t space;
+        send(ctx->rt_pair[0], ctx->frame, sizeof(ctx->frame), 0);
+        uint8_t *rx = forwarder_rx_tail(&ctx->forwarder, &space);
+        ssize_t n = recv(ctx->sockets.rt_exe_fd, rx, space, 0);
+        forward_rt_exe_data(&ctx->forwarder, &ctx->sockets, &ctx->cache, (size_t)n);
+        bench_consume((uint64_t)recv(ctx->daq_pair[1], buf, sizeof(buf), 0));
+    }
+}
+
+static void bench_cmd_forward_udp(void *p, uint64_t iterations)
+{
+    ForwardCtx *ctx = p;
+    uint8_t buf[256];
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        ctx->frame[2] = (uint8_t)i; // Keep the CTR in sequence
+        ctx->frame[3] = (uint8_t)(i >> 8);
+        send(ctx->rt_pair[0], ctx->frame, sizeof(ctx->frame), 0);
+        forward_rt_exe_udp(&ctx->forwarder, &ctx->sockets, &ctx->cache);
+        bench_consume((uint64_t)recv(ctx->daq_pair[1], buf, sizeof(buf), 0));
+    }
+}
+
+static const BenchCase cases[] = {
+    {"state_add_packet", state_setup, bench_state_add_packet, state_teardown},
+    {"state_load", state_setup, bench_state_load, state_teardown},
+    {"frame_parse", stream_setup_narrow, bench_frame_parse, free},
+    {"frame_reader", stream_setup_narrow, bench_frame_reader, free},
+    {"pid_classify", NULL, bench_pid_classify, NULL},
+    {"dto_decode_2xf64", stream_setup_narrow, bench_dto_decode, free},
+    {"dto_decode_32_mixed", stream_setup_wide, bench_dto_decode, free},
+    {"recorder_write", recorder_setup, bench_recorder_write, recorder_teardown},
+    {"recorder_write_flush", recorder_setup, bench_recorder_write_flush, recorder_teardown},
+    {"cmd_forward", forward_setup, bench_cmd_forward, forward_teardown},
+    {"cmd_forward_udp", forward_setup_udp, bench_cmd_forward_udp, forward_teardown},
+};
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-r repetitions] [-w warmup] [-t min_rep_ms] [-f filter] [-o results.csv]\n"
+           "          [-b baseline.csv] [-T threshold_percent] [-d tmp_dir] [-l]\n"
+           "  -b  Compare against a saved results file, exit 1 on regressions\n"
+           "  -l  List benchmarks and exit\n",
+           prog);
+}
+
+int main(int argc, char *argv[])
+{
+    BenchConfig config;
+    const char *results_file = DEFAULT_RESULTS_FILE;
+    const char *baseline_file = NULL;
+    double threshold = DEFAULT_THRESHOLD_PERCENT / 100.0;
+    int case_count = (int)(sizeof(cases) / sizeof(cases[0]));
+    bench_config_init(&config);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:w:t:f:o:b:T:d:lh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            config.repetitions = atoi(optarg);
+            break;
+        case 'w':
+            config.warmup = atoi(optarg);
+            break;
+        case 't':
+            config.min_rep_ns = (uint64_t)(atof(optarg) * 1e6);
+            break;
+        case 'f':
+            config.filter = optarg;
+            break;
+        case 'o':
+            results_file = optarg;
+            break;
+        case 'b':
+            baseline_file = optarg;
+            break;
+        case 'T':
+            threshold = atof(optarg) / 100.0;
+            break;
+        case 'd':
+            snprintf(tmp_dir, sizeof(tmp_dir), "%s", optarg);
+            break;
+        case 'l':
+            for (int i = 0; i < case_count; i++)
+                printf("%s\n", cases[i].name);
+            return 0;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    static BenchResult results[BENCH_MAX_CASES];
+    int count = 0;
+    bench_print_header(stdout);
+    for (int i = 0; i < case_count; i++)
+    {
+        if (config.filter && !strstr(cases[i].name, config.filter))
+            continue;
+        if (bench_run(&config, &cases[i], &results[count]) < 0)
+            return 1;
+        bench_print_result(stdout, &results[count]);
+        fflush(stdout);
+        count++;
+    }
+
+    if (bench_write_csv(results_file, results, count) < 0)
+        return 1;
+    printf("Results written to %s\n", results_file);
+
+    if (baseline_file)
+    {
+        static BenchResult baseline[BENCH_MAX_CASES];
+        int baseline_count = bench_read_csv(baseline_file, baseline, BENCH_MAX_CASES);
+        if (baseline_count < 0)
+        {
+            fprintf(stderr, "No baseline at %s, save one with: make bench-baseline\n", baseline_file);
+            return 0;
+        }
+        int regressions = bench_compare(results, count, baseline, baseline_count, threshold);
+        if (regressions > 0)
+        {
+            printf("%d benchmark(s) regressed by more than %.0f%%.\n", regressions, threshold * 100.0);
+            return 1;
+        }
+        printf("No regressions beyond %.0f%%.\n", threshold * 100.0);
+    }
+    return 0;
+}
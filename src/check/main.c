@@ -0,0 +1,275 @@
+// Regression checks for failure paths the apps are hard to drive into by hand
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "recording_index.h"
+#include "daq_plan.h"
+#include "forward.h"
+#include "replica.h"
+
+#define CHECK(cond)                                                                                                \
+    do                                                                                                             \
+    {                                                                                                              \
+        if (!(cond))                                                                                               \
+        {                                                                                                          \
+            fprintf(stderr, "  %s:%d: %s\n", __FILE__, __LINE__, #cond);                                            \
+            return -1;                                                                                             \
+        }                                                                                                          \
+    } while (0)
+
+typedef struct
+{
+    const char *name;
+    int (*run)(void);
+} Check;
+
+static char tmp_dir[256] = "/tmp";
+
+static void tmp_path(char *path, size_t size, const char *name)
+{
+    snprintf(path, size, "%s/check_%d_%s", tmp_dir, (int)getpid(), name);
+}
+
+// A crash mid-record followed by a restart must leave the earlier chunks
+// and the new segment loadable.
+static int check_index_crash_restart(void)
+{
+    char path[512];
+    tmp_path(path, sizeof(path), "index.idx");
+    remove(path);
+
+    static DaqPlan plan;
+    DaqDecoder decoder;
+    RecordingIndexWriter writer;
+    daq_decoder_init(&decoder, &plan);
+
+    // Two chunks, the second of which the crash cuts short
+    CHECK(index_writer_open(&writer, path, &plan, &decoder, RECORDING_CLOCK_DAQ) == 0);
+    index_writer_frame(&writer, 0, RECORDING_CHUNK_BYTES);
+    index_writer_frame(&writer, RECORDING_CHUNK_BYTES, 100);
+    index_writer_close(&writer);
+    FILE *f = fopen(path, "r+b");
+    CHECK(f != NULL);
+    fseek(f, 0, SEEK_END);
+    CHECK(ftruncate(fileno(f), ftell(f) - 20) == 0);
+    fclose(f);
+
+    CHECK(index_writer_open(&writer, path, &plan, &decoder, RECORDING_CLOCK_DAQ) == 0);
+    index_writer_frame(&writer, RECORDING_CHUNK_BYTES + 100, 100);
+    index_writer_close(&writer);
+
+    RecordingIndex index;
+    int loaded = recording_index_load(&index, path);
+    remove(path);
+    CHECK(loaded == 0);
+    CHECK(index.segment_count == 2);
+    CHECK(index.chunk_count == 2);
+    CHECK(index.chunks[0].offset == 0 && index.chunk_segment[0] == 0);
+    CHECK(index.chunks[1].offset == RECORDING_CHUNK_BYTES + 100 && index.chunk_segment[1] == 1);
+    recording_index_free(&index);
+    return 0;
+}
+
+// The forwarder reports every send and drop, send that to /dev/null while a
+// check drives it.
+typedef struct
+{
+    int out;
+    int err;
+} SavedOutput;
+
+static SavedOutput quiet_output(void)
+{
+    fflush(stdout);
+    fflush(stderr);
+    SavedOutput saved = {dup(STDOUT_FILENO), dup(STDERR_FILENO)};
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0)
+    {
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+    return saved;
+}
+
+static void restore_output(SavedOutput saved)
+{
+    fflush(stdout);
+    fflush(stderr);
+    if (saved.out >= 0)
+    {
+        dup2(saved.out, STDOUT_FILENO);
+        close(saved.out);
+    }
+    if (saved.err >= 0)
+    {
+        dup2(saved.err, STDERR_FILENO);
+        close(saved.err);
+    }
+}
+
+// An XCP_DAQ that never reads must neither block the forwarder nor keep the
+// pool exhausted: it is disconnected and its frames go to the cache.
+static int check_forward_reclaim(void)
+{
+    static Forwarder fwd;
+    static XcpSessionState cache;
+    int sv[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0); // Blocking, as accept() leaves them
+    CHECK(forwarder_init(&fwd) == 0);
+    SocketHandles sockets = {.rt_exe_fd = -1, .xcp_cmd_fd = -1, .xcp_daq_fd = sv[0], .client_server_fd = -1};
+
+    char cwd[512];
+    CHECK(getcwd(cwd, sizeof(cwd)) != NULL);
+    CHECK(chdir(tmp_dir) == 0); // The cache file is written to the working directory
+    SavedOutput saved = quiet_output();
+    alarm(10); // A blocking send would hang here for good
+
+    int reclaims = 0, stuck = 0;
+    uint16_t ctr = 0;
+    for (int i = 0; i < 2000 && !stuck; i++)
+    {
+        size_t space;
+        uint8_t *buf = forwarder_rx_tail(&fwd, &space);
+        if (buf == NULL)
+        {
+            reclaims++;
+            forwarder_reclaim(&fwd, &sockets, &cache);
+            buf = forwarder_rx_tail(&fwd, &space);
+        }
+        if (buf == NULL)
+        {
+            stuck = 1;
+            break;
+        }
+        size_t n = 0;
+        for (; n + 14 <= space && n < 4000; n += 14, ctr++)
+        {
+            uint8_t frame[14] = {10, 0, (uint8_t)ctr, (uint8_t)(ctr >> 8), 0x00}; // A DAQ packet
+            memcpy(buf + n, frame, sizeof(frame));
+        }
+        forward_rt_exe_data(&fwd, &sockets, &cache, n);
+    }
+
+    alarm(0);
+    restore_output(saved);
+    remove(XCP_DAQ_CACHE_FILE);
+    CHECK(chdir(cwd) == 0);
+    close(sv[1]);
+    if (sockets.xcp_daq_fd >= 0)
+        close(sockets.xcp_daq_fd);
+    ForwardStats stats = fwd.stats;
+    forwarder_free(&fwd);
+
+    CHECK(!stuck);
+    CHECK(reclaims > 0);
+    CHECK(sockets.xcp_daq_fd == -1);
+    CHECK(stats.cached_frames > 0);
+    return 0;
+}
+
+// Lists on different event channels still fire together once per
+// hyperperiod, the peak load has to count all of them.
+static int check_daq_peak_load(void)
+{
+    static DaqPlan plan;
+    memset(&plan, 0, sizeof(plan));
+    plan.list_count = 2;
+    for (int l = 0; l < plan.list_count; l++)
+    {
+        plan.lists[l].event_channel = (uint16_t)l;
+        plan.lists[l].event_period_us = 1000 * (uint64_t)(l + 1); // 1 ms and 2 ms
+        plan.lists[l].odt_count = 1;
+        plan.lists[l].odts[0].size = 10;
+        plan.lists[l].entry_count = 1;
+    }
+
+    DaqBudget budget;
+    daq_budget_init(&budget);
+    budget.max_cpu_load = 0.01; // A list alone is 0.77% of its 1 ms, both are 1.54%
+    SavedOutput saved = quiet_output();
+    int fit = daq_plan_fit(&plan, &budget);
+    restore_output(saved);
+
+    double tick_us = plan.lists[0].cpu_us_per_cycle + plan.lists[1].cpu_us_per_cycle;
+    CHECK(plan.peak_cpu_load > tick_us / 1000.0 - 1e-9 && plan.peak_cpu_load < tick_us / 1000.0 + 1e-9);
+    CHECK(fit < 0);
+    return 0;
+}
+
+// Count the RESET and PACKET messages waiting on the standby's end.
+static void read_replica_msgs(int fd, int *resets, int *packets)
+{
+    uint8_t buf[sizeof(ReplicaHeader) + MAX_PACKET_SIZE];
+    ReplicaHeader header;
+    ssize_t n;
+    *resets = *packets = 0;
+    while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) >= (ssize_t)sizeof(header))
+    {
+        memcpy(&header, buf, sizeof(header));
+        *resets += header.type == REPLICA_MSG_RESET;
+        *packets += header.type == REPLICA_MSG_PACKET;
+    }
+}
+
+// A state cleared and refilled to the same count between two syncs must
+// still reach the standby as a reset, not as nothing new.
+static int check_replica_clear(void)
+{
+    static XcpSessionState cmd_state, daq_state;
+    int sv[2];
+    CHECK(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == 0);
+    Replica replica;
+    replica_init(&replica);
+    replica.peer_fd = sv[0];
+    SocketHandles sockets = {-1, -1, -1, -1};
+    const uint8_t packet[8] = {4, 0, 0, 0, 0xFF};
+    int resets, packets;
+
+    clear_xcp_state(&cmd_state);
+    clear_xcp_state(&daq_state);
+    cache_xcp_packet(&cmd_state, packet, sizeof(packet));
+    replica_sync(&replica, &sockets, &cmd_state, &daq_state);
+    read_replica_msgs(sv[1], &resets, &packets);
+    bool first = resets == 2 && packets == 1;
+
+    clear_xcp_state(&cmd_state);
+    cache_xcp_packet(&cmd_state, packet, sizeof(packet));
+    replica_sync(&replica, &sockets, &cmd_state, &daq_state);
+    read_replica_msgs(sv[1], &resets, &packets);
+
+    replica_drop(&replica);
+    close(sv[1]);
+    CHECK(first);
+    CHECK(resets == 1 && packets == 1);
+    return 0;
+}
+
+static const Check checks[] = {
+    {"index_crash_restart", check_index_crash_restart},
+    {"forward_reclaim", check_forward_reclaim},
+    {"daq_peak_load", check_daq_peak_load},
+    {"replica_clear", check_replica_clear},
+};
+
+int main(int argc, char *argv[])
+{
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    int failed = 0, run = 0;
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++)
+    {
+        if (filter && !strstr(checks[i].name, filter))
+            continue;
+        int ok = checks[i].run() == 0;
+        printf("%-28s %s\n", checks[i].name, ok ? "ok" : "FAILED");
+        failed += !ok;
+        run++;
+    }
+    printf("%d of %d checks passed\n", run - failed, run);
+    return failed ? 1 : 0;
+}
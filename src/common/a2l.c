@@ -0,0 +1,373 @@
+// Minimal A2L reader - just enough of ASAP2 to plan and decode DAQ lists.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#include "a2l.h"
+
+#define A2L_MAX_TOKEN A2L_MAX_NAME
+
+typedef struct
+{
+    const char *pos;
+    const char *end;
+    char token[A2L_MAX_TOKEN];
+} A2lTokenizer;
+
+// Read the next token into t->token, stripping quotes from strings.
+// Returns 0 on success, -1 at end of input.
+static int next_token(A2lTokenizer *t)
+{
+    while (t->pos < t->end)
+    {
+        if (isspace((unsigned char)*t->pos))
+        {
+            t->pos++;
+        }
+        else if (t->pos + 1 < t->end && t->pos[0] == '/' && t->pos[1] == '*')
+        {
+            const char *close = strstr(t->pos + 2, "*/");
+            t->pos = close ? close + 2 : t->end;
+        }
+        else if (t->pos + 1 < t->end && t->pos[0] == '/' && t->pos[1] == '/')
+        {
+            while (t->pos < t->end && *t->pos != '\n')
+                t->pos++;
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (t->pos >= t->end)
+        return -1;
+
+    size_t n = 0;
+    if (*t->pos == '"')
+    {
+        t->pos++;
+        while (t->pos < t->end && *t->pos != '"')
+        {
+            if (*t->pos == '\\' && t->pos + 1 < t->end)
+                t->pos++;
+            if (n < A2L_MAX_TOKEN - 1)
+                t->token[n++] = *t->pos;
+            t->pos++;
+        }
+        t->pos++; // closing quote
+    }
+    else
+    {
+        while (t->pos < t->end && !isspace((unsigned char)*t->pos))
+        {
+            if (n < A2L_MAX_TOKEN - 1)
+                t->token[n++] = *t->pos;
+            t->pos++;
+        }
+    }
+    t->token[n] = '\0';
+    return 0;
+}
+
+static unsigned long next_number(A2lTokenizer *t)
+{
+    if (next_token(t) < 0)
+        return 0;
+    return strtoul(t->token, NULL, 0);
+}
+
+// Skip tokens up to and including "/end <block>".
+static void skip_block(A2lTokenizer *t, const char *block)
+{
+    while (next_token(t) == 0)
+    {
+        if (strcmp(t->token, "/end") == 0 && next_token(t) == 0 && strcmp(t->token, block) == 0)
+            return;
+    }
+}
+
+static A2lDataType parse_data_type(const char *s)
+{
+    static const struct
+    {
+        const char *name;
+        A2lDataType type;
+    } types[] = {
+        {"UBYTE", A2L_UBYTE},
+        {"SBYTE", A2L_SBYTE},
+        {"UWORD", A2L_UWORD},
+        {"SWORD", A2L_SWORD},
+        {"ULONG", A2L_ULONG},
+        {"SLONG", A2L_SLONG},
+        {"A_UINT64", A2L_A_UINT64},
+        {"A_INT64", A2L_A_INT64},
+        {"FLOAT32_IEEE", A2L_FLOAT32_IEEE},
+        {"FLOAT64_IEEE", A2L_FLOAT64_IEEE},
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+    {
+        if (strcmp(s, types[i].name) == 0)
+            return types[i].type;
+    }
+    return A2L_TYPE_UNKNOWN;
+}
+
+static void parse_measurement(A2lTokenizer *t, A2lFile *a2l)
+{
+    A2lMeasurement m = {0};
+
+    // Name, long identifier, data type, conversion, resolution, accuracy,
+    // lower limit, upper limit - then optional keywords.
+    if (next_token(t) < 0)
+        return;
+    snprintf(m.name, sizeof(m.name), "%s", t->token);
+    next_token(t);
+    next_token(t);
+    m.type = parse_data_type(t->token);
+    for (int i = 0; i < 5; i++)
+        next_token(t);
+
+    while (next_token(t) == 0)
+    {
+        if (strcmp(t->token, "ECU_ADDRESS") == 0)
+        {
+            m.address = (uint32_t)next_number(t);
+        }
+        else if (strcmp(t->token, "ECU_ADDRESS_EXTENSION") == 0)
+        {
+            m.address_extension = (uint8_t)next_number(t);
+        }
+        else if (strcmp(t->token, "/begin") == 0)
+        {
+            next_token(t);
+            char nested[A2L_MAX_TOKEN];
+            snprintf(nested, sizeof(nested), "%s", t->token);
+            skip_block(t, nested);
+        }
+        else if (strcmp(t->token, "/end") == 0)
+        {
+            next_token(t); // MEASUREMENT
+            break;
+        }
+    }
+
+    if (a2l->measurement_count < A2L_MAX_MEASUREMENTS)
+        a2l->measurements[a2l->measurement_count++] = m;
+}
+
+static void parse_event(A2lTokenizer *t, A2lFile *a2l)
+{
+    A2lEvent e = {0};
+
+    // Name, short name, channel number, direction, MAX_DAQ_LIST, TIME_CYCLE,
+    // TIME_UNIT, PRIORITY.
+    next_token(t);
+    snprintf(e.name, sizeof(e.name), "%s", t->token);
+    next_token(t);
+    e.channel = (uint16_t)next_number(t);
+    next_token(t);
+    e.max_daq_list = (uint8_t)next_number(t);
+    e.time_cycle = (uint8_t)next_number(t);
+    e.time_unit = (uint8_t)next_number(t);
+    e.priority = (uint8_t)next_number(t);
+    skip_block(t, "EVENT");
+
+    if (a2l->event_count < A2L_MAX_EVENTS)
+        a2l->events[a2l->event_count++] = e;
+}
+
+static void parse_timestamp(A2lTokenizer *t, A2lFile *a2l)
+{
+    static const struct
+    {
+        const char *name;
+        uint32_t ns;
+    } units[] = {
+        {"UNIT_1NS", 1},
+        {"UNIT_10NS", 10},
+        {"UNIT_100NS", 100},
+        {"UNIT_1US", 1000},
+        {"UNIT_10US", 10000},
+        {"UNIT_100US", 100000},
+        {"UNIT_1MS", 1000000},
+        {"UNIT_10MS", 10000000},
+        {"UNIT_100MS", 100000000},
+        {"UNIT_1S", 1000000000},
+    };
+
+    uint32_t ticks = (uint32_t)next_number(t);
+    next_token(t);
+    if (strcmp(t->token, "SIZE_BYTE") == 0)
+        a2l->timestamp_size = 1;
+    else if (strcmp(t->token, "SIZE_WORD") == 0)
+        a2l->timestamp_size = 2;
+    else if (strcmp(t->token, "SIZE_DWORD") == 0)
+        a2l->timestamp_size = 4;
+    else
+        a2l->timestamp_size = 0;
+
+    next_token(t);
+    for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++)
+    {
+        if (strcmp(t->token, units[i].name) == 0)
+            a2l->timestamp_ns_per_tick = ticks * units[i].ns;
+    }
+    skip_block(t, "TIMESTAMP_SUPPORTED");
+}
+
+// XCP_ON_TCP_IP and XCP_ON_UDP_IP share their layout. Only the first one
+// listed is kept, later ones are alternatives the ECU also offers.
+static void parse_ip_transport(A2lTokenizer *t, A2lFile *a2l, A2lTransport transport)
+{
+    bool keep = a2l->transport == A2L_TRANSPORT_NONE;
+    next_number(t); // transport layer version
+    uint16_t port = (uint16_t)next_number(t);
+    if (keep)
+    {
+        a2l->transport = transport;
+        a2l->port = port;
+    }
+
+    while (next_token(t) == 0)
+    {
+        if (strcmp(t->token, "ADDRESS") == 0 || strcmp(t->token, "HOST_NAME") == 0)
+        {
+            next_token(t);
+            if (keep)
+                snprintf(a2l->address, sizeof(a2l->address), "%s", t->token);
+        }
+        else if (strcmp(t->token, "/end") == 0)
+        {
+            next_token(t);
+            break;
+        }
+    }
+}
+
+int a2l_load(A2lFile *a2l, const char *filename)
+{
+    memset(a2l, 0, sizeof(*a2l));
+
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+    {
+        perror("Failed to open A2L file");
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size <= 0)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    char *text = malloc((size_t)size + 1);
+    if (!text || fread(text, 1, (size_t)size, f) != (size_t)size)
+    {
+        free(text);
+        fclose(f);
+        return -1;
+    }
+    text[size] = '\0';
+    fclose(f);
+
+    A2lTokenizer t = {.pos = text, .end = text + size};
+    while (next_token(&t) == 0)
+    {
+        if (strcmp(t.token, "/begin") != 0 || next_token(&t) < 0)
+            continue;
+
+        if (strcmp(t.token, "A2ML") == 0)
+        {
+            skip_block(&t, "A2ML"); // Format description only, no data
+        }
+        else if (strcmp(t.token, "MEASUREMENT") == 0)
+        {
+            parse_measurement(&t, a2l);
+        }
+        else if (strcmp(t.token, "EVENT") == 0)
+        {
+            parse_event(&t, a2l);
+        }
+        else if (strcmp(t.token, "TIMESTAMP_SUPPORTED") == 0)
+        {
+            parse_timestamp(&t, a2l);
+        }
+        else if (strcmp(t.token, "PROTOCOL_LAYER") == 0)
+        {
+            // Version, T1..T7, MAX_CTO, MAX_DTO
+            for (int i = 0; i < 8; i++)
+                next_token(&t);
+            a2l->max_cto = (uint16_t)next_number(&t);
+            a2l->max_dto = (uint16_t)next_number(&t);
+            skip_block(&t, "PROTOCOL_LAYER");
+        }
+        else if (strcmp(t.token, "XCP_ON_TCP_IP") == 0)
+        {
+            parse_ip_transport(&t, a2l, A2L_TRANSPORT_TCP);
+        }
+        else if (strcmp(t.token, "XCP_ON_UDP_IP") == 0)
+        {
+            parse_ip_transport(&t, a2l, A2L_TRANSPORT_UDP);
+        }
+    }
+
+    free(text);
+    return 0;
+}
+
+const A2lMeasurement *a2l_find_measurement(const A2lFile *a2l, const char *name)
+{
+    for (int i = 0; i < a2l->measurement_count; i++)
+    {
+        if (strcmp(a2l->measurements[i].name, name) == 0)
+            return &a2l->measurements[i];
+    }
+    return NULL;
+}
+
+const A2lEvent *a2l_find_event(const A2lFile *a2l, uint16_t channel)
+{
+    for (int i = 0; i < a2l->event_count; i++)
+    {
+        if (a2l->events[i].channel == channel)
+            return &a2l->events[i];
+    }
+    return NULL;
+}
+
+uint64_t a2l_event_period_us(const A2lEvent *event)
+{
+    // TIME_UNIT is a power of ten in nanoseconds, 0 = 1 ns ... 9 = 1 s
+    uint64_t unit_ns = 1;
+    for (int i = 0; i < event->time_unit && i < 9; i++)
+        unit_ns *= 10;
+    return (uint64_t)event->time_cycle * unit_ns / 1000;
+}
+
+size_t a2l_type_size(A2lDataType type)
+{
+    switch (type)
+    {
+    case A2L_UBYTE:
+    case A2L_SBYTE:
+        return 1;
+    case A2L_UWORD:
+    case A2L_SWORD:
+        return 2;
+    case A2L_ULONG:
+    case A2L_SLONG:
+    case A2L_FLOAT32_IEEE:
+        return 4;
+    case A2L_A_UINT64:
+    case A2L_A_INT64:
+    case A2L_FLOAT64_IEEE:
+        return 8;
+    default:
+        return 0;
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef A2L_H
+#define A2L_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Default A2L description of the RT_EXE, relative to the src directory.
+#define DEFAULT_A2L_FILE "../_inputs/TASK_1_x86_64_linux_gnu/SIMPLE_RT_1807776314_4150173325_3634272898_3980045516.a2l"
+
+#define A2L_MAX_NAME 128
+#define A2L_MAX_MEASUREMENTS 512
+#define A2L_MAX_EVENTS 32
+
+typedef enum
+{
+    A2L_TYPE_UNKNOWN = 0,
+    A2L_UBYTE,
+    A2L_SBYTE,
+    A2L_UWORD,
+    A2L_SWORD,
+    A2L_ULONG,
+    A2L_SLONG,
+    A2L_A_UINT64,
+    A2L_A_INT64,
+    A2L_FLOAT32_IEEE,
+    A2L_FLOAT64_IEEE,
+} A2lDataType;
+
+typedef enum
+{
+    A2L_TRANSPORT_NONE = 0,
+    A2L_TRANSPORT_TCP, // XCP_ON_TCP_IP
+    A2L_TRANSPORT_UDP, // XCP_ON_UDP_IP
+} A2lTransport;
+
+typedef struct
+{
+    char name[A2L_MAX_NAME];
+    A2lDataType type;
+    uint32_t address;
+    uint8_t address_extension;
+} A2lMeasurement;
+
+typedef struct
+{
+    char name[A2L_MAX_NAME];
+    uint16_t channel;
+    uint8_t max_daq_list;
+    uint8_t time_cycle;
+    uint8_t time_unit; // XCP TIME_UNIT code, 0 = 1 ns ... 9 = 1 s
+    uint8_t priority;
+} A2lEvent;
+
+typedef struct
+{
+    A2lMeasurement measurements[A2L_MAX_MEASUREMENTS];
+    int measurement_count;
+    A2lEvent events[A2L_MAX_EVENTS];
+    int event_count;
+
+    // PROTOCOL_LAYER
+    uint16_t max_cto;
+    uint16_t max_dto;
+
+    // DAQ / TIMESTAMP_SUPPORTED, timestamp_size is 0 if not supported
+    uint8_t timestamp_size;
+    uint32_t timestamp_ns_per_tick;
+
+    // XCP_ON_TCP_IP or XCP_ON_UDP_IP, whichever is listed first
+    A2lTransport transport;
+    char address[A2L_MAX_NAME];
+    uint16_t port;
+} A2lFile;
+
+/**
+ * @brief Parse the parts of an A2L file needed to plan and decode DAQ lists.
+ * @param a2l Output, cleared before parsing.
+ * @param filename Path of the A2L file.
+ * @return 0 on success, -1 if the file could not be read.
+ * @note Only MEASUREMENT blocks and the XCP IF_DATA (PROTOCOL_LAYER, DAQ
+ * EVENTs, TIMESTAMP_SUPPORTED, transport layer) are read, everything else is
+ * skipped.
+ */
+int a2l_load(A2lFile *a2l, const char *filename);
+
+const A2lMeasurement *a2l_find_measurement(const A2lFile *a2l, const char *name);
+const A2lEvent *a2l_find_event(const A2lFile *a2l, uint16_t channel);
+
+/**
+ * @brief Cycle time of an event channel in microseconds.
+ * @return The period, or 0 for a sporadic (non-cyclic) event.
+ */
+uint64_t a2l_event_period_us(const A2lEvent *event);
+
+/**
+ * @brief Size in bytes of an A2L data type, 0 for unknown types.
+ */
+size_t a2l_type_size(A2lDataType type);
+
+#endif // A2L_H
@@ -0,0 +1,302 @@
+// Frames wait in a byte ring until they are older than the pre-trigger window.
+// A trigger flushes the ring to the recording and keeps writing until the
+// post-trigger window has passed, so each capture is an ordinary indexed
+// stretch of the recording that XCP_QUERY and REPLAY can read.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "xcp_utils.h"
+#include "time_utils.h"
+
+static const struct
+{
+    const char *text;
+    TriggerOp op;
+} trigger_ops[] = {
+    {">=", TRIGGER_GE}, {"<=", TRIGGER_LE},   {"==", TRIGGER_EQ},        {"!=", TRIGGER_NE},
+    {">", TRIGGER_GT},  {"<", TRIGGER_LT},    {"rises", TRIGGER_RISES}, {"falls", TRIGGER_FALLS},
+};
+
+int capture_parse_trigger(const DaqPlan *plan, const char *text, CaptureTrigger *trigger)
+{
+    char name[A2L_MAX_NAME];
+    char op[8];
+    double threshold;
+    char extra;
+    if (sscanf(text, "%127s %7s %lf %c", name, op, &threshold, &extra) != 3)
+    {
+        fprintf(stderr, "Trigger '%s' is not of the form \"SIGNAL OP VALUE\".\n", text);
+        return -1;
+    }
+
+    memset(trigger, 0, sizeof(*trigger));
+    snprintf(trigger->text, sizeof(trigger->text), "%s", text);
+    trigger->threshold = threshold;
+    trigger->signal = -1;
+    for (int i = 0; i < plan->signal_count; i++)
+    {
+        if (strcmp(plan->signals[i].name, name) == 0)
+            trigger->signal = i;
+    }
+    if (trigger->signal < 0)
+    {
+        fprintf(stderr, "Trigger signal %s is not recorded.\n", name);
+        return -1;
+    }
+
+    for (size_t i = 0; i < sizeof(trigger_ops) / sizeof(trigger_ops[0]); i++)
+    {
+        if (strcmp(op, trigger_ops[i].text) == 0)
+        {
+            trigger->op = trigger_ops[i].op;
+            return 0;
+        }
+    }
+    fprintf(stderr, "Unknown trigger operator '%s'.\n", op);
+    return -1;
+}
+
+// Smallest frame the plan produces, header included. ODT sizes count the PID
+// and, for ODT 0, the timestamp.
+static size_t min_frame_size(const DaqPlan *plan)
+{
+    size_t min = XCP_MAX_PACKET_SIZE;
+    for (int l = 0; l < plan->list_count; l++)
+    {
+        for (int o = 0; o < plan->lists[l].odt_count; o++)
+        {
+            if (plan->lists[l].odts[o].size < min)
+                min = plan->lists[l].odts[o].size;
+        }
+    }
+    return XCP_TCP_HEADER_SIZE + (min > 2 ? min : 2); // At least a PID and a byte
+}
+
+int capture_init(Capture *capture, const DaqPlan *plan, Recorder *recorder, uint64_t pre_ns, uint64_t post_ns,
+                 size_t buffer_bytes)
+{
+    memset(capture, 0, sizeof(*capture));
+    capture->pre_ns = pre_ns;
+    capture->post_ns = post_ns;
+    capture->recorder = recorder;
+
+    // Split the budget so the frame table runs out together with the bytes
+    // when every frame is as small as the plan allows.
+    size_t min_frame = min_frame_size(plan);
+    capture->frame_capacity = (uint32_t)(buffer_bytes / (min_frame + sizeof(CaptureFrame)));
+    capture->byte_capacity = buffer_bytes - capture->frame_capacity * sizeof(CaptureFrame);
+    capture->bytes = malloc(capture->byte_capacity);
+    capture->frames = malloc(capture->frame_capacity * sizeof(CaptureFrame));
+    if (!capture->bytes || !capture->frames)
+    {
+        fprintf(stderr, "Failed to allocate the capture buffer.\n");
+        capture_free(capture);
+        return -1;
+    }
+    daq_decoder_init(&capture->tail, plan);
+    return 0;
+}
+
+void capture_free(Capture *capture)
+{
+    free(capture->bytes);
+    free(capture->frames);
+    capture->bytes = NULL;
+    capture->frames = NULL;
+}
+
+// Decode a frame with the tail decoder, keeping it in step with the ring.
+static int decode_tail(Capture *capture, const uint8_t *frame, size_t len, DaqSample *samples)
+{
+    if (len <= XCP_TCP_HEADER_SIZE || xcp_classify_pid(frame[XCP_TCP_HEADER_SIZE]) != XCP_PACKET_DAQ)
+        return 0;
+    int n = daq_decode_dto(&capture->tail, frame + XCP_TCP_HEADER_SIZE, len - XCP_TCP_HEADER_SIZE, samples,
+                           DAQ_MAX_ENTRIES_PER_ODT);
+    return n < 0 ? 0 : n;
+}
+
+static void persist_frame(Capture *capture, const uint8_t *frame, size_t len)
+{
+    DaqSample samples[DAQ_MAX_ENTRIES_PER_ODT];
+    recorder_write_frame(capture->recorder, frame, len);
+    int n = decode_tail(capture, frame, len, samples);
+    recorder_index_samples(capture->recorder, samples, n);
+}
+
+static void drop_oldest(Capture *capture)
+{
+    DaqSample samples[DAQ_MAX_ENTRIES_PER_ODT];
+    const CaptureFrame *oldest = &capture->frames[capture->first];
+    decode_tail(capture, capture->bytes + oldest->offset, oldest->len, samples);
+    capture->first = (capture->first + 1) % capture->frame_capacity;
+    capture->count--;
+}
+
+// Find room for len bytes, dropping the oldest frames if the buffer is full.
+static uint8_t *ring_reserve(Capture *capture, size_t len)
+{
+    while (capture->count > 0)
+    {
+        size_t oldest = capture->frames[capture->first].offset;
+        if (capture->count < capture->frame_capacity)
+        {
+            if (capture->write_offset > oldest)
+            {
+                // Free space is the end of the buffer, then the start up to the oldest frame.
+                if (capture->byte_capacity - capture->write_offset >= len)
+                    break;
+                if (oldest >= len)
+                {
+                    capture->write_offset = 0;
+                    break;
+                }
+            }
+            else if (oldest - capture->write_offset >= len)
+            {
+                break;
+            }
+        }
+        drop_oldest(capture);
+        capture->truncated++;
+    }
+    if (capture->count == 0)
+        capture->write_offset = 0;
+    return capture->bytes + capture->write_offset;
+}
+
+static void flush_ring(Capture *capture)
+{
+    while (capture->count > 0)
+    {
+        const CaptureFrame *oldest = &capture->frames[capture->first];
+        persist_frame(capture, capture->bytes + oldest->offset, oldest->len);
+        capture->first = (capture->first + 1) % capture->frame_capacity;
+        capture->count--;
+    }
+    capture->write_offset = 0;
+}
+
+static bool trigger_update(CaptureTrigger *trigger, double value)
+{
+    double x = trigger->threshold;
+    bool fire = false;
+    switch (trigger->op)
+    {
+    case TRIGGER_RISES:
+        fire = trigger->have_previous && trigger->previous <= x && value > x;
+        break;
+    case TRIGGER_FALLS:
+        fire = trigger->have_previous && trigger->previous >= x && value < x;
+        break;
+    default:
+    {
+        bool now = (trigger->op == TRIGGER_GT && value > x) || (trigger->op == TRIGGER_GE && value >= x) ||
+                   (trigger->op == TRIGGER_LT && value < x) || (trigger->op == TRIGGER_LE && value <= x) ||
+                   (trigger->op == TRIGGER_EQ && value == x) || (trigger->op == TRIGGER_NE && value != x);
+        fire = now && !trigger->was_true;
+        trigger->was_true = now;
+        break;
+    }
+    }
+    trigger->previous = value;
+    trigger->have_previous = true;
+    return fire;
+}
+
+// Feed the samples to every trigger. Returns the sample that fired first, or -1.
+static int evaluate_triggers(Capture *capture, const DaqSample *samples, int count, const CaptureTrigger **fired)
+{
+    int first = -1;
+    for (int i = 0; i < count; i++)
+    {
+        for (int t = 0; t < capture->trigger_count; t++)
+        {
+            CaptureTrigger *trigger = &capture->triggers[t];
+            if (trigger->signal == samples[i].signal && trigger_update(trigger, samples[i].value) && first < 0)
+            {
+                first = i;
+                *fired = trigger;
+            }
+        }
+    }
+    return first;
+}
+
+static void start_capture(Capture *capture, const CaptureTrigger *trigger, uint64_t trigger_ts_ns)
+{
+    Recorder *recorder = capture->recorder;
+    uint64_t wall_ns = time_wall_ns();
+
+    memset(&capture->current, 0, sizeof(capture->current));
+    capture->current.trigger_wall_ns = wall_ns;
+    capture->current.trigger_ts_ns = trigger_ts_ns;
+    capture->current.first_ts_ns = capture->frames[capture->first].timestamp_ns;
+    capture->current.offset = recorder->offset;
+    snprintf(capture->current.trigger, sizeof(capture->current.trigger), "%s", trigger->text);
+    capture->capturing = true;
+
+    // The buffered frames arrived earlier, date them relative to the trigger.
+    index_writer_set_wall_offset(&recorder->index, (int64_t)(wall_ns - trigger_ts_ns));
+    flush_ring(capture);
+    printf("Trigger '%s' fired at %.6f, capturing.\n", trigger->text, trigger_ts_ns / 1e9);
+}
+
+void capture_frame(Capture *capture, const uint8_t *frame, size_t len, const DaqSample *samples, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (samples[i].timestamp_ns > capture->last_ts_ns)
+            capture->last_ts_ns = samples[i].timestamp_ns;
+    }
+    uint64_t ts = capture->last_ts_ns;
+
+    if (capture->capturing)
+    {
+        // Triggers keep their state, but do not fire again within a capture.
+        const CaptureTrigger *fired;
+        evaluate_triggers(capture, samples, count, &fired);
+        persist_frame(capture, frame, len);
+        if (ts >= capture->current.trigger_ts_ns + capture->post_ns)
+            capture_finish(capture);
+        return;
+    }
+
+    if (len > capture->byte_capacity)
+        return;
+    uint8_t *dst = ring_reserve(capture, len);
+    memcpy(dst, frame, len);
+    uint32_t slot = (capture->first + capture->count) % capture->frame_capacity;
+    capture->frames[slot] = (CaptureFrame){(uint32_t)capture->write_offset, (uint16_t)len, ts};
+    capture->write_offset += len;
+    capture->count++;
+
+    while (capture->frames[capture->first].timestamp_ns + capture->pre_ns < ts)
+        drop_oldest(capture);
+
+    const CaptureTrigger *fired;
+    int sample = evaluate_triggers(capture, samples, count, &fired);
+    if (sample < 0)
+        return;
+    start_capture(capture, fired, samples[sample].timestamp_ns);
+    if (ts >= capture->current.trigger_ts_ns + capture->post_ns)
+        capture_finish(capture);
+}
+
+void capture_finish(Capture *capture)
+{
+    if (!capture->capturing)
+        return;
+
+    Recorder *recorder = capture->recorder;
+    capture->current.last_ts_ns = capture->last_ts_ns;
+    capture->current.length = recorder->offset - capture->current.offset;
+    index_writer_capture(&recorder->index, &capture->current);
+    recorder_flush(recorder);
+    capture->capturing = false;
+    capture->captures++;
+    printf("Captured %.3f s around trigger '%s', %llu bytes.\n",
+           (capture->current.last_ts_ns - capture->current.first_ts_ns) / 1e9, capture->current.trigger,
+           (unsigned long long)capture->current.length);
+}
@@ -0,0 +1,112 @@
+// Triggered capture: buffer the DAQ stream in memory and only persist the
+// windows around trigger events
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "daq_plan.h"
+#include "daq_decode.h"
+#include "recorder.h"
+
+#define CAPTURE_MAX_TRIGGERS 8
+#define CAPTURE_DEFAULT_PRE_NS 2000000000ULL
+#define CAPTURE_DEFAULT_POST_NS 2000000000ULL
+#define CAPTURE_DEFAULT_BUFFER_BYTES (16u << 20)
+#define CAPTURE_MAX_BUFFER_MIB 4095 // Ring offsets are 32-bit
+
+typedef enum
+{
+    TRIGGER_GT,    // SIGNAL > x
+    TRIGGER_GE,    // SIGNAL >= x
+    TRIGGER_LT,    // SIGNAL < x
+    TRIGGER_LE,    // SIGNAL <= x
+    TRIGGER_EQ,    // SIGNAL == x
+    TRIGGER_NE,    // SIGNAL != x
+    TRIGGER_RISES, // SIGNAL rises x, crosses x upwards
+    TRIGGER_FALLS, // SIGNAL falls x, crosses x downwards
+} TriggerOp;
+
+// Level conditions fire when they become true, edges when the signal crosses
+// the threshold between two consecutive samples.
+typedef struct
+{
+    char text[RECORDING_TRIGGER_TEXT];
+    int signal; // Index into DaqPlan.signals
+    TriggerOp op;
+    double threshold;
+    double previous;
+    bool have_previous;
+    bool was_true;
+} CaptureTrigger;
+
+// A frame held in the ring, its bytes live in Capture.bytes.
+typedef struct
+{
+    uint32_t offset;
+    uint16_t len;
+    uint64_t timestamp_ns;
+} CaptureFrame;
+
+typedef struct
+{
+    uint64_t pre_ns;
+    uint64_t post_ns;
+    Recorder *recorder;
+
+    // Ring of the most recent frames, at most pre_ns of DAQ time
+    uint8_t *bytes;
+    size_t byte_capacity;
+    size_t write_offset;
+    CaptureFrame *frames;
+    uint32_t frame_capacity;
+    uint32_t first;
+    uint32_t count;
+    uint64_t last_ts_ns;
+
+    // Decoder state just before the oldest frame in the ring. Frames are
+    // decoded again as they leave the ring, so once persisted the recording
+    // index sees them with the timestamp state they were received with.
+    DaqDecoder tail;
+
+    CaptureTrigger triggers[CAPTURE_MAX_TRIGGERS];
+    int trigger_count;
+
+    bool capturing;
+    RecordingCapture current;
+    uint64_t captures;
+    uint64_t truncated; // Frames dropped from the pre-trigger window for lack of buffer
+} Capture;
+
+/**
+ * @brief Parse "SIGNAL OP VALUE", OP one of > >= < <= == != rises falls.
+ * @return 0 on success, -1 if the expression or signal is invalid.
+ */
+int capture_parse_trigger(const DaqPlan *plan, const char *text, CaptureTrigger *trigger);
+
+/**
+ * @brief Set up capture mode. The recorder's index must use capture->tail as
+ * its decoder, without the host clock.
+ * @param buffer_bytes Memory for the ring, frame table included, at most
+ * CAPTURE_MAX_BUFFER_MIB MiB.
+ * @return 0 on success, -1 if out of memory.
+ */
+int capture_init(Capture *capture, const DaqPlan *plan, Recorder *recorder, uint64_t pre_ns, uint64_t post_ns,
+                 size_t buffer_bytes);
+void capture_free(Capture *capture);
+
+/**
+ * @brief Take one received frame (header included) and the samples decoded
+ * from it. Buffers it, or writes it while a capture is running, and starts a
+ * capture when a trigger fires.
+ */
+void capture_frame(Capture *capture, const uint8_t *frame, size_t len, const DaqSample *samples, int count);
+
+/**
+ * @brief End a running capture early, e.g. on shutdown.
+ */
+void capture_finish(Capture *capture);
+
+#endif // CAPTURE_H
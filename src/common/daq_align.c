@@ -0,0 +1,301 @@
+// Rows are queued as the master clock ticks and held back until every DAQ
+// list has completed a cycle at or past the row time, so the values either
+// side of it are known. Per signal only the samples later rows may still
+// need are kept.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "daq_align.h"
+
+static const struct
+{
+    const char *name;
+    AlignMode mode;
+} align_modes[] = {
+    {"hold", ALIGN_HOLD},
+    {"nearest", ALIGN_NEAREST},
+    {"linear", ALIGN_LINEAR},
+};
+
+int daq_align_parse_mode(const char *text, AlignMode *mode)
+{
+    for (size_t i = 0; i < sizeof(align_modes) / sizeof(align_modes[0]); i++)
+    {
+        if (strcmp(text, align_modes[i].name) == 0)
+        {
+            *mode = align_modes[i].mode;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// "10ms", "250us" or "0.5s"
+static int parse_period(const char *text, uint64_t *period_ns)
+{
+    char *end;
+    double value = strtod(text, &end);
+    double scale = 0;
+    if (strcmp(end, "s") == 0)
+        scale = 1e9;
+    else if (strcmp(end, "ms") == 0)
+        scale = 1e6;
+    else if (strcmp(end, "us") == 0)
+        scale = 1e3;
+    if (end == text || scale == 0 || value * scale < 1)
+        return -1;
+    *period_ns = (uint64_t)(value * scale);
+    return 0;
+}
+
+int daq_align_init(DaqAligner *aligner, const DaqPlan *plan, const char *master, AlignMode mode,
+                   uint64_t max_lateness_ns, AlignRowFn emit, void *ctx)
+{
+    memset(aligner, 0, sizeof(*aligner));
+    aligner->plan = plan;
+    aligner->mode = mode;
+    aligner->max_lateness_ns = max_lateness_ns;
+    aligner->emit = emit;
+    aligner->ctx = ctx;
+    aligner->master_list = -1;
+    if (plan->timestamp_size == 0)
+    {
+        fprintf(stderr, "Aligning lists needs DAQ timestamps.\n");
+        return -1;
+    }
+
+    for (int i = 0; i < plan->signal_count; i++)
+    {
+        if (strcmp(plan->signals[i].name, master) == 0)
+        {
+            aligner->master_list = plan->signals[i].list;
+            return 0;
+        }
+    }
+    if (parse_period(master, &aligner->period_ns) == 0)
+        return 0;
+    fprintf(stderr, "Master clock %s is neither a recorded signal nor a period.\n", master);
+    return -1;
+}
+
+static AlignPoint *point_at(AlignHistory *history, int i)
+{
+    return &history->points[(history->first + i) % ALIGN_HISTORY];
+}
+
+static bool value_at(const DaqAligner *aligner, AlignHistory *history, uint64_t t, double *value)
+{
+    const AlignPoint *before = NULL;
+    const AlignPoint *after = NULL;
+    for (int i = 0; i < history->count; i++)
+    {
+        const AlignPoint *p = point_at(history, i);
+        if (p->timestamp_ns > t)
+        {
+            after = p;
+            break;
+        }
+        before = p;
+    }
+
+    switch (aligner->mode)
+    {
+    case ALIGN_NEAREST:
+        if (!before && !after)
+            return false;
+        if (!after || (before && t - before->timestamp_ns <= after->timestamp_ns - t))
+            *value = before->value;
+        else
+            *value = after->value;
+        return true;
+    case ALIGN_LINEAR:
+        if (!before)
+            return false;
+        *value = before->value;
+        if (after && t > before->timestamp_ns)
+        {
+            double f = (double)(t - before->timestamp_ns) / (double)(after->timestamp_ns - before->timestamp_ns);
+            *value += (after->value - before->value) * f;
+        }
+        return true;
+    default:
+        if (!before)
+            return false;
+        *value = before->value;
+        return true;
+    }
+}
+
+// Rows still to come are no earlier than the oldest queued one, or later
+// than the last one queued if none are.
+static bool row_bound(const DaqAligner *aligner, uint64_t *bound)
+{
+    if (aligner->pending_count > 0)
+        *bound = aligner->pending[aligner->pending_first];
+    else if (aligner->have_queued)
+        *bound = aligner->queued_ns;
+    else
+        return false;
+    return true;
+}
+
+// Drop the samples no later row can use: all but the last one at or before
+// the earliest row still to come.
+static void prune(DaqAligner *aligner)
+{
+    uint64_t bound;
+    if (!row_bound(aligner, &bound))
+        return;
+    for (int s = 0; s < aligner->plan->signal_count; s++)
+    {
+        AlignHistory *history = &aligner->history[s];
+        while (history->count >= 2 && point_at(history, 1)->timestamp_ns <= bound)
+        {
+            history->first = (history->first + 1) % ALIGN_HISTORY;
+            history->count--;
+        }
+    }
+}
+
+static void emit_oldest(DaqAligner *aligner)
+{
+    uint64_t t = aligner->pending[aligner->pending_first];
+    aligner->pending_first = (aligner->pending_first + 1) % ALIGN_MAX_PENDING;
+    aligner->pending_count--;
+
+    double values[DAQ_MAX_SIGNALS];
+    bool valid[DAQ_MAX_SIGNALS];
+    for (int s = 0; s < aligner->plan->signal_count; s++)
+        valid[s] = value_at(aligner, &aligner->history[s], t, &values[s]);
+    aligner->emit(aligner->ctx, t, values, valid, aligner->plan->signal_count);
+    aligner->stats.rows++;
+    prune(aligner);
+}
+
+// Whether every list has completed a cycle far enough past t that no
+// sample it sends from now on changes the row.
+static bool lists_caught_up(const DaqAligner *aligner, uint64_t t)
+{
+    for (int l = 0; l < aligner->plan->list_count; l++)
+    {
+        if (!aligner->list_complete[l])
+            return false;
+        uint64_t done = aligner->list_complete_ns[l];
+        if (done < t || (done == t && aligner->mode != ALIGN_HOLD))
+            return false;
+    }
+    return true;
+}
+
+static void emit_ready(DaqAligner *aligner)
+{
+    while (aligner->pending_count > 0)
+    {
+        uint64_t t = aligner->pending[aligner->pending_first];
+        if (!lists_caught_up(aligner, t))
+        {
+            if (aligner->newest_ns < t + aligner->max_lateness_ns)
+                break;
+            aligner->stats.late_rows++;
+        }
+        emit_oldest(aligner);
+    }
+}
+
+static void queue_row(DaqAligner *aligner, uint64_t t)
+{
+    if (aligner->have_queued && t <= aligner->queued_ns)
+        return;
+    if (aligner->pending_count == ALIGN_MAX_PENDING)
+    {
+        aligner->stats.forced_rows++;
+        emit_oldest(aligner);
+    }
+    aligner->pending[(aligner->pending_first + aligner->pending_count) % ALIGN_MAX_PENDING] = t;
+    aligner->pending_count++;
+    aligner->queued_ns = t;
+    aligner->have_queued = true;
+}
+
+static void add_point(DaqAligner *aligner, const DaqSample *sample)
+{
+    AlignHistory *history = &aligner->history[sample->signal];
+    if (history->count > 0 && sample->timestamp_ns < point_at(history, history->count - 1)->timestamp_ns)
+    {
+        aligner->stats.dropped_samples++;
+        return;
+    }
+
+    if (history->count == ALIGN_HISTORY)
+        prune(aligner);
+    while (history->count == ALIGN_HISTORY && aligner->pending_count > 0)
+    {
+        aligner->stats.forced_rows++;
+        emit_oldest(aligner);
+    }
+    if (history->count == ALIGN_HISTORY)
+    {
+        history->first = (history->first + 1) % ALIGN_HISTORY;
+        history->count--;
+        aligner->stats.dropped_samples++;
+    }
+
+    *point_at(history, history->count) = (AlignPoint){sample->timestamp_ns, sample->value};
+    history->count++;
+}
+
+void daq_align_samples(DaqAligner *aligner, const DaqSample *samples, int count)
+{
+    if (count <= 0)
+        return;
+
+    // All samples of a DTO belong to one ODT of one list cycle.
+    const DaqSignal *signal = &aligner->plan->signals[samples[0].signal];
+    int list = signal->list;
+    uint64_t ts = samples[0].timestamp_ns;
+    if (signal->odt == aligner->plan->lists[list].odt_count - 1)
+    {
+        aligner->list_complete_ns[list] = ts;
+        aligner->list_complete[list] = true;
+    }
+    if (!aligner->have_newest || ts > aligner->newest_ns)
+        aligner->newest_ns = ts;
+    aligner->have_newest = true;
+
+    if (list == aligner->master_list)
+        queue_row(aligner, ts);
+    for (int i = 0; i < count; i++)
+        add_point(aligner, &samples[i]);
+
+    if (aligner->master_list < 0)
+    {
+        if (!aligner->have_next_row)
+        {
+            aligner->next_row_ns = (ts + aligner->period_ns - 1) / aligner->period_ns * aligner->period_ns;
+            aligner->have_next_row = true;
+        }
+        // After a jump in DAQ time only the last queue's worth of ticks are kept.
+        uint64_t span = aligner->period_ns * ALIGN_MAX_PENDING;
+        if (aligner->newest_ns > aligner->next_row_ns + span)
+            aligner->next_row_ns += (aligner->newest_ns - aligner->next_row_ns - span) / aligner->period_ns *
+                                    aligner->period_ns;
+        while (aligner->next_row_ns <= aligner->newest_ns)
+        {
+            queue_row(aligner, aligner->next_row_ns);
+            aligner->next_row_ns += aligner->period_ns;
+        }
+    }
+
+    emit_ready(aligner);
+}
+
+void daq_align_flush(DaqAligner *aligner)
+{
+    while (aligner->pending_count > 0)
+    {
+        if (!lists_caught_up(aligner, aligner->pending[aligner->pending_first]))
+            aligner->stats.late_rows++;
+        emit_oldest(aligner);
+    }
+}
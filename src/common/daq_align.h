@@ -0,0 +1,111 @@
+// Time alignment of the DAQ lists into wide rows
+//
+// Each DAQ list arrives as its own DTO stream with its own timestamps. The
+// aligner merges them onto a master clock, either the cycles of one list or
+// a fixed period, and emits one row per master tick with a value for every
+// signal. A row is emitted as soon as every list has moved past its time, or
+// once the newest DAQ time seen is max_lateness past it, whichever is first.
+// Memory is fixed: a few samples per signal and a bounded queue of rows.
+#ifndef DAQ_ALIGN_H
+#define DAQ_ALIGN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "daq_plan.h"
+#include "daq_decode.h"
+
+#define ALIGN_HISTORY 16      // Samples kept per signal
+#define ALIGN_MAX_PENDING 256 // Rows waiting for late lists
+#define ALIGN_DEFAULT_MAX_LATENESS_NS 100000000ULL
+
+typedef enum
+{
+    ALIGN_HOLD,    // Latest sample at or before the row time
+    ALIGN_NEAREST, // Sample closest to the row time, either side
+    ALIGN_LINEAR,  // Interpolated between the samples either side, else held
+} AlignMode;
+
+typedef struct
+{
+    uint64_t timestamp_ns;
+    double value;
+} AlignPoint;
+
+// Oldest first, the first point is the last one at or before the oldest row
+// still to be emitted.
+typedef struct
+{
+    AlignPoint points[ALIGN_HISTORY];
+    int first;
+    int count;
+} AlignHistory;
+
+typedef struct
+{
+    uint64_t rows;
+    uint64_t late_rows;       // Emitted on max_lateness before every list caught up
+    uint64_t forced_rows;     // Emitted early because a queue was full
+    uint64_t dropped_samples; // Older than rows already emitted, or pushed out
+} AlignStats;
+
+/**
+ * @brief Called for every row, in time order.
+ * @param values One per plan signal, only meaningful where valid is set.
+ */
+typedef void (*AlignRowFn)(void *ctx, uint64_t timestamp_ns, const double *values, const bool *valid, int count);
+
+typedef struct
+{
+    const DaqPlan *plan;
+    AlignMode mode;
+    int master_list;  // -1 when ticking at period_ns
+    uint64_t period_ns;
+    uint64_t max_lateness_ns;
+    AlignRowFn emit;
+    void *ctx;
+
+    AlignHistory history[DAQ_MAX_SIGNALS];
+    uint64_t list_complete_ns[DAQ_MAX_LISTS]; // Latest cycle whose last ODT arrived
+    bool list_complete[DAQ_MAX_LISTS];
+    uint64_t newest_ns; // Newest DAQ time seen on any list
+    bool have_newest;
+
+    uint64_t pending[ALIGN_MAX_PENDING]; // Row times, oldest first
+    int pending_first;
+    int pending_count;
+    uint64_t queued_ns; // Latest row ever queued, rows only move forward
+    bool have_queued;
+    uint64_t next_row_ns; // Next tick when ticking at period_ns
+    bool have_next_row;
+
+    AlignStats stats;
+} DaqAligner;
+
+/**
+ * @brief Parse "hold", "nearest" or "linear".
+ * @return 0 on success, -1 if unknown.
+ */
+int daq_align_parse_mode(const char *text, AlignMode *mode);
+
+/**
+ * @brief Set up an aligner.
+ * @param master A plan signal, whose DAQ list's cycles are the row times, or
+ * a period such as "10ms" or "0.5s" to tick at.
+ * @return 0 on success, -1 if master is neither or the plan has no timestamps.
+ */
+int daq_align_init(DaqAligner *aligner, const DaqPlan *plan, const char *master, AlignMode mode,
+                   uint64_t max_lateness_ns, AlignRowFn emit, void *ctx);
+
+/**
+ * @brief Take the samples decoded from one DTO and emit the rows they complete.
+ */
+void daq_align_samples(DaqAligner *aligner, const DaqSample *samples, int count);
+
+/**
+ * @brief Emit every queued row with what has arrived, e.g. at the end of the stream.
+ */
+void daq_align_flush(DaqAligner *aligner);
+
+#endif // DAQ_ALIGN_H
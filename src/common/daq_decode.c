@@ -0,0 +1,105 @@
+// DTO decoding - the ECU sends little-endian data (BYTE_ORDER MSB_LAST)
+#include <string.h>
+
+#include "daq_decode.h"
+
+void daq_decoder_init(DaqDecoder *decoder, const DaqPlan *plan)
+{
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->plan = plan;
+}
+
+static uint64_t read_le(const uint8_t *data, size_t size)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < size; i++)
+        v |= (uint64_t)data[i] << (8 * i);
+    return v;
+}
+
+double daq_decode_value(const uint8_t *data, A2lDataType type)
+{
+    switch (type)
+    {
+    case A2L_UBYTE:
+        return data[0];
+    case A2L_SBYTE:
+        return (int8_t)data[0];
+    case A2L_UWORD:
+        return (uint16_t)read_le(data, 2);
+    case A2L_SWORD:
+        return (int16_t)read_le(data, 2);
+    case A2L_ULONG:
+        return (uint32_t)read_le(data, 4);
+    case A2L_SLONG:
+        return (int32_t)read_le(data, 4);
+    case A2L_A_UINT64:
+        return (double)read_le(data, 8);
+    case A2L_A_INT64:
+        return (double)(int64_t)read_le(data, 8);
+    case A2L_FLOAT32_IEEE:
+    {
+        uint32_t bits = (uint32_t)read_le(data, 4);
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+    case A2L_FLOAT64_IEEE:
+    {
+        uint64_t bits = read_le(data, 8);
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+    default:
+        return 0.0;
+    }
+}
+
+static uint64_t unwrap_timestamp(DaqDecoder *decoder, uint32_t raw)
+{
+    const DaqPlan *plan = decoder->plan;
+    uint64_t range = 1ULL << (8 * plan->timestamp_size);
+
+    // A raw value far below the previous one means the counter wrapped. Small
+    // steps backwards are reordering between lists and are left alone.
+    if (decoder->have_timestamp && raw < decoder->last_raw_timestamp &&
+        decoder->last_raw_timestamp - raw > range / 2)
+    {
+        decoder->timestamp_wraps++;
+    }
+    decoder->last_raw_timestamp = raw;
+    decoder->have_timestamp = 1;
+
+    uint64_t ticks = decoder->timestamp_wraps * range + raw;
+    return ticks * plan->timestamp_ns_per_tick;
+}
+
+int daq_decode_dto(DaqDecoder *decoder, const uint8_t *packet, size_t len, DaqSample *samples, int max_samples)
+{
+    const DaqPlan *plan = decoder->plan;
+    int list_index, odt_index;
+    if (len < 1 || !daq_plan_lookup_pid(plan, packet[0], &list_index, &odt_index))
+        return -1;
+
+    const DaqOdt *odt = &plan->lists[list_index].odts[odt_index];
+    if (len < odt->size)
+        return -1;
+
+    if (odt_index == 0 && plan->timestamp_size > 0)
+    {
+        uint32_t raw = (uint32_t)read_le(packet + 1, plan->timestamp_size);
+        decoder->list_timestamp_ns[list_index] = unwrap_timestamp(decoder, raw);
+    }
+
+    int count = 0;
+    for (int e = 0; e < odt->entry_count && count < max_samples; e++)
+    {
+        const DaqSignal *s = &plan->signals[odt->signals[e]];
+        samples[count].signal = odt->signals[e];
+        samples[count].timestamp_ns = decoder->list_timestamp_ns[list_index];
+        samples[count].value = daq_decode_value(packet + s->offset, s->type);
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,48 @@
+// Decodes DTO packets into signal samples using a DAQ plan
+#ifndef DAQ_DECODE_H
+#define DAQ_DECODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "daq_plan.h"
+
+typedef struct
+{
+    uint16_t signal;       // Index into DaqPlan.signals
+    uint64_t timestamp_ns; // Unwrapped DAQ timestamp, 0 if the plan has none
+    double value;
+} DaqSample;
+
+typedef struct
+{
+    const DaqPlan *plan;
+    uint64_t list_timestamp_ns[DAQ_MAX_LISTS]; // Timestamp of the current cycle per list
+    uint32_t last_raw_timestamp;
+    uint64_t timestamp_wraps;
+    int have_timestamp;
+} DaqDecoder;
+
+void daq_decoder_init(DaqDecoder *decoder, const DaqPlan *plan);
+
+/**
+ * @brief Decode one DTO (XCP packet starting with the PID).
+ * @param decoder Decoder holding the layout and timestamp state.
+ * @param packet DTO packet, transport header excluded.
+ * @param len Length of the packet.
+ * @param samples Output, one sample per ODT entry.
+ * @param max_samples Capacity of samples, DAQ_MAX_ENTRIES_PER_ODT is always enough.
+ * @return Number of samples decoded, or -1 if the PID is unknown or the
+ * packet is shorter than its ODT.
+ * @note The DAQ timestamp is only carried by the first ODT of a list, later
+ * ODTs of the same cycle reuse it. Wraps of the raw counter are unwrapped so
+ * timestamps keep increasing across the whole stream.
+ */
+int daq_decode_dto(DaqDecoder *decoder, const uint8_t *packet, size_t len, DaqSample *samples, int max_samples);
+
+/**
+ * @brief Read a little-endian (MSB_LAST) value of the given A2L type as a double.
+ */
+double daq_decode_value(const uint8_t *data, A2lDataType type);
+
+#endif // DAQ_DECODE_H
@@ -0,0 +1,356 @@
+// Lays out DAQ lists from A2L signals and fits prescalers to a load budget
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "daq_plan.h"
+#include "xcp_utils.h"
+
+void daq_budget_init(DaqBudget *budget)
+{
+    memset(budget, 0, sizeof(*budget));
+    budget->max_bytes_per_sec = 0;
+    budget->max_cpu_load = 1.0;
+    budget->max_prescaler = DAQ_DEFAULT_MAX_PRESCALER;
+    budget->cost_per_list_us = DAQ_COST_PER_LIST_US;
+    budget->cost_per_odt_us = DAQ_COST_PER_ODT_US;
+    budget->cost_per_entry_us = DAQ_COST_PER_ENTRY_US;
+    budget->cost_per_byte_us = DAQ_COST_PER_BYTE_US;
+}
+
+int daq_parse_signal_spec(const char *spec, DaqSignalRequest *request)
+{
+    memset(request, 0, sizeof(*request));
+
+    const char *at = strchr(spec, '@');
+    size_t name_len = at ? (size_t)(at - spec) : strlen(spec);
+    if (name_len == 0 || name_len >= sizeof(request->name))
+        return -1;
+    memcpy(request->name, spec, name_len);
+
+    if (at)
+    {
+        char *end;
+        unsigned long channel = strtoul(at + 1, &end, 0);
+        if (*(at + 1) == '\0' || *end != '\0' || channel > 0xFFFF)
+            return -1;
+        request->event_channel = (uint16_t)channel;
+    }
+    return 0;
+}
+
+int daq_parse_signal_args(int count, char *const specs[], DaqSignalRequest *requests)
+{
+    static const char *defaults[] = DAQ_DEFAULT_SIGNALS;
+    int total = count > 0 ? count : (int)(sizeof(defaults) / sizeof(defaults[0]));
+    if (total > DAQ_MAX_SIGNALS)
+    {
+        fprintf(stderr, "Too many signals (max %d).\n", DAQ_MAX_SIGNALS);
+        return -1;
+    }
+
+    for (int i = 0; i < total; i++)
+    {
+        const char *spec = count > 0 ? specs[i] : defaults[i];
+        if (daq_parse_signal_spec(spec, &requests[i]) < 0)
+        {
+            fprintf(stderr, "Invalid signal spec: %s\n", spec);
+            return -1;
+        }
+    }
+    return total;
+}
+
+static int find_or_add_list(DaqPlan *plan, const A2lEvent *event)
+{
+    for (int i = 0; i < plan->list_count; i++)
+    {
+        if (plan->lists[i].event_channel == event->channel)
+            return i;
+    }
+    if (plan->list_count >= DAQ_MAX_LISTS)
+        return -1;
+
+    DaqListPlan *list = &plan->lists[plan->list_count];
+    list->event_channel = event->channel;
+    list->event_period_us = a2l_event_period_us(event);
+    list->prescaler = 1;
+    return plan->list_count++;
+}
+
+int daq_plan_layout(DaqPlan *plan, const A2lFile *a2l, const DaqSignalRequest *requests, int count)
+{
+    memset(plan, 0, sizeof(*plan));
+    plan->timestamp_size = a2l->timestamp_size;
+    plan->timestamp_ns_per_tick = a2l->timestamp_ns_per_tick;
+    plan->max_odt_size = DAQ_MAX_ODT_SIZE;
+    if (a2l->max_dto > 0 && a2l->max_dto < plan->max_odt_size)
+        plan->max_odt_size = a2l->max_dto;
+
+    if (count > DAQ_MAX_SIGNALS)
+    {
+        fprintf(stderr, "Too many signals requested (%d, max %d).\n", count, DAQ_MAX_SIGNALS);
+        return -1;
+    }
+
+    // Resolve every signal against the A2L and group by event channel.
+    for (int i = 0; i < count; i++)
+    {
+        const A2lMeasurement *m = a2l_find_measurement(a2l, requests[i].name);
+        if (!m || a2l_type_size(m->type) == 0)
+        {
+            fprintf(stderr, "Unknown or unsupported measurement: %s\n", requests[i].name);
+            return -1;
+        }
+        const A2lEvent *event = a2l_find_event(a2l, requests[i].event_channel);
+        if (!event)
+        {
+            fprintf(stderr, "Unknown event channel %u for %s\n", requests[i].event_channel, requests[i].name);
+            return -1;
+        }
+        int list = find_or_add_list(plan, event);
+        if (list < 0)
+        {
+            fprintf(stderr, "Too many DAQ lists (max %d).\n", DAQ_MAX_LISTS);
+            return -1;
+        }
+
+        DaqSignal *s = &plan->signals[plan->signal_count++];
+        snprintf(s->name, sizeof(s->name), "%s", m->name);
+        s->type = m->type;
+        s->address = m->address;
+        s->address_extension = m->address_extension;
+        s->size = (uint8_t)a2l_type_size(m->type);
+        s->list = (uint8_t)list;
+    }
+
+    // Pack each list's signals into ODTs in request order. The first ODT of
+    // every list carries the DAQ timestamp after the PID.
+    int pid = 0;
+    for (int l = 0; l < plan->list_count; l++)
+    {
+        DaqListPlan *list = &plan->lists[l];
+        list->first_pid = (uint8_t)pid;
+
+        for (int i = 0; i < plan->signal_count; i++)
+        {
+            DaqSignal *s = &plan->signals[i];
+            if (s->list != l)
+                continue;
+
+            DaqOdt *odt = list->odt_count > 0 ? &list->odts[list->odt_count - 1] : NULL;
+            if (!odt || odt->entry_count >= DAQ_MAX_ENTRIES_PER_ODT || odt->size + s->size > plan->max_odt_size)
+            {
+                if (list->odt_count >= DAQ_MAX_ODTS_PER_LIST)
+                {
+                    fprintf(stderr, "DAQ list %d needs more than %d ODTs.\n", l, DAQ_MAX_ODTS_PER_LIST);
+                    return -1;
+                }
+                odt = &list->odts[list->odt_count++];
+                odt->size = 1 + (list->odt_count == 1 ? plan->timestamp_size : 0);
+                if (odt->size + s->size > plan->max_odt_size)
+                {
+                    fprintf(stderr, "%s does not fit in a DTO of %u bytes.\n", s->name, plan->max_odt_size);
+                    return -1;
+                }
+            }
+
+            s->odt = (uint8_t)(list->odt_count - 1);
+            s->entry = (uint8_t)odt->entry_count;
+            s->offset = odt->size;
+            odt->signals[odt->entry_count++] = (uint8_t)i;
+            odt->size += s->size;
+            list->entry_count++;
+        }
+        pid += list->odt_count;
+    }
+
+    if (pid > XCP_PID_SERV)
+    {
+        fprintf(stderr, "Plan needs %d ODTs, absolute PIDs only allow %d.\n", pid, XCP_PID_SERV);
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t gcd_u64(uint64_t a, uint64_t b)
+{
+    while (b != 0)
+    {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static void compute_load(DaqPlan *plan, const DaqBudget *budget)
+{
+    plan->bytes_per_sec = 0;
+    plan->cpu_load = 0;
+    plan->peak_cpu_load = 0;
+
+    for (int l = 0; l < plan->list_count; l++)
+    {
+        DaqListPlan *list = &plan->lists[l];
+        uint32_t payload = 0;
+        list->bytes_per_cycle = 0;
+        for (int o = 0; o < list->odt_count; o++)
+        {
+            payload += list->odts[o].size;
+            list->bytes_per_cycle += XCP_TCP_HEADER_SIZE + list->odts[o].size;
+        }
+        list->cpu_us_per_cycle = budget->cost_per_list_us +
+                                 list->odt_count * budget->cost_per_odt_us +
+                                 list->entry_count * budget->cost_per_entry_us +
+                                 payload * budget->cost_per_byte_us;
+
+        // Sporadic events have no period to project a rate from.
+        list->bytes_per_sec = 0;
+        if (list->event_period_us > 0)
+        {
+            double cycle_us = (double)list->event_period_us * list->prescaler;
+            list->bytes_per_sec = list->bytes_per_cycle * 1e6 / cycle_us;
+            plan->cpu_load += list->cpu_us_per_cycle / cycle_us;
+        }
+        plan->bytes_per_sec += list->bytes_per_sec;
+    }
+
+    // Prescalers are not phase shifted, so at the start of every hyperperiod
+    // (the LCM of the effective periods) every periodic list fires on the
+    // same tick, whatever its event channel. That tick has to be done before
+    // the next event tick, which comes one GCD of the event periods later.
+    double tick_us = 0;
+    uint64_t base_us = 0;
+    for (int l = 0; l < plan->list_count; l++)
+    {
+        const DaqListPlan *list = &plan->lists[l];
+        if (list->event_period_us == 0)
+            continue;
+        tick_us += list->cpu_us_per_cycle;
+        base_us = gcd_u64(base_us, list->event_period_us);
+    }
+    if (base_us > 0)
+        plan->peak_cpu_load = tick_us / (double)base_us;
+}
+
+static bool over_bandwidth(const DaqPlan *plan, const DaqBudget *budget)
+{
+    return budget->max_bytes_per_sec > 0 && plan->bytes_per_sec > budget->max_bytes_per_sec;
+}
+
+static bool over_cpu(const DaqPlan *plan, const DaqBudget *budget)
+{
+    return plan->cpu_load > budget->max_cpu_load;
+}
+
+static void assign_priorities(DaqPlan *plan)
+{
+    // Rate monotonic - the list with the shortest effective period gets the
+    // highest priority, sporadic lists go last.
+    for (int l = 0; l < plan->list_count; l++)
+    {
+        const DaqListPlan *list = &plan->lists[l];
+        uint64_t period = list->event_period_us ? list->event_period_us * list->prescaler : UINT64_MAX;
+        int rank = 0;
+        for (int k = 0; k < plan->list_count; k++)
+        {
+            const DaqListPlan *other = &plan->lists[k];
+            uint64_t other_period = other->event_period_us ? other->event_period_us * other->prescaler : UINT64_MAX;
+            if (other_period < period || (other_period == period && k < l))
+                rank++;
+        }
+        plan->lists[l].priority = (uint8_t)(0xFF - rank);
+    }
+}
+
+int daq_plan_fit(DaqPlan *plan, const DaqBudget *budget)
+{
+    for (int l = 0; l < plan->list_count; l++)
+        plan->lists[l].prescaler = 1;
+    compute_load(plan, budget);
+
+    int result = 0;
+    if (plan->peak_cpu_load > budget->max_cpu_load)
+    {
+        fprintf(stderr, "Peak ECU load %.3g%% per event tick exceeds budget of %.3g%%, prescalers cannot fix this.\n",
+                plan->peak_cpu_load * 100.0, budget->max_cpu_load * 100.0);
+        result = -1;
+    }
+
+    // Greedily slow down whichever list contributes most to the overrun.
+    while (result == 0 && (over_bandwidth(plan, budget) || over_cpu(plan, budget)))
+    {
+        bool bandwidth = over_bandwidth(plan, budget);
+        int worst = -1;
+        double worst_load = 0;
+        for (int l = 0; l < plan->list_count; l++)
+        {
+            const DaqListPlan *list = &plan->lists[l];
+            if (list->event_period_us == 0 || list->prescaler >= budget->max_prescaler)
+                continue;
+            double load = bandwidth ? list->bytes_per_sec
+                                    : list->cpu_us_per_cycle / ((double)list->event_period_us * list->prescaler);
+            if (load > worst_load)
+            {
+                worst = l;
+                worst_load = load;
+            }
+        }
+        if (worst < 0)
+        {
+            fprintf(stderr, "Plan overruns the %s budget even at prescaler %u.\n",
+                    bandwidth ? "bandwidth" : "ECU", budget->max_prescaler);
+            result = -1;
+            break;
+        }
+        plan->lists[worst].prescaler++;
+        compute_load(plan, budget);
+    }
+
+    assign_priorities(plan);
+    return result;
+}
+
+void daq_plan_print(const DaqPlan *plan, const DaqBudget *budget)
+{
+    printf("DAQ plan: %d signal(s) in %d list(s), max DTO %u bytes, timestamp %u bytes\n",
+           plan->signal_count, plan->list_count, plan->max_odt_size, plan->timestamp_size);
+    for (int l = 0; l < plan->list_count; l++)
+    {
+        const DaqListPlan *list = &plan->lists[l];
+        printf("  List %d: event %u (%llu us), prescaler %u, priority %u, %d ODT(s), %u bytes/cycle, %.0f bytes/s, %.1f us ECU/cycle\n",
+               l, list->event_channel, (unsigned long long)list->event_period_us, list->prescaler, list->priority,
+               list->odt_count, list->bytes_per_cycle, list->bytes_per_sec, list->cpu_us_per_cycle);
+        for (int o = 0; o < list->odt_count; o++)
+        {
+            const DaqOdt *odt = &list->odts[o];
+            printf("    ODT %d (PID 0x%02X, %u bytes):", o, list->first_pid + o, odt->size);
+            for (int e = 0; e < odt->entry_count; e++)
+                printf(" %s", plan->signals[odt->signals[e]].name);
+            printf("\n");
+        }
+    }
+
+    printf("  Projected link load: %.0f bytes/s", plan->bytes_per_sec);
+    if (budget->max_bytes_per_sec > 0)
+        printf(" (%.1f%% of %.0f)", 100.0 * plan->bytes_per_sec / budget->max_bytes_per_sec, budget->max_bytes_per_sec);
+    printf("\n");
+    printf("  Projected ECU load: %.3g%% average, %.3g%% peak per event tick (budget %.3g%%)\n",
+           plan->cpu_load * 100.0, plan->peak_cpu_load * 100.0, budget->max_cpu_load * 100.0);
+}
+
+bool daq_plan_lookup_pid(const DaqPlan *plan, uint8_t pid, int *list, int *odt)
+{
+    for (int l = 0; l < plan->list_count; l++)
+    {
+        const DaqListPlan *p = &plan->lists[l];
+        if (pid >= p->first_pid && pid < p->first_pid + p->odt_count)
+        {
+            *list = l;
+            *odt = pid - p->first_pid;
+            return true;
+        }
+    }
+    return false;
+}
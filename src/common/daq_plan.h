@@ -0,0 +1,162 @@
+// DAQ list layout and bandwidth / ECU load planning
+#ifndef DAQ_PLAN_H
+#define DAQ_PLAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "a2l.h"
+
+#define DAQ_MAX_SIGNALS 64
+#define DAQ_MAX_LISTS 8
+#define DAQ_MAX_ODTS_PER_LIST 16
+#define DAQ_MAX_ENTRIES_PER_ODT 32
+
+// Largest ODT we will lay out, in bytes including the PID. Kept small enough
+// that a DTO plus its transport header fits a CMD cache slot (MAX_PACKET_SIZE).
+#define DAQ_MAX_ODT_SIZE 252
+
+// Default ECU cost model for DAQ sampling, in microseconds. These are rough
+// numbers for a small target and should be measured on the real ECU.
+#define DAQ_COST_PER_LIST_US 5.0
+#define DAQ_COST_PER_ODT_US 2.0
+#define DAQ_COST_PER_ENTRY_US 0.5
+#define DAQ_COST_PER_BYTE_US 0.02
+
+#define DAQ_DEFAULT_MAX_PRESCALER 255
+
+// Signals measured when none are given on the command line. XCP_CMD and
+// XCP_DAQ must agree on these to agree on the layout.
+#define DAQ_DEFAULT_SIGNALS {"SIMPLE_RT_Y.Q_1", "SIMPLE_RT_Y.Q_2"}
+
+typedef struct
+{
+    char name[A2L_MAX_NAME];
+    uint16_t event_channel;
+} DaqSignalRequest;
+
+typedef struct
+{
+    char name[A2L_MAX_NAME];
+    A2lDataType type;
+    uint32_t address;
+    uint8_t address_extension;
+    uint8_t size;
+    uint8_t list;   // DAQ list this signal is sampled in
+    uint8_t odt;    // ODT within the list
+    uint8_t entry;  // Entry within the ODT
+    uint16_t offset; // Byte offset of the value within the DTO, PID included
+} DaqSignal;
+
+typedef struct
+{
+    uint8_t signals[DAQ_MAX_ENTRIES_PER_ODT]; // Indexes into DaqPlan.signals
+    int entry_count;
+    uint16_t size; // DTO size in bytes, PID and timestamp included
+} DaqOdt;
+
+typedef struct
+{
+    uint16_t event_channel;
+    uint64_t event_period_us; // 0 for sporadic events
+    uint8_t first_pid;        // Absolute PID of ODT 0
+    DaqOdt odts[DAQ_MAX_ODTS_PER_LIST];
+    int odt_count;
+    int entry_count;
+
+    // Chosen by daq_plan_fit()
+    uint8_t prescaler;
+    uint8_t priority;
+
+    // Projected load at the chosen prescaler
+    uint32_t bytes_per_cycle; // On the wire, transport headers included
+    double bytes_per_sec;
+    double cpu_us_per_cycle; // ECU time spent sampling this list per event
+} DaqListPlan;
+
+typedef struct
+{
+    DaqSignal signals[DAQ_MAX_SIGNALS];
+    int signal_count;
+    DaqListPlan lists[DAQ_MAX_LISTS];
+    int list_count;
+    uint8_t timestamp_size;
+    uint32_t timestamp_ns_per_tick;
+    uint16_t max_odt_size;
+
+    // Totals, filled by daq_plan_fit()
+    double bytes_per_sec;
+    double cpu_load;      // Average fraction of ECU time spent on DAQ
+    double peak_cpu_load; // Tick all periodic lists fire on, as a fraction of the event base tick
+} DaqPlan;
+
+typedef struct
+{
+    double max_bytes_per_sec; // Link budget, 0 for unlimited
+    double max_cpu_load;      // Fraction of each event period the ECU may spend on DAQ
+    uint8_t max_prescaler;
+
+    double cost_per_list_us;
+    double cost_per_odt_us;
+    double cost_per_entry_us;
+    double cost_per_byte_us;
+} DaqBudget;
+
+/**
+ * @brief Fill a budget with the default cost model and no limits.
+ */
+void daq_budget_init(DaqBudget *budget);
+
+/**
+ * @brief Parse a signal spec of the form NAME or NAME@EVENT_CHANNEL.
+ * @return 0 on success, -1 if the spec is malformed.
+ */
+int daq_parse_signal_spec(const char *spec, DaqSignalRequest *request);
+
+/**
+ * @brief Parse signal specs from the command line, or the defaults if there are none.
+ * @param count Number of specs in specs.
+ * @param specs Specs of the form accepted by daq_parse_signal_spec().
+ * @param requests Output, DAQ_MAX_SIGNALS entries.
+ * @return Number of requests, or -1 on a malformed spec or too many signals.
+ */
+int daq_parse_signal_args(int count, char *const specs[], DaqSignalRequest *requests);
+
+/**
+ * @brief Lay out the requested signals into DAQ lists and ODTs.
+ * @param plan Output plan, cleared first.
+ * @param a2l Parsed A2L used to resolve signal addresses, types and events.
+ * @param requests Signals to measure, one DAQ list per distinct event channel.
+ * @param count Number of requests.
+ * @return 0 on success, -1 if a signal or event is unknown or the layout
+ * does not fit the DAQ limits. The reason is printed to stderr.
+ * @note The layout only depends on the A2L and the request order, so XCP_DAQ
+ * can rebuild the exact layout XCP_CMD configured in order to decode DTOs.
+ */
+int daq_plan_layout(DaqPlan *plan, const A2lFile *a2l, const DaqSignalRequest *requests, int count);
+
+/**
+ * @brief Choose prescalers and priorities so the plan fits the budget.
+ * @return 0 if the plan fits, -1 if it would overrun the link or the ECU
+ * even at the largest allowed prescalers. The projected load is filled in
+ * either way so it can be reported.
+ * @note Prescalers only reduce average load. Once per hyperperiod every
+ * periodic list fires on the same tick and the ECU samples all of them, so
+ * the peak per-tick cost is checked separately and cannot be fixed by
+ * prescaling.
+ */
+int daq_plan_fit(DaqPlan *plan, const DaqBudget *budget);
+
+/**
+ * @brief Print the layout and projected load of a plan to stdout.
+ */
+void daq_plan_print(const DaqPlan *plan, const DaqBudget *budget);
+
+/**
+ * @brief Find the list and ODT for an absolute PID.
+ * @return true if the PID belongs to the plan.
+ */
+bool daq_plan_lookup_pid(const DaqPlan *plan, uint8_t pid, int *list, int *odt);
+
+#endif // DAQ_PLAN_H
@@ -0,0 +1,317 @@
+#define _GNU_SOURCE // accept4
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "live_stream.h"
+
+static int make_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        fprintf(stderr, "Live stream socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int live_server_open(LiveServer *server, const char *path, const DaqPlan *plan)
+{
+    memset(server, 0, sizeof(*server));
+    server->listen_fd = -1;
+    server->plan = plan;
+
+    struct sockaddr_un addr;
+    if (make_address(path, &addr) < 0)
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+    {
+        perror("live stream socket");
+        return -1;
+    }
+    unlink(path); // Left behind by a previous XCP_DAQ
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, LIVE_MAX_CLIENTS) < 0)
+    {
+        perror("live stream bind");
+        close(fd);
+        return -1;
+    }
+    server->listen_fd = fd;
+    return 0;
+}
+
+void live_server_close(LiveServer *server)
+{
+    for (int i = 0; i < server->client_count; i++)
+        close(server->clients[i].fd);
+    server->client_count = 0;
+    if (server->listen_fd >= 0)
+    {
+        struct sockaddr_un addr;
+        socklen_t len = sizeof(addr);
+        if (getsockname(server->listen_fd, (struct sockaddr *)&addr, &len) == 0)
+            unlink(addr.sun_path);
+        close(server->listen_fd);
+    }
+    server->listen_fd = -1;
+}
+
+int live_server_pollfds(const LiveServer *server, struct pollfd *pfds)
+{
+    if (server->listen_fd < 0)
+        return 0;
+
+    int n = 0;
+    pfds[n++] = (struct pollfd){.fd = server->listen_fd, .events = POLLIN};
+    for (int i = 0; i < server->client_count; i++)
+        pfds[n++] = (struct pollfd){.fd = server->clients[i].fd, .events = POLLIN};
+    return n;
+}
+
+static void drop_client(LiveServer *server, int index)
+{
+    close(server->clients[index].fd);
+    server->clients[index] = server->clients[--server->client_count];
+}
+
+static int find_signal(const DaqPlan *plan, const char *name)
+{
+    for (int i = 0; i < plan->signal_count; i++)
+    {
+        if (strcmp(plan->signals[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// Apply a subscribe request, replacing any earlier subscription.
+static int subscribe(LiveServer *server, LiveClient *client, const uint8_t *msg, size_t len)
+{
+    LiveSubscribe request;
+    if (len < sizeof(request))
+        return -1;
+    memcpy(&request, msg, sizeof(request));
+    if (request.type != LIVE_MSG_SUBSCRIBE || request.count > DAQ_MAX_SIGNALS)
+        return -1;
+
+    uint32_t rate = request.max_rate_hz ? request.max_rate_hz : LIVE_DEFAULT_RATE_HZ;
+    if (rate > LIVE_MAX_RATE_HZ)
+        rate = LIVE_MAX_RATE_HZ;
+    client->period_ns = 1000000000ULL / rate;
+    client->next_ns = 0;
+    client->mask = 0;
+
+    uint8_t reply[sizeof(LiveHeader) + DAQ_MAX_SIGNALS * sizeof(int16_t)];
+    LiveHeader header = {.type = LIVE_MSG_SUBSCRIBED, .count = request.count};
+    memcpy(reply, &header, sizeof(header));
+
+    const char *name = (const char *)msg + sizeof(request);
+    const char *end = (const char *)msg + len;
+    for (uint16_t id = 0; id < request.count; id++)
+    {
+        int16_t status = -1;
+        size_t name_len = name < end ? strnlen(name, (size_t)(end - name)) : 0;
+        if (name < end && name + name_len < end)
+        {
+            int s = server->plan ? find_signal(server->plan, name) : -1;
+            if (s >= 0)
+            {
+                client->mask |= 1ULL << s;
+                client->ids[s] = id;
+                // Send the latest known value, if any, straight away.
+                client->sent_seq[s] = server->seq[s] ? server->seq[s] - 1 : 0;
+                status = 0;
+            }
+            name += name_len + 1;
+        }
+        memcpy(reply + sizeof(header) + id * sizeof(status), &status, sizeof(status));
+    }
+
+    size_t reply_len = sizeof(header) + request.count * sizeof(int16_t);
+    return send(client->fd, reply, reply_len, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)reply_len ? 0 : -1;
+}
+
+void live_server_handle(LiveServer *server, const struct pollfd *pfds, int count)
+{
+    if (count == 0)
+        return;
+
+    // Viewers from the last, so dropping one (swapped with the last) does
+    // not disturb those still to be handled.
+    for (int i = count - 1; i >= 1; i--)
+    {
+        if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+        int index = i - 1;
+        uint8_t msg[LIVE_MAX_MESSAGE];
+        ssize_t n = recv(server->clients[index].fd, msg, sizeof(msg), MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            continue;
+        if (n <= 0 || subscribe(server, &server->clients[index], msg, (size_t)n) < 0)
+            drop_client(server, index);
+    }
+
+    if (pfds[0].revents & POLLIN)
+    {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+        if (server->client_count == LIVE_MAX_CLIENTS)
+        {
+            fprintf(stderr, "Too many live viewers, refusing one.\n");
+            close(fd);
+            return;
+        }
+        LiveClient *client = &server->clients[server->client_count++];
+        memset(client, 0, sizeof(*client));
+        client->fd = fd;
+    }
+}
+
+// Whether any of the client's signals changed since its last update.
+static int has_changes(const LiveServer *server, const LiveClient *client)
+{
+    for (uint64_t mask = client->mask; mask; mask &= mask - 1)
+    {
+        int s = __builtin_ctzll(mask);
+        if (server->seq[s] != client->sent_seq[s])
+            return 1;
+    }
+    return 0;
+}
+
+int live_server_publish(LiveServer *server, uint64_t now_ns)
+{
+    uint64_t wait_ns = UINT64_MAX;
+    for (int i = server->client_count - 1; i >= 0; i--)
+    {
+        LiveClient *client = &server->clients[i];
+        if (!has_changes(server, client))
+            continue;
+        if (now_ns < client->next_ns)
+        {
+            if (client->next_ns - now_ns < wait_ns)
+                wait_ns = client->next_ns - now_ns;
+            continue;
+        }
+
+        uint8_t msg[sizeof(LiveHeader) + DAQ_MAX_SIGNALS * sizeof(LiveValue)];
+        LiveValue *values = (LiveValue *)(msg + sizeof(LiveHeader));
+        uint16_t count = 0;
+        for (uint64_t mask = client->mask; mask; mask &= mask - 1)
+        {
+            int s = __builtin_ctzll(mask);
+            if (server->seq[s] == client->sent_seq[s])
+                continue;
+            values[count++] = (LiveValue){client->ids[s], server->timestamp_ns[s], server->value[s]};
+        }
+        LiveHeader header = {.type = LIVE_MSG_UPDATE, .count = count, .publish_ns = now_ns};
+        memcpy(msg, &header, sizeof(header));
+
+        client->next_ns = now_ns + client->period_ns;
+        size_t len = sizeof(header) + count * sizeof(LiveValue);
+        ssize_t n = send(client->fd, msg, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // Viewer is behind, the values stay pending and coalesce further.
+            client->deferred++;
+            if (client->period_ns < wait_ns)
+                wait_ns = client->period_ns;
+            continue;
+        }
+        if (n < 0)
+        {
+            drop_client(server, i);
+            continue;
+        }
+        for (uint64_t mask = client->mask; mask; mask &= mask - 1)
+        {
+            int s = __builtin_ctzll(mask);
+            client->sent_seq[s] = server->seq[s];
+        }
+    }
+    return wait_ns == UINT64_MAX ? -1 : (int)((wait_ns + 999999) / 1000000);
+}
+
+int live_subscribe(const char *path, const char *const *names, int count, uint32_t max_rate_hz, int16_t *status)
+{
+    struct sockaddr_un addr;
+    if (count > DAQ_MAX_SIGNALS || make_address(path, &addr) < 0)
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("Failed to connect to XCP_DAQ live stream");
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    uint8_t msg[LIVE_MAX_MESSAGE];
+    LiveSubscribe request = {.type = LIVE_MSG_SUBSCRIBE, .count = (uint16_t)count, .max_rate_hz = max_rate_hz};
+    size_t len = sizeof(request);
+    memcpy(msg, &request, sizeof(request));
+    for (int i = 0; i < count; i++)
+    {
+        size_t name_len = strlen(names[i]) + 1;
+        if (len + name_len > sizeof(msg))
+        {
+            close(fd);
+            return -1;
+        }
+        memcpy(msg + len, names[i], name_len);
+        len += name_len;
+    }
+
+    LiveHeader header;
+    ssize_t n;
+    if (send(fd, msg, len, MSG_NOSIGNAL) != (ssize_t)len || (n = recv(fd, msg, sizeof(msg), 0)) < (ssize_t)sizeof(header))
+    {
+        perror("Live stream subscribe failed");
+        close(fd);
+        return -1;
+    }
+    memcpy(&header, msg, sizeof(header));
+    if (header.type != LIVE_MSG_SUBSCRIBED || header.count != count ||
+        (size_t)n < sizeof(header) + count * sizeof(int16_t))
+    {
+        fprintf(stderr, "Unexpected live stream reply.\n");
+        close(fd);
+        return -1;
+    }
+    memcpy(status, msg + sizeof(header), count * sizeof(int16_t));
+    return fd;
+}
+
+int live_receive(int fd, LiveValue *values, int max, uint64_t *publish_ns)
+{
+    uint8_t msg[LIVE_MAX_MESSAGE];
+    while (1)
+    {
+        ssize_t n = recv(fd, msg, sizeof(msg), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return (int)n;
+
+        LiveHeader header;
+        if ((size_t)n < sizeof(header))
+            continue;
+        memcpy(&header, msg, sizeof(header));
+        if (header.type != LIVE_MSG_UPDATE || (size_t)n < sizeof(header) + header.count * sizeof(LiveValue))
+            continue;
+
+        int count = header.count < max ? header.count : max;
+        memcpy(values, msg + sizeof(header), count * sizeof(LiveValue));
+        *publish_ns = header.publish_ns;
+        return count;
+    }
+}
@@ -0,0 +1,132 @@
+// Live decoded-signal streaming from XCP_DAQ to local viewers
+//
+// Viewers connect to a Unix SOCK_SEQPACKET socket and subscribe to signals by
+// A2L name with a maximum update rate. XCP_DAQ keeps only the latest value of
+// each signal and sends each viewer the values that changed since its last
+// update, at most max_rate_hz times a second. A viewer that cannot keep up
+// gets fewer, newer updates, it never holds up the recorder.
+#ifndef LIVE_STREAM_H
+#define LIVE_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <poll.h>
+
+#include "daq_plan.h"
+#include "daq_decode.h"
+
+#define LIVE_STREAM_PATH "/tmp/xcp_daq_live.sock"
+#define LIVE_MAX_CLIENTS 32
+#define LIVE_DEFAULT_RATE_HZ 10
+#define LIVE_MAX_RATE_HZ 1000
+#define LIVE_MAX_MESSAGE 16384 // Largest message either way, fits 64 full length names
+
+typedef enum
+{
+    LIVE_MSG_SUBSCRIBE = 1,  // Viewer: LiveSubscribe then NUL separated names
+    LIVE_MSG_SUBSCRIBED = 2, // XCP_DAQ: LiveHeader then int16 status per name
+    LIVE_MSG_UPDATE = 3,     // XCP_DAQ: LiveHeader then count LiveValues
+} LiveMsgType;
+
+#pragma pack(push, 1)
+typedef struct
+{
+    uint16_t type;
+    uint16_t count;
+    uint32_t reserved;
+    uint64_t publish_ns; // XCP_DAQ monotonic clock, UPDATE only
+} LiveHeader;
+
+typedef struct
+{
+    uint16_t type;
+    uint16_t count;
+    uint32_t max_rate_hz;
+} LiveSubscribe;
+
+// Signals are identified by their position in the viewer's subscribe request.
+typedef struct
+{
+    uint16_t id;
+    uint64_t timestamp_ns; // DAQ time of the sample
+    double value;
+} LiveValue;
+#pragma pack(pop)
+
+typedef struct
+{
+    int fd;
+    uint64_t mask;                 // Plan signals subscribed to
+    uint16_t ids[DAQ_MAX_SIGNALS]; // Plan signal to subscriber id
+    uint32_t sent_seq[DAQ_MAX_SIGNALS];
+    uint64_t period_ns;
+    uint64_t next_ns; // Earliest time the next update may go out
+    uint64_t deferred; // Updates put off because the viewer's socket was full
+} LiveClient;
+
+typedef struct
+{
+    int listen_fd;
+    const DaqPlan *plan;
+    LiveClient clients[LIVE_MAX_CLIENTS];
+    int client_count;
+
+    // Latest value of each plan signal, seq counts the updates
+    double value[DAQ_MAX_SIGNALS];
+    uint64_t timestamp_ns[DAQ_MAX_SIGNALS];
+    uint32_t seq[DAQ_MAX_SIGNALS];
+} LiveServer;
+
+/**
+ * @brief Start serving viewers for the given plan.
+ * @return 0 on success, -1 on failure (the server is then inert).
+ */
+int live_server_open(LiveServer *server, const char *path, const DaqPlan *plan);
+void live_server_close(LiveServer *server);
+
+/**
+ * @brief Add the listening and viewer sockets to a poll set.
+ * @return Number of entries added, at most LIVE_MAX_CLIENTS + 1.
+ */
+int live_server_pollfds(const LiveServer *server, struct pollfd *pfds);
+
+/**
+ * @brief Handle the poll results of the entries live_server_pollfds() added:
+ * new viewers, subscription changes and hang-ups.
+ */
+void live_server_handle(LiveServer *server, const struct pollfd *pfds, int count);
+
+/**
+ * @brief Record the latest values, called for every decoded frame.
+ */
+static inline void live_server_update(LiveServer *server, const DaqSample *samples, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        int s = samples[i].signal;
+        server->value[s] = samples[i].value;
+        server->timestamp_ns[s] = samples[i].timestamp_ns;
+        server->seq[s]++;
+    }
+}
+
+/**
+ * @brief Send every viewer that is due its changed values, without blocking.
+ * @return Milliseconds until the next update may be due, or -1 if none is.
+ */
+int live_server_publish(LiveServer *server, uint64_t now_ns);
+
+/**
+ * @brief Viewer side: connect and subscribe.
+ * @param status Output, per name 0 if subscribed or -1 if the signal is unknown.
+ * @return Socket to read updates from with live_receive(), or -1 on failure.
+ */
+int live_subscribe(const char *path, const char *const *names, int count, uint32_t max_rate_hz, int16_t *status);
+
+/**
+ * @brief Viewer side: wait for the next update.
+ * @return Number of values, 0 if XCP_DAQ went away, or -1 on error.
+ */
+int live_receive(int fd, LiveValue *values, int max, uint64_t *publish_ns);
+
+#endif // LIVE_STREAM_H
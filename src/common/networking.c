@@ -9,6 +9,7 @@
 #include "networking.h"
 
 #define RETRY_DELAY_SEC 1
+#define UDP_RECEIVE_BUFFER (4 << 20)
 
 void send_packet(int sock, const uint8_t *data, size_t len)
 {
@@ -59,3 +60,91 @@ int connect_with_retry(const char *host, int port, const char *name)
         sleep(RETRY_DELAY_SEC);
     }
 }
+
+int setup_tcp_server(int port)
+{
+    int sock;
+    struct sockaddr_in addr;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY; // Listen on all interfaces
+    addr.sin_port = htons(port);
+
+    int yes = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+
+    if (listen(sock, 5) < 0)
+    {
+        perror("listen");
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+int open_udp_socket(const char *host, int port)
+{
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    if (inet_pton(AF_INET, host, &addr.sin_addr) <= 0)
+    {
+        perror("inet_pton");
+        return -1;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    int size = UDP_RECEIVE_BUFFER;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    // Connecting only sets the default destination and filters what we
+    // receive to that peer, nothing is sent.
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int setup_udp_server(int port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = INADDR_ANY};
+    int yes = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
@@ -31,4 +31,28 @@ int connect_with_retry(const char *host, int port, const char *name);
  */
 void send_packet(int sock, const uint8_t *data, size_t len);
 
+/**
+ * @brief Create a TCP server socket listening on all interfaces.
+ * @param port The port number to listen on.
+ * @return The listening socket file descriptor, or -1 on failure.
+ */
+int setup_tcp_server(int port);
+
+/**
+ * @brief Open a UDP socket connected to a peer, e.g. an XCP on UDP slave.
+ * @param host The IP address of the peer.
+ * @param port The port number of the peer.
+ * @return The socket file descriptor, or -1 on failure.
+ * @note The receive buffer is enlarged so bursts of DAQ datagrams are not
+ * dropped by the kernel while the caller is busy.
+ */
+int open_udp_socket(const char *host, int port);
+
+/**
+ * @brief Create a UDP socket bound to a port on all interfaces.
+ * @param port The port number to bind.
+ * @return The socket file descriptor, or -1 on failure.
+ */
+int setup_udp_server(int port);
+
 #endif // NETWORKING_H
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "packet_pool.h"
+
+// Entries handed to one sendmsg() call
+#define PACKET_SEND_BATCH 64
+
+int packet_pool_init(PacketPool *pool, int block_count)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->blocks = calloc((size_t)block_count, sizeof(PacketBlock));
+    if (!pool->blocks)
+    {
+        perror("Failed to allocate packet pool");
+        return -1;
+    }
+    pool->block_count = block_count;
+    for (int i = 0; i < block_count; i++)
+        pool->blocks[i].next_free = i + 1 < block_count ? i + 1 : -1;
+    pool->free_head = 0;
+    return 0;
+}
+
+void packet_pool_free(PacketPool *pool)
+{
+    free(pool->blocks);
+    memset(pool, 0, sizeof(*pool));
+}
+
+PacketBlock *packet_block_alloc(PacketPool *pool)
+{
+    if (pool->free_head < 0 || !pool->blocks)
+    {
+        pool->exhausted++;
+        return NULL;
+    }
+
+    PacketBlock *block = &pool->blocks[pool->free_head];
+    pool->free_head = block->next_free;
+    block->refs = 1;
+    block->next_free = -1;
+    pool->in_use++;
+    if (pool->in_use > pool->high_water)
+        pool->high_water = pool->in_use;
+    return block;
+}
+
+void packet_block_retain(PacketBlock *block)
+{
+    block->refs++;
+}
+
+void packet_block_release(PacketPool *pool, PacketBlock *block)
+{
+    if (--block->refs > 0)
+        return;
+    block->next_free = pool->free_head;
+    pool->free_head = (int)(block - pool->blocks);
+    pool->in_use--;
+}
+
+void packet_queue_init(PacketQueue *queue)
+{
+    queue->head = 0;
+    queue->count = 0;
+    queue->sent = 0;
+    queue->dropped = 0;
+}
+
+int packet_queue_push(PacketQueue *queue, PacketRef ref)
+{
+    if (queue->count > 0)
+    {
+        PacketRef *last = &queue->refs[(queue->head + queue->count - 1) % PACKET_QUEUE_SIZE];
+        if (last->block == ref.block && last->offset + last->len == ref.offset)
+        {
+            last->len += ref.len;
+            return 0;
+        }
+    }
+
+    if (queue->count == PACKET_QUEUE_SIZE)
+    {
+        queue->dropped++;
+        return -1;
+    }
+    packet_block_retain(ref.block);
+    queue->refs[(queue->head + queue->count) % PACKET_QUEUE_SIZE] = ref;
+    queue->count++;
+    return 0;
+}
+
+// Release entries from the head covering len bytes.
+static void consume(PacketPool *pool, PacketQueue *queue, size_t len)
+{
+    while (len > 0 && queue->count > 0)
+    {
+        PacketRef *ref = &queue->refs[queue->head];
+        size_t left = ref->len - queue->sent;
+        if (len < left)
+        {
+            queue->sent += (uint32_t)len;
+            return;
+        }
+        len -= left;
+        packet_block_release(pool, ref->block);
+        queue->head = (queue->head + 1) % PACKET_QUEUE_SIZE;
+        queue->count--;
+        queue->sent = 0;
+    }
+}
+
+ssize_t packet_queue_send(PacketPool *pool, PacketQueue *queue, int fd)
+{
+    ssize_t total = 0;
+    while (queue->count > 0)
+    {
+        struct iovec iov[PACKET_SEND_BATCH];
+        int iovcnt = 0;
+        for (uint32_t i = 0; i < queue->count && iovcnt < PACKET_SEND_BATCH; i++)
+        {
+            const PacketRef *ref = &queue->refs[(queue->head + i) % PACKET_QUEUE_SIZE];
+            uint32_t skip = i == 0 ? queue->sent : 0;
+            iov[iovcnt].iov_base = (void *)(packet_ref_data(ref) + skip);
+            iov[iovcnt].iov_len = ref->len - skip;
+            iovcnt++;
+        }
+
+        struct msghdr msg = {.msg_iov = iov, .msg_iovlen = (size_t)iovcnt};
+        ssize_t n = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+                return total;
+            return -1;
+        }
+        consume(pool, queue, (size_t)n);
+        total += n;
+    }
+    return total;
+}
+
+void packet_queue_clear(PacketPool *pool, PacketQueue *queue)
+{
+    while (queue->count > 0)
+    {
+        packet_block_release(pool, queue->refs[queue->head].block);
+        queue->head = (queue->head + 1) % PACKET_QUEUE_SIZE;
+        queue->count--;
+    }
+    queue->sent = 0;
+}
@@ -0,0 +1,97 @@
+// Reference-counted receive buffers, so one frame can be queued to several
+// consumers without copying it.
+#ifndef PACKET_POOL_H
+#define PACKET_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// A block holds many frames, a whole recv() lands in one block.
+#define PACKET_BLOCK_SIZE 16384
+#define PACKET_POOL_BLOCKS 64
+#define PACKET_QUEUE_SIZE 1024
+
+// Blocks are used from a single thread, the counts are not atomic.
+typedef struct
+{
+    uint32_t refs;
+    int32_t next_free; // Free list link while refs == 0
+    uint8_t data[PACKET_BLOCK_SIZE];
+} PacketBlock;
+
+typedef struct
+{
+    PacketBlock *blocks;
+    int block_count;
+    int free_head;
+    int in_use;
+    int high_water;
+    uint64_t exhausted; // Allocations refused because every block was in use
+} PacketPool;
+
+// Handle to one frame (or a run of frames) inside a block.
+typedef struct
+{
+    PacketBlock *block;
+    uint32_t offset;
+    uint32_t len;
+} PacketRef;
+
+// FIFO of frame handles, each holding a reference on its block.
+typedef struct
+{
+    PacketRef refs[PACKET_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t count;
+    uint32_t sent; // Bytes of the head entry already consumed
+    uint64_t dropped;
+} PacketQueue;
+
+/**
+ * @brief Allocate all blocks up front, nothing is allocated after this.
+ * @return 0 on success, -1 if out of memory.
+ */
+int packet_pool_init(PacketPool *pool, int block_count);
+void packet_pool_free(PacketPool *pool);
+
+/**
+ * @brief Take a block from the pool with one reference held by the caller.
+ * @return The block, or NULL if every block is still referenced.
+ */
+PacketBlock *packet_block_alloc(PacketPool *pool);
+void packet_block_retain(PacketBlock *block);
+
+/**
+ * @brief Drop a reference, the block returns to the pool with the last one.
+ */
+void packet_block_release(PacketPool *pool, PacketBlock *block);
+
+static inline const uint8_t *packet_ref_data(const PacketRef *ref)
+{
+    return ref->block->data + ref->offset;
+}
+
+void packet_queue_init(PacketQueue *queue);
+
+/**
+ * @brief Queue a frame, taking a reference on its block. A frame directly
+ * following the last queued one in the same block extends that entry instead.
+ * @return 0 on success, -1 if the queue is full (counted in dropped).
+ */
+int packet_queue_push(PacketQueue *queue, PacketRef ref);
+
+/**
+ * @brief Send as much of the queue as the socket takes without blocking, with
+ * one sendmsg() per batch of entries.
+ * @return Bytes sent, or -1 on a socket error. Sent entries are released,
+ * whatever the socket did not take stays queued.
+ */
+ssize_t packet_queue_send(PacketPool *pool, PacketQueue *queue, int fd);
+
+/**
+ * @brief Release every queued entry.
+ */
+void packet_queue_clear(PacketPool *pool, PacketQueue *queue);
+
+#endif // PACKET_POOL_H
@@ -0,0 +1,275 @@
+// Spinning is adaptive: the loop only burns CPU for spin_us after data, to
+// catch the rest of a burst, and for spin_us either side of the time the
+// next cycle is expected. In between it sleeps, with ppoll() so the wake-up
+// ahead of the next cycle is not rounded to a millisecond.
+#define _GNU_SOURCE // sched_setaffinity, ppoll
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sched.h>
+#include <malloc.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "realtime.h"
+#include "time_utils.h"
+
+// Cores that exist, as far as a cpu_set_t reaches.
+static long cpu_limit(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    return n > 0 && n < CPU_SETSIZE ? n : CPU_SETSIZE;
+}
+
+// Parse one number of a "CPU:PRIORITY:SPIN_US" spec and step past it.
+static int parse_field(const char **text, long min, long max, long *value)
+{
+    char *end;
+    errno = 0;
+    long v = strtol(*text, &end, 10);
+    if (end == *text || errno == ERANGE || v < min || v > max)
+        return -1;
+    *value = v;
+    *text = end;
+    return 0;
+}
+
+int realtime_parse(const char *text, RealtimeConfig *config)
+{
+    long cpu, priority = REALTIME_DEFAULT_PRIORITY, spin_us = REALTIME_DEFAULT_SPIN_US;
+    const char *p = text;
+    if (parse_field(&p, -1, LONG_MAX, &cpu) < 0)
+        return -1;
+    if (*p == ':')
+    {
+        p++;
+        if (parse_field(&p, 0, 99, &priority) < 0)
+            return -1;
+    }
+    if (*p == ':')
+    {
+        p++;
+        if (parse_field(&p, 0, REALTIME_MAX_SPIN_US, &spin_us) < 0)
+            return -1;
+    }
+    if (*p != '\0')
+        return -1;
+    if (cpu >= cpu_limit())
+    {
+        fprintf(stderr, "No core %ld, this system has %ld.\n", cpu, cpu_limit());
+        return -1;
+    }
+
+    config->cpu = (int)cpu;
+    config->priority = (int)priority;
+    config->spin_us = (uint32_t)spin_us;
+    return 0;
+}
+
+static void prefault_stack(void)
+{
+    volatile uint8_t stack[REALTIME_PREFAULT_STACK];
+    for (size_t i = 0; i < sizeof(stack); i += 4096)
+        stack[i] = 0;
+}
+
+int realtime_enter(Realtime *rt, const RealtimeConfig *config)
+{
+    memset(rt, 0, sizeof(*rt));
+    rt->config = *config;
+    rt->latency.min_ns = UINT64_MAX;
+    rt->cycle.min_ns = UINT64_MAX;
+
+    if (config->cpu >= cpu_limit() || config->spin_us > REALTIME_MAX_SPIN_US)
+    {
+        fprintf(stderr, "Invalid low-latency settings: core %d, spinning %u us.\n", config->cpu, config->spin_us);
+        return -1;
+    }
+    if (config->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(config->cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        {
+            fprintf(stderr, "Cannot pin to core %d: %s\n", config->cpu, strerror(errno));
+            return -1;
+        }
+    }
+
+    bool fifo = false;
+    if (config->priority > 0)
+    {
+        struct sched_param param = {.sched_priority = config->priority};
+        fifo = sched_setscheduler(0, SCHED_FIFO, &param) == 0;
+        if (!fifo)
+            fprintf(stderr, "SCHED_FIFO not permitted (%s), keeping the normal scheduler.\n", strerror(errno));
+    }
+
+    // Keep freed memory in the process, so nothing is faulted in again later.
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    bool locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+    if (!locked)
+        fprintf(stderr, "Memory not locked (%s), buffers are only prefaulted.\n", strerror(errno));
+    prefault_stack();
+
+    rt->enabled = true;
+    char where[32] = "any core";
+    if (config->cpu >= 0)
+        snprintf(where, sizeof(where), "core %d", config->cpu);
+    printf("Low-latency mode: %s, %s, memory %slocked, spinning %u us.\n", where,
+           fifo ? "SCHED_FIFO" : "normal scheduler", locked ? "" : "not ", config->spin_us);
+    return 0;
+}
+
+void realtime_prefault(void *buffer, size_t len)
+{
+    volatile uint8_t *p = buffer;
+    for (size_t i = 0; i < len; i += 4096)
+        p[i] = p[i];
+}
+
+void realtime_socket(const Realtime *rt, int fd)
+{
+    if (!rt->enabled || fd < 0)
+        return;
+    int usec = (int)rt->config.spin_us;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0)
+        perror("SO_BUSY_POLL");
+}
+
+static void jitter_add(JitterHistogram *h, uint64_t ns)
+{
+    uint64_t bucket = ns / 1000;
+    h->buckets[bucket < JITTER_BUCKETS ? bucket : JITTER_BUCKETS - 1]++;
+    h->count++;
+    h->sum_ns += ns;
+    if (ns < h->min_ns)
+        h->min_ns = ns;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+}
+
+// Upper edge of the bucket holding the given fraction of samples, in us.
+static double jitter_percentile(const JitterHistogram *h, double fraction)
+{
+    uint64_t target = (uint64_t)(h->count * fraction);
+    uint64_t seen = 0;
+    for (int i = 0; i < JITTER_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen > target)
+            return i + 1;
+    }
+    return h->max_ns / 1e3;
+}
+
+static int spin_until(struct pollfd *pfds, nfds_t nfds, uint64_t deadline_ns)
+{
+    do
+    {
+        int ret = poll(pfds, nfds, 0);
+        if (ret != 0)
+            return ret;
+    } while (time_now_ns() < deadline_ns);
+    return 0;
+}
+
+static int sleep_until(struct pollfd *pfds, nfds_t nfds, uint64_t now, uint64_t until_ns)
+{
+    uint64_t ns = until_ns - now;
+    struct timespec ts = {.tv_sec = (time_t)(ns / 1000000000ULL), .tv_nsec = (long)(ns % 1000000000ULL)};
+    return ppoll(pfds, nfds, &ts, NULL);
+}
+
+int realtime_poll(Realtime *rt, struct pollfd *pfds, nfds_t nfds, int timeout_ms)
+{
+    if (!rt->enabled)
+        return poll(pfds, nfds, timeout_ms);
+
+    uint64_t spin_ns = rt->config.spin_us * 1000ULL;
+    uint64_t now = time_now_ns();
+    uint64_t deadline = timeout_ms < 0 ? UINT64_MAX : now + (uint64_t)timeout_ms * 1000000ULL;
+    int ret = 0;
+    rt->spun = false;
+
+    if (rt->last_ns && now < rt->last_ns + spin_ns)
+    {
+        // The rest of a burst
+        ret = spin_until(pfds, nfds, rt->last_ns + spin_ns);
+        rt->spun = ret > 0;
+        now = time_now_ns();
+    }
+    if (ret == 0 && rt->period_ns)
+    {
+        // Sleep until just before the next cycle is due, then spin past it.
+        // Neither goes beyond the timeout.
+        uint64_t due = rt->last_ns + rt->period_ns;
+        if (now + spin_ns < due)
+        {
+            ret = sleep_until(pfds, nfds, now, due - spin_ns < deadline ? due - spin_ns : deadline);
+            now = time_now_ns();
+        }
+        if (ret == 0 && now < deadline && now + spin_ns >= due && now < due + spin_ns)
+        {
+            ret = spin_until(pfds, nfds, due + spin_ns < deadline ? due + spin_ns : deadline);
+            rt->spun = ret > 0;
+            now = time_now_ns();
+        }
+    }
+    if (ret == 0 && now < deadline)
+        ret = timeout_ms < 0 ? poll(pfds, nfds, -1) : sleep_until(pfds, nfds, now, deadline);
+
+    rt->wake_ns = time_now_ns();
+    return ret;
+}
+
+void realtime_ingested(Realtime *rt)
+{
+    if (!rt->enabled)
+        return;
+    uint64_t now = time_now_ns();
+    jitter_add(&rt->latency, now - rt->wake_ns);
+    rt->wakeups++;
+    if (rt->spun)
+        rt->spin_wakeups++;
+
+    // Wake-ups within the spin window are the same cycle as the last one.
+    uint64_t gap = rt->last_ns ? rt->wake_ns - rt->last_ns : 0;
+    if (rt->period_ns && gap > 4 * rt->period_ns)
+    {
+        // The stream paused, learn the period again.
+        rt->period_ns = 0;
+    }
+    else if (gap > rt->config.spin_us * 1000ULL)
+    {
+        if (rt->period_ns)
+            jitter_add(&rt->cycle, gap > rt->period_ns ? gap - rt->period_ns : rt->period_ns - gap);
+        rt->period_ns = rt->period_ns ? (rt->period_ns * 7 + gap) / 8 : gap;
+    }
+    rt->last_ns = rt->wake_ns;
+}
+
+static void print_histogram(const char *name, const JitterHistogram *h)
+{
+    if (h->count == 0)
+        return;
+    printf("%s: %llu samples, min %.1f us, mean %.1f us, p50 %.0f us, p99 %.0f us, p99.9 %.0f us, max %.1f us\n",
+           name, (unsigned long long)h->count, h->min_ns / 1e3, (double)h->sum_ns / h->count / 1e3,
+           jitter_percentile(h, 0.5), jitter_percentile(h, 0.99), jitter_percentile(h, 0.999), h->max_ns / 1e3);
+}
+
+void realtime_report(const Realtime *rt)
+{
+    if (!rt->enabled)
+        return;
+    printf("Ingest wake-ups: %llu, %llu while spinning, cycle period %.1f us\n", (unsigned long long)rt->wakeups,
+           (unsigned long long)rt->spin_wakeups, rt->period_ns / 1e3);
+    print_histogram("Wake-up to ingested", &rt->latency);
+    print_histogram("Cycle jitter", &rt->cycle);
+}
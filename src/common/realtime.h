@@ -0,0 +1,96 @@
+// Low-latency runtime mode for the ingest loops of CMD and XCP_DAQ
+//
+// Pins the process to a core, runs it SCHED_FIFO and locks its memory where
+// the system permits, and replaces the plain poll() of the event loop with
+// one that spins for a while before sleeping: right after data arrived, and
+// shortly before the next cycle is due. Wake-ups are timed so the jitter of
+// the loop can be reported.
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <poll.h>
+
+#define REALTIME_DEFAULT_PRIORITY 50
+#define REALTIME_DEFAULT_SPIN_US 50
+#define REALTIME_MAX_SPIN_US 100000 // Longer is a typo, not a tuning
+#define REALTIME_PREFAULT_STACK (256u << 10)
+#define JITTER_BUCKETS 1000 // 1 us each, longer waits land in the last
+
+typedef struct
+{
+    int cpu;          // Core to pin to, -1 to run anywhere
+    int priority;     // SCHED_FIFO priority, 0 to keep the normal scheduler
+    uint32_t spin_us; // Spin window, also the SO_BUSY_POLL time
+} RealtimeConfig;
+
+typedef struct
+{
+    uint64_t buckets[JITTER_BUCKETS];
+    uint64_t count;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t sum_ns;
+} JitterHistogram;
+
+typedef struct
+{
+    RealtimeConfig config;
+    bool enabled;
+
+    uint64_t wake_ns;   // When the last poll returned
+    uint64_t last_ns;   // Last ingest, 0 before the first
+    uint64_t period_ns; // Smoothed gap between cycles, 0 until known
+    bool spun;          // The last poll returned while spinning
+
+    JitterHistogram latency; // Wake-up to ingest done
+    JitterHistogram cycle;   // Deviation of each gap between cycles from period_ns
+    uint64_t wakeups;
+    uint64_t spin_wakeups; // Data found while spinning rather than asleep
+} Realtime;
+
+/**
+ * @brief Parse "CPU[:PRIORITY[:SPIN_US]]".
+ * @return 0 on success, -1 if malformed or out of range: CPU from -1 to the
+ * last configured core, PRIORITY 0..99, SPIN_US 0..REALTIME_MAX_SPIN_US.
+ */
+int realtime_parse(const char *text, RealtimeConfig *config);
+
+/**
+ * @brief Enter low-latency mode: pin, switch to SCHED_FIFO, lock memory and
+ * prefault the stack. Call once the big buffers are allocated. Anything the
+ * system refuses is reported and skipped.
+ * @return 0 on success, -1 if the core cannot be used or the config is out
+ * of the ranges realtime_parse() accepts.
+ */
+int realtime_enter(Realtime *rt, const RealtimeConfig *config);
+
+/**
+ * @brief Touch every page of a buffer so the first frames do not fault.
+ */
+void realtime_prefault(void *buffer, size_t len);
+
+/**
+ * @brief Enable SO_BUSY_POLL on the ingest socket. No-op when not enabled.
+ */
+void realtime_socket(const Realtime *rt, int fd);
+
+/**
+ * @brief poll(), spinning first when data is recent or the next cycle is due.
+ * Never waits past timeout_ms. A plain poll() when not enabled.
+ */
+int realtime_poll(Realtime *rt, struct pollfd *pfds, nfds_t nfds, int timeout_ms);
+
+/**
+ * @brief Mark the end of handling ingest data the last poll woke up for.
+ */
+void realtime_ingested(Realtime *rt);
+
+/**
+ * @brief Print the latency and jitter statistics.
+ */
+void realtime_report(const Realtime *rt);
+
+#endif // REALTIME_H
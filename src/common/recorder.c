@@ -0,0 +1,66 @@
+#include <string.h>
+
+#include "recorder.h"
+
+int recorder_open(Recorder *recorder, const char *filename)
+{
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->file = fopen(filename, "ab");
+    if (!recorder->file)
+    {
+        perror("Failed to open recording");
+        return -1;
+    }
+    fseek(recorder->file, 0, SEEK_END);
+    long size = ftell(recorder->file);
+    recorder->offset = size > 0 ? (uint64_t)size : 0;
+    return 0;
+}
+
+int recorder_enable_index(Recorder *recorder, const char *filename, const DaqPlan *plan,
+                          const DaqDecoder *decoder, RecordingClock clock)
+{
+    char index_file[512];
+    snprintf(index_file, sizeof(index_file), "%s%s", filename, RECORDING_INDEX_SUFFIX);
+    return index_writer_open(&recorder->index, index_file, plan, decoder, clock);
+}
+
+int recorder_write(Recorder *recorder, const uint8_t *data, size_t len)
+{
+    if (!recorder->file)
+        return -1;
+    if (fwrite(data, 1, len, recorder->file) != len)
+    {
+        perror("Failed to write recording");
+        return -1;
+    }
+    recorder->offset += len;
+    recorder->bytes_written += len;
+    return 0;
+}
+
+int recorder_write_frame(Recorder *recorder, const uint8_t *frame, size_t len)
+{
+    index_writer_frame(&recorder->index, recorder->offset, len);
+    return recorder_write(recorder, frame, len);
+}
+
+void recorder_index_samples(Recorder *recorder, const DaqSample *samples, int count)
+{
+    index_writer_samples(&recorder->index, samples, count);
+}
+
+void recorder_flush(Recorder *recorder)
+{
+    if (recorder->file)
+        fflush(recorder->file);
+    index_writer_flush(&recorder->index);
+}
+
+void recorder_close(Recorder *recorder)
+{
+    if (recorder->file)
+        fclose(recorder->file);
+    recorder->file = NULL;
+    index_writer_close(&recorder->index);
+}
@@ -0,0 +1,60 @@
+// Append-only persistence of the raw DAQ stream (xcp_data.bin)
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "daq_plan.h"
+#include "daq_decode.h"
+#include "recording_index.h"
+
+#define DEFAULT_RECORDING_FILE "xcp_data.bin"
+
+typedef struct
+{
+    FILE *file;
+    uint64_t offset; // Size of the recording, i.e. where the next write lands
+    uint64_t bytes_written;
+    RecordingIndexWriter index;
+} Recorder;
+
+/**
+ * @brief Open a recording for appending.
+ * @return 0 on success, -1 on failure.
+ */
+int recorder_open(Recorder *recorder, const char *filename);
+
+/**
+ * @brief Maintain a sparse time index (<filename>.idx) next to the recording.
+ * @param plan Layout of the frames that will be written from now on.
+ * @param decoder Decoder the caller decodes frames with, see recorder_write_frame().
+ * @param clock How chunks are stamped with wall time, see RecordingClock.
+ * @return 0 on success, -1 if the index could not be opened.
+ */
+int recorder_enable_index(Recorder *recorder, const char *filename, const DaqPlan *plan,
+                          const DaqDecoder *decoder, RecordingClock clock);
+
+/**
+ * @brief Append raw stream bytes to the recording.
+ * @return 0 on success, -1 on a write error.
+ * @note Data is buffered, call recorder_flush() at the end of each batch so a
+ * crash of XCP_DAQ does not lose what CMD already handed over. Bytes written
+ * this way are not indexed, use recorder_write_frame() for indexed recordings.
+ */
+int recorder_write(Recorder *recorder, const uint8_t *data, size_t len);
+
+/**
+ * @brief Append one whole XCP frame (header included) to the recording.
+ * @note Call before decoding the frame, then pass the decoded samples to
+ * recorder_index_samples() so the index knows the frame's time and signals.
+ */
+int recorder_write_frame(Recorder *recorder, const uint8_t *frame, size_t len);
+void recorder_index_samples(Recorder *recorder, const DaqSample *samples, int count);
+
+void recorder_flush(Recorder *recorder);
+void recorder_close(Recorder *recorder);
+
+#endif // RECORDER_H
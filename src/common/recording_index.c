@@ -0,0 +1,742 @@
+// Index writing happens inline with recording, queries only touch the
+// chunks the index says overlap the request.
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "recording_index.h"
+#include "xcp_utils.h"
+#include "time_utils.h"
+
+// Largest payload of a record, a segment with every signal and list in use
+// comes to about 14 KiB.
+#define RECORD_MAX_BYTES 32768
+
+// Little-endian field codec for record payloads. Running past the end sets
+// bad instead of touching memory, so a payload only has to be checked once.
+typedef struct
+{
+    uint8_t *data;
+    size_t len;
+    size_t pos;
+    bool bad;
+} Fields;
+
+static void put_bytes(Fields *f, const void *src, size_t n)
+{
+    if (f->pos + n > f->len)
+    {
+        f->bad = true;
+        return;
+    }
+    memcpy(f->data + f->pos, src, n);
+    f->pos += n;
+}
+
+static void put_uint(Fields *f, uint64_t value, int bytes)
+{
+    uint8_t le[8];
+    for (int i = 0; i < bytes; i++)
+        le[i] = (uint8_t)(value >> (8 * i));
+    put_bytes(f, le, (size_t)bytes);
+}
+
+static void put_double(Fields *f, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_uint(f, bits, 8);
+}
+
+static void put_text(Fields *f, const char *text, size_t max)
+{
+    size_t n = strnlen(text, max - 1);
+    put_uint(f, n, 1);
+    put_bytes(f, text, n);
+}
+
+static uint64_t get_uint(Fields *f, int bytes)
+{
+    if (f->pos + (size_t)bytes > f->len)
+    {
+        f->bad = true;
+        return 0;
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= (uint64_t)f->data[f->pos + i] << (8 * i);
+    f->pos += (size_t)bytes;
+    return value;
+}
+
+static double get_double(Fields *f)
+{
+    uint64_t bits = get_uint(f, 8);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void get_text(Fields *f, char *text, size_t max)
+{
+    size_t n = (size_t)get_uint(f, 1);
+    if (n >= max || f->pos + n > f->len)
+    {
+        f->bad = true;
+        text[0] = '\0';
+        return;
+    }
+    memcpy(text, f->data + f->pos, n);
+    text[n] = '\0';
+    f->pos += n;
+}
+
+static void put_plan(Fields *f, const DaqPlan *plan)
+{
+    put_uint(f, (uint64_t)plan->signal_count, 1);
+    for (int i = 0; i < plan->signal_count; i++)
+    {
+        const DaqSignal *sig = &plan->signals[i];
+        put_text(f, sig->name, sizeof(sig->name));
+        put_uint(f, (uint64_t)sig->type, 1);
+        put_uint(f, sig->address, 4);
+        put_uint(f, sig->address_extension, 1);
+        put_uint(f, sig->size, 1);
+        put_uint(f, sig->list, 1);
+        put_uint(f, sig->odt, 1);
+        put_uint(f, sig->entry, 1);
+        put_uint(f, sig->offset, 2);
+    }
+
+    put_uint(f, (uint64_t)plan->list_count, 1);
+    for (int l = 0; l < plan->list_count; l++)
+    {
+        const DaqListPlan *list = &plan->lists[l];
+        put_uint(f, list->event_channel, 2);
+        put_uint(f, list->event_period_us, 8);
+        put_uint(f, list->first_pid, 1);
+        put_uint(f, (uint64_t)list->odt_count, 1);
+        for (int o = 0; o < list->odt_count; o++)
+        {
+            const DaqOdt *odt = &list->odts[o];
+            put_uint(f, (uint64_t)odt->entry_count, 1);
+            put_bytes(f, odt->signals, (size_t)odt->entry_count);
+            put_uint(f, odt->size, 2);
+        }
+        put_uint(f, (uint64_t)list->entry_count, 2);
+        put_uint(f, list->prescaler, 1);
+        put_uint(f, list->priority, 1);
+        put_uint(f, list->bytes_per_cycle, 4);
+        put_double(f, list->bytes_per_sec);
+        put_double(f, list->cpu_us_per_cycle);
+    }
+
+    put_uint(f, plan->timestamp_size, 1);
+    put_uint(f, plan->timestamp_ns_per_tick, 4);
+    put_uint(f, plan->max_odt_size, 2);
+    put_double(f, plan->bytes_per_sec);
+    put_double(f, plan->cpu_load);
+    put_double(f, plan->peak_cpu_load);
+}
+
+// Counts and indexes are checked against the plan limits, the decoder trusts them.
+static void get_plan(Fields *f, DaqPlan *plan)
+{
+    memset(plan, 0, sizeof(*plan));
+    plan->signal_count = (int)get_uint(f, 1);
+    if (plan->signal_count > DAQ_MAX_SIGNALS)
+    {
+        f->bad = true;
+        return;
+    }
+    for (int i = 0; i < plan->signal_count; i++)
+    {
+        DaqSignal *sig = &plan->signals[i];
+        get_text(f, sig->name, sizeof(sig->name));
+        sig->type = (A2lDataType)get_uint(f, 1);
+        sig->address = (uint32_t)get_uint(f, 4);
+        sig->address_extension = (uint8_t)get_uint(f, 1);
+        sig->size = (uint8_t)get_uint(f, 1);
+        sig->list = (uint8_t)get_uint(f, 1);
+        sig->odt = (uint8_t)get_uint(f, 1);
+        sig->entry = (uint8_t)get_uint(f, 1);
+        sig->offset = (uint16_t)get_uint(f, 2);
+    }
+
+    plan->list_count = (int)get_uint(f, 1);
+    if (plan->list_count > DAQ_MAX_LISTS)
+    {
+        f->bad = true;
+        return;
+    }
+    for (int l = 0; l < plan->list_count && !f->bad; l++)
+    {
+        DaqListPlan *list = &plan->lists[l];
+        list->event_channel = (uint16_t)get_uint(f, 2);
+        list->event_period_us = get_uint(f, 8);
+        list->first_pid = (uint8_t)get_uint(f, 1);
+        list->odt_count = (int)get_uint(f, 1);
+        if (list->odt_count > DAQ_MAX_ODTS_PER_LIST)
+        {
+            f->bad = true;
+            return;
+        }
+        for (int o = 0; o < list->odt_count; o++)
+        {
+            DaqOdt *odt = &list->odts[o];
+            odt->entry_count = (int)get_uint(f, 1);
+            if (odt->entry_count > DAQ_MAX_ENTRIES_PER_ODT)
+            {
+                f->bad = true;
+                return;
+            }
+            for (int e = 0; e < odt->entry_count; e++)
+                odt->signals[e] = (uint8_t)get_uint(f, 1);
+            odt->size = (uint16_t)get_uint(f, 2);
+
+            // The decoder reads each value at its offset in a DTO of odt->size bytes.
+            for (int e = 0; e < odt->entry_count; e++)
+            {
+                const DaqSignal *sig = &plan->signals[odt->signals[e]];
+                if (odt->signals[e] >= plan->signal_count || sig->size > 8 || sig->offset + sig->size > odt->size)
+                    f->bad = true;
+            }
+        }
+        list->entry_count = (int)get_uint(f, 2);
+        list->prescaler = (uint8_t)get_uint(f, 1);
+        list->priority = (uint8_t)get_uint(f, 1);
+        list->bytes_per_cycle = (uint32_t)get_uint(f, 4);
+        list->bytes_per_sec = get_double(f);
+        list->cpu_us_per_cycle = get_double(f);
+    }
+
+    plan->timestamp_size = (uint8_t)get_uint(f, 1);
+    if (plan->timestamp_size > 4)
+        f->bad = true;
+    plan->timestamp_ns_per_tick = (uint32_t)get_uint(f, 4);
+    plan->max_odt_size = (uint16_t)get_uint(f, 2);
+    plan->bytes_per_sec = get_double(f);
+    plan->cpu_load = get_double(f);
+    plan->peak_cpu_load = get_double(f);
+}
+
+static void put_chunk(Fields *f, const RecordingChunk *chunk)
+{
+    put_uint(f, chunk->offset, 8);
+    put_uint(f, chunk->length, 4);
+    put_uint(f, chunk->frames, 4);
+    put_uint(f, chunk->wall_ns, 8);
+    put_uint(f, chunk->first_ts_ns, 8);
+    put_uint(f, chunk->last_ts_ns, 8);
+    put_uint(f, chunk->signal_mask, 8);
+    put_uint(f, chunk->timestamp_wraps, 8);
+    put_uint(f, DAQ_MAX_LISTS, 1);
+    for (int l = 0; l < DAQ_MAX_LISTS; l++)
+        put_uint(f, chunk->list_timestamp_ns[l], 8);
+    put_uint(f, chunk->last_raw_timestamp, 4);
+    put_uint(f, chunk->have_timestamp, 1);
+}
+
+static void get_chunk(Fields *f, RecordingChunk *chunk)
+{
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->offset = get_uint(f, 8);
+    chunk->length = (uint32_t)get_uint(f, 4);
+    chunk->frames = (uint32_t)get_uint(f, 4);
+    chunk->wall_ns = get_uint(f, 8);
+    chunk->first_ts_ns = get_uint(f, 8);
+    chunk->last_ts_ns = get_uint(f, 8);
+    chunk->signal_mask = get_uint(f, 8);
+    chunk->timestamp_wraps = get_uint(f, 8);
+    int lists = (int)get_uint(f, 1);
+    if (lists > DAQ_MAX_LISTS)
+    {
+        f->bad = true;
+        return;
+    }
+    for (int l = 0; l < lists; l++)
+        chunk->list_timestamp_ns[l] = get_uint(f, 8);
+    chunk->last_raw_timestamp = (uint32_t)get_uint(f, 4);
+    chunk->have_timestamp = (uint32_t)get_uint(f, 1);
+}
+
+static void put_capture(Fields *f, const RecordingCapture *capture)
+{
+    put_uint(f, capture->trigger_wall_ns, 8);
+    put_uint(f, capture->trigger_ts_ns, 8);
+    put_uint(f, capture->first_ts_ns, 8);
+    put_uint(f, capture->last_ts_ns, 8);
+    put_uint(f, capture->offset, 8);
+    put_uint(f, capture->length, 8);
+    put_text(f, capture->trigger, sizeof(capture->trigger));
+}
+
+static void get_capture(Fields *f, RecordingCapture *capture)
+{
+    memset(capture, 0, sizeof(*capture));
+    capture->trigger_wall_ns = get_uint(f, 8);
+    capture->trigger_ts_ns = get_uint(f, 8);
+    capture->first_ts_ns = get_uint(f, 8);
+    capture->last_ts_ns = get_uint(f, 8);
+    capture->offset = get_uint(f, 8);
+    capture->length = get_uint(f, 8);
+    get_text(f, capture->trigger, sizeof(capture->trigger));
+}
+
+static void write_record(FILE *file, RecordingRecordType type, const Fields *payload)
+{
+    uint8_t header[sizeof(RecordingRecord)];
+    Fields h = {.data = header, .len = sizeof(header)};
+    put_uint(&h, type, 4);
+    put_uint(&h, payload->pos, 4);
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(payload->data, payload->pos, 1, file);
+}
+
+// Check the file header of an index being appended to, or write it to a new
+// one. A record cut short by a crash is cut off, the new records must follow
+// a complete one for the index to load.
+static int open_file_header(FILE *file, const char *index_file)
+{
+    uint8_t header[sizeof(RecordingFileHeader)];
+    Fields h = {.data = header, .len = sizeof(header)};
+    if (fseek(file, 0, SEEK_END) != 0)
+        return -1;
+    long size = ftell(file);
+    if (size < (long)sizeof(header))
+    {
+        // New, or the crash came before the header was out.
+        if (size > 0 && ftruncate(fileno(file), 0) < 0)
+            return -1;
+        put_uint(&h, RECORDING_INDEX_MAGIC, 4);
+        put_uint(&h, RECORDING_INDEX_VERSION, 2);
+        put_uint(&h, 0, 2);
+        fwrite(header, sizeof(header), 1, file);
+        return 0;
+    }
+
+    rewind(file);
+    if (fread(header, sizeof(header), 1, file) != 1 || get_uint(&h, 4) != RECORDING_INDEX_MAGIC ||
+        get_uint(&h, 2) != RECORDING_INDEX_VERSION)
+    {
+        fprintf(stderr, "%s is not a version %d recording index, move it aside or rebuild it with XCP_QUERY -R\n",
+                index_file, RECORDING_INDEX_VERSION);
+        return -1;
+    }
+
+    long end = (long)sizeof(header);
+    uint8_t raw[sizeof(RecordingRecord)];
+    while (end < size && fread(raw, sizeof(raw), 1, file) == 1)
+    {
+        Fields r = {.data = raw, .len = sizeof(raw)};
+        get_uint(&r, 4);
+        uint32_t length = (uint32_t)get_uint(&r, 4);
+        if (length > RECORD_MAX_BYTES)
+        {
+            fprintf(stderr, "Corrupt recording index %s, rebuild it with XCP_QUERY -R\n", index_file);
+            return -1;
+        }
+        if (end + (long)sizeof(raw) + length > size || fseek(file, length, SEEK_CUR) != 0)
+            break;
+        end += (long)sizeof(raw) + length;
+    }
+    if (end < size)
+    {
+        fprintf(stderr, "Dropping %ld bytes of a record cut short in %s\n", size - end, index_file);
+        if (ftruncate(fileno(file), end) < 0)
+        {
+            perror("Failed to repair recording index");
+            return -1;
+        }
+    }
+    return fseek(file, 0, SEEK_END);
+}
+
+int index_writer_open(RecordingIndexWriter *writer, const char *index_file, const DaqPlan *plan,
+                      const DaqDecoder *decoder, RecordingClock clock)
+{
+    memset(writer, 0, sizeof(*writer));
+    FILE *file = fopen(index_file, "a+b");
+    if (!file)
+    {
+        perror("Failed to open recording index");
+        return -1;
+    }
+    if (open_file_header(file, index_file) < 0)
+    {
+        fclose(file);
+        return -1;
+    }
+
+    uint8_t payload[RECORD_MAX_BYTES];
+    Fields f = {.data = payload, .len = sizeof(payload)};
+    put_uint(&f, clock, 1);
+    put_plan(&f, plan);
+    write_record(file, RECORDING_RECORD_SEGMENT, &f);
+    fflush(file);
+
+    writer->file = file;
+    writer->decoder = decoder;
+    writer->clock = clock;
+    return 0;
+}
+
+static void close_chunk(RecordingIndexWriter *writer)
+{
+    if (!writer->chunk_open)
+        return;
+    if (writer->clock != RECORDING_CLOCK_HOST)
+        writer->chunk.wall_ns = writer->chunk.first_ts_ns + (uint64_t)writer->wall_offset_ns;
+
+    uint8_t payload[RECORD_MAX_BYTES];
+    Fields f = {.data = payload, .len = sizeof(payload)};
+    put_chunk(&f, &writer->chunk);
+    write_record(writer->file, RECORDING_RECORD_CHUNK, &f);
+    writer->chunk_open = false;
+}
+
+void index_writer_frame(RecordingIndexWriter *writer, uint64_t offset, size_t len)
+{
+    if (!writer->file)
+        return;
+
+    RecordingChunk *chunk = &writer->chunk;
+    if (writer->chunk_open &&
+        (chunk->length + len > RECORDING_CHUNK_BYTES ||
+         (writer->chunk_has_ts && chunk->last_ts_ns - chunk->first_ts_ns >= RECORDING_CHUNK_NS)))
+    {
+        close_chunk(writer);
+    }
+
+    if (!writer->chunk_open)
+    {
+        const DaqDecoder *d = writer->decoder;
+        memset(chunk, 0, sizeof(*chunk));
+        chunk->offset = offset;
+        chunk->timestamp_wraps = d->timestamp_wraps;
+        chunk->last_raw_timestamp = d->last_raw_timestamp;
+        chunk->have_timestamp = (uint32_t)d->have_timestamp;
+        memcpy(chunk->list_timestamp_ns, d->list_timestamp_ns, sizeof(chunk->list_timestamp_ns));
+        writer->chunk_open = true;
+        writer->chunk_has_ts = false;
+    }
+
+    chunk->length += (uint32_t)len;
+    chunk->frames++;
+}
+
+void index_writer_samples(RecordingIndexWriter *writer, const DaqSample *samples, int count)
+{
+    if (!writer->file || !writer->chunk_open)
+        return;
+
+    RecordingChunk *chunk = &writer->chunk;
+    for (int i = 0; i < count; i++)
+    {
+        uint64_t ts = samples[i].timestamp_ns;
+        if (!writer->chunk_has_ts)
+        {
+            chunk->first_ts_ns = ts;
+            chunk->last_ts_ns = ts;
+            if (writer->clock == RECORDING_CLOCK_HOST)
+                chunk->wall_ns = time_wall_ns();
+            writer->chunk_has_ts = true;
+        }
+        if (ts < chunk->first_ts_ns)
+            chunk->first_ts_ns = ts;
+        if (ts > chunk->last_ts_ns)
+            chunk->last_ts_ns = ts;
+        chunk->signal_mask |= 1ULL << samples[i].signal;
+    }
+}
+
+void index_writer_set_wall_offset(RecordingIndexWriter *writer, int64_t offset_ns)
+{
+    close_chunk(writer);
+    writer->wall_offset_ns = offset_ns;
+}
+
+void index_writer_capture(RecordingIndexWriter *writer, const RecordingCapture *capture)
+{
+    if (!writer->file)
+        return;
+    close_chunk(writer);
+    uint8_t payload[RECORD_MAX_BYTES];
+    Fields f = {.data = payload, .len = sizeof(payload)};
+    put_capture(&f, capture);
+    write_record(writer->file, RECORDING_RECORD_CAPTURE, &f);
+}
+
+void index_writer_flush(RecordingIndexWriter *writer)
+{
+    if (writer->file)
+        fflush(writer->file);
+}
+
+void index_writer_close(RecordingIndexWriter *writer)
+{
+    if (!writer->file)
+        return;
+    close_chunk(writer);
+    fclose(writer->file);
+    writer->file = NULL;
+}
+
+int recording_index_load(RecordingIndex *index, const char *index_file)
+{
+    memset(index, 0, sizeof(*index));
+    FILE *file = fopen(index_file, "rb");
+    if (!file)
+    {
+        perror("Failed to open recording index");
+        return -1;
+    }
+
+    uint8_t header[sizeof(RecordingFileHeader)];
+    Fields h = {.data = header, .len = sizeof(header)};
+    if (fread(header, sizeof(header), 1, file) != 1 || get_uint(&h, 4) != RECORDING_INDEX_MAGIC)
+    {
+        fprintf(stderr, "%s is not a recording index, rebuild it with XCP_QUERY -R\n", index_file);
+        fclose(file);
+        return -1;
+    }
+    int version = (int)get_uint(&h, 2);
+    if (version != RECORDING_INDEX_VERSION)
+    {
+        fprintf(stderr, "%s is a version %d recording index, this build reads version %d. Rebuild it with XCP_QUERY -R\n",
+                index_file, version, RECORDING_INDEX_VERSION);
+        fclose(file);
+        return -1;
+    }
+
+    uint8_t *payload = malloc(RECORD_MAX_BYTES);
+    int chunk_capacity = 0;
+    int capture_capacity = 0;
+    int result = payload ? 0 : -1;
+    uint8_t raw[sizeof(RecordingRecord)];
+    while (result == 0 && fread(raw, sizeof(raw), 1, file) == 1)
+    {
+        Fields r = {.data = raw, .len = sizeof(raw)};
+        uint32_t type = (uint32_t)get_uint(&r, 4);
+        uint32_t length = (uint32_t)get_uint(&r, 4);
+        if (length > RECORD_MAX_BYTES)
+        {
+            result = -1;
+            break;
+        }
+        if (fread(payload, 1, length, file) != length)
+            break; // Truncated by a crash mid-write
+        Fields f = {.data = payload, .len = length};
+
+        if (type == RECORDING_RECORD_SEGMENT)
+        {
+            int n = index->segment_count + 1;
+            DaqPlan *segments = realloc(index->segments, n * sizeof(DaqPlan));
+            if (segments)
+                index->segments = segments;
+            RecordingClock *clocks = realloc(index->segment_clocks, n * sizeof(RecordingClock));
+            if (clocks)
+                index->segment_clocks = clocks;
+            if (!segments || !clocks)
+            {
+                result = -1;
+                break;
+            }
+            RecordingClock clock = (RecordingClock)get_uint(&f, 1);
+            get_plan(&f, &index->segments[index->segment_count]);
+            if (clock > RECORDING_CLOCK_DAQ)
+                f.bad = true;
+            index->segment_clocks[index->segment_count] = clock;
+            index->segment_count++;
+        }
+        else if (type == RECORDING_RECORD_CHUNK && index->segment_count > 0)
+        {
+            if (index->chunk_count == chunk_capacity)
+            {
+                chunk_capacity = chunk_capacity ? chunk_capacity * 2 : 1024;
+                RecordingChunk *chunks = realloc(index->chunks, chunk_capacity * sizeof(RecordingChunk));
+                int *chunk_segment = realloc(index->chunk_segment, chunk_capacity * sizeof(int));
+                if (chunks)
+                    index->chunks = chunks;
+                if (chunk_segment)
+                    index->chunk_segment = chunk_segment;
+                if (!chunks || !chunk_segment)
+                {
+                    result = -1;
+                    break;
+                }
+            }
+            get_chunk(&f, &index->chunks[index->chunk_count]);
+            index->chunk_segment[index->chunk_count] = index->segment_count - 1;
+            index->chunk_count++;
+        }
+        else if (type == RECORDING_RECORD_CAPTURE)
+        {
+            if (index->capture_count == capture_capacity)
+            {
+                capture_capacity = capture_capacity ? capture_capacity * 2 : 64;
+                RecordingCapture *captures = realloc(index->captures, capture_capacity * sizeof(RecordingCapture));
+                if (!captures)
+                {
+                    result = -1;
+                    break;
+                }
+                index->captures = captures;
+            }
+            get_capture(&f, &index->captures[index->capture_count]);
+            index->capture_count++;
+        }
+        else
+        {
+            f.bad = true;
+        }
+
+        // Every payload must be used up exactly.
+        if (f.bad || f.pos != f.len)
+            result = -1;
+    }
+
+    // A record cut short at the end is a crash mid-write, what came before it stands.
+    if (result < 0)
+    {
+        fprintf(stderr, "Corrupt recording index %s\n", index_file);
+        recording_index_free(index);
+    }
+    free(payload);
+    fclose(file);
+    return result;
+}
+
+void recording_index_free(RecordingIndex *index)
+{
+    free(index->segments);
+    free(index->segment_clocks);
+    free(index->chunks);
+    free(index->chunk_segment);
+    free(index->captures);
+    memset(index, 0, sizeof(*index));
+}
+
+static uint64_t chunk_end_ns(const RecordingChunk *chunk)
+{
+    return chunk->wall_ns + (chunk->last_ts_ns - chunk->first_ts_ns);
+}
+
+// Bit mask of the requested signals within one segment's plan.
+static uint64_t signal_mask_for(const DaqPlan *plan, const char *const *signals, int signal_count)
+{
+    if (!signals || signal_count == 0)
+        return ~0ULL;
+
+    uint64_t mask = 0;
+    for (int i = 0; i < plan->signal_count; i++)
+    {
+        for (int k = 0; k < signal_count; k++)
+        {
+            if (strcmp(plan->signals[i].name, signals[k]) == 0)
+                mask |= 1ULL << i;
+        }
+    }
+    return mask;
+}
+
+// First chunk that may end at or after from_ns.
+static int find_first_chunk(const RecordingIndex *index, uint64_t from_ns)
+{
+    int lo = 0, hi = index->chunk_count;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (index->chunks[mid].wall_ns < from_ns)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    // The chunk before may still run into the range.
+    return lo > 0 ? lo - 1 : 0;
+}
+
+int recording_query(const RecordingIndex *index, const char *data_file, uint64_t from_ns, uint64_t to_ns,
+                    const char *const *signals, int signal_count, RecordingSampleFn fn, void *ctx,
+                    RecordingQueryStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->chunks_total = index->chunk_count;
+
+    FILE *f = fopen(data_file, "rb");
+    if (!f)
+    {
+        perror("Failed to open recording");
+        return -1;
+    }
+
+    uint8_t *buf = malloc(RECORDING_CHUNK_BYTES + XCP_MAX_FRAME_SIZE);
+    uint64_t *masks = calloc((size_t)index->segment_count + 1, sizeof(uint64_t));
+    if (!buf || !masks)
+    {
+        free(buf);
+        free(masks);
+        fclose(f);
+        return -1;
+    }
+    for (int s = 0; s < index->segment_count; s++)
+        masks[s] = signal_mask_for(&index->segments[s], signals, signal_count);
+
+    DaqSample samples[DAQ_MAX_ENTRIES_PER_ODT];
+    for (int c = find_first_chunk(index, from_ns); c < index->chunk_count; c++)
+    {
+        const RecordingChunk *chunk = &index->chunks[c];
+        int segment = index->chunk_segment[c];
+        if (chunk->wall_ns > to_ns)
+            break;
+        if (chunk_end_ns(chunk) < from_ns || (chunk->signal_mask & masks[segment]) == 0)
+            continue;
+        if (chunk->length > RECORDING_CHUNK_BYTES + XCP_MAX_FRAME_SIZE)
+            continue;
+
+        if (fseek(f, (long)chunk->offset, SEEK_SET) != 0 || fread(buf, 1, chunk->length, f) != chunk->length)
+            break; // Index runs past the data, e.g. data file truncated
+        stats->chunks_read++;
+        stats->bytes_read += chunk->length;
+
+        // Prime the decoder with the state captured when the chunk was written.
+        const DaqPlan *plan = &index->segments[segment];
+        DaqDecoder decoder;
+        daq_decoder_init(&decoder, plan);
+        decoder.timestamp_wraps = chunk->timestamp_wraps;
+        decoder.last_raw_timestamp = chunk->last_raw_timestamp;
+        decoder.have_timestamp = (int)chunk->have_timestamp;
+        memcpy(decoder.list_timestamp_ns, chunk->list_timestamp_ns, sizeof(decoder.list_timestamp_ns));
+
+        size_t off = 0;
+        XcpFrame frame;
+        int n;
+        while ((n = xcp_parse_frame(buf + off, chunk->length - off, &frame)) > 0)
+        {
+            off += (size_t)n;
+            if (xcp_classify_pid(frame.packet[0]) != XCP_PACKET_DAQ)
+                continue;
+            int count = daq_decode_dto(&decoder, frame.packet, frame.len, samples, DAQ_MAX_ENTRIES_PER_ODT);
+            if (count <= 0)
+                continue;
+            stats->frames_decoded++;
+
+            for (int i = 0; i < count; i++)
+            {
+                if (!(masks[segment] & (1ULL << samples[i].signal)))
+                    continue;
+                uint64_t wall = chunk->wall_ns + (samples[i].timestamp_ns - chunk->first_ts_ns);
+                if (wall < from_ns || wall > to_ns)
+                    continue;
+                RecordingQuerySample out = {.wall_ns = wall, .plan = plan, .sample = samples[i]};
+                fn(ctx, &out);
+                stats->samples_emitted++;
+            }
+        }
+    }
+
+    free(buf);
+    free(masks);
+    fclose(f);
+    return 0;
+}
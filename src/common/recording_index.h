@@ -0,0 +1,197 @@
+// Sparse time index over XCP_DAQ recordings and time-range queries
+#ifndef RECORDING_INDEX_H
+#define RECORDING_INDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "daq_plan.h"
+#include "daq_decode.h"
+
+// The index of xcp_data.bin is xcp_data.bin.idx
+#define RECORDING_INDEX_SUFFIX ".idx"
+
+// A chunk is closed once it holds this many bytes or spans this much DAQ time.
+#define RECORDING_CHUNK_BYTES 65536
+#define RECORDING_CHUNK_NS 1000000000ULL
+
+// On disk an index is a RecordingFileHeader followed by records, each a
+// RecordingRecord and length bytes of payload. Payloads are written field by
+// field, little-endian, so the in-memory structs below may change freely; a
+// change to what is written needs a new RECORDING_INDEX_VERSION. Indexes of
+// another version are refused and have to be rebuilt (XCP_QUERY -R).
+#define RECORDING_INDEX_MAGIC 0x58444958 // "XIDX"
+#define RECORDING_INDEX_VERSION 2
+
+typedef enum
+{
+    RECORDING_RECORD_SEGMENT = 1, // Clock and DaqPlan of the chunks after it
+    RECORDING_RECORD_CHUNK = 2,   // A RecordingChunk
+    RECORDING_RECORD_CAPTURE = 3, // A RecordingCapture, after its chunks
+} RecordingRecordType;
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+} RecordingFileHeader;
+
+typedef struct
+{
+    uint32_t type;
+    uint32_t length; // Of the payload that follows
+} RecordingRecord;
+
+// Where the wall_ns of a segment's chunks comes from. Live recordings use the
+// host clock, an index rebuilt from the data alone can only use DAQ time, so
+// its segments are queried in DAQ seconds. Segments of both kinds in one
+// index are not comparable with each other.
+typedef enum
+{
+    RECORDING_CLOCK_HOST = 0,   // Host CLOCK_REALTIME when the chunk's first sample arrived
+    RECORDING_CLOCK_OFFSET = 1, // DAQ time plus a host offset, see index_writer_set_wall_offset()
+    RECORDING_CLOCK_DAQ = 2,    // DAQ time itself, rebuilt indexes
+} RecordingClock;
+
+// One index entry: a frame-aligned run of the recording.
+typedef struct
+{
+    uint64_t offset; // Of the first frame in the data file
+    uint32_t length; // Bytes, whole frames only
+    uint32_t frames;
+    uint64_t wall_ns;     // When first_ts_ns was received, see RecordingClock
+    uint64_t first_ts_ns; // Earliest and latest DAQ timestamp in the chunk
+    uint64_t last_ts_ns;
+    uint64_t signal_mask; // Bit n set if the chunk holds samples of plan signal n
+
+    // Decoder state at the start of the chunk, so a chunk decodes on its own.
+    uint64_t timestamp_wraps;
+    uint64_t list_timestamp_ns[DAQ_MAX_LISTS];
+    uint32_t last_raw_timestamp;
+    uint32_t have_timestamp;
+} RecordingChunk;
+
+#define RECORDING_TRIGGER_TEXT 96
+
+// A triggered capture, see capture.h. Its chunks are the ones written since
+// the previous record, covering [first_ts_ns, last_ts_ns].
+typedef struct
+{
+    uint64_t trigger_wall_ns;
+    uint64_t trigger_ts_ns;
+    uint64_t first_ts_ns;
+    uint64_t last_ts_ns;
+    uint64_t offset; // Of the capture's first frame in the data file
+    uint64_t length;
+    char trigger[RECORDING_TRIGGER_TEXT];
+} RecordingCapture;
+
+typedef struct
+{
+    FILE *file;
+    const DaqDecoder *decoder;
+    RecordingClock clock;
+    int64_t wall_offset_ns; // RECORDING_CLOCK_OFFSET: wall_ns = first_ts_ns + offset
+    RecordingChunk chunk;
+    bool chunk_open;
+    bool chunk_has_ts;
+} RecordingIndexWriter;
+
+typedef struct
+{
+    DaqPlan *segments;
+    RecordingClock *segment_clocks;
+    int segment_count;
+    RecordingChunk *chunks;
+    int *chunk_segment;
+    int chunk_count;
+    RecordingCapture *captures;
+    int capture_count;
+} RecordingIndex;
+
+typedef struct
+{
+    uint64_t wall_ns;
+    const DaqPlan *plan;
+    DaqSample sample;
+} RecordingQuerySample;
+
+typedef struct
+{
+    int chunks_total;
+    int chunks_read;
+    uint64_t bytes_read;
+    uint64_t frames_decoded;
+    uint64_t samples_emitted;
+} RecordingQueryStats;
+
+typedef void (*RecordingSampleFn)(void *ctx, const RecordingQuerySample *sample);
+
+/**
+ * @brief Open (append to) an index and start a new segment for the plan.
+ * @param decoder Decoder whose state is captured at the start of each chunk.
+ * @param clock How chunks are stamped with wall time.
+ * @return 0 on success, -1 if the index could not be opened, is corrupt or of
+ * another version. A record cut short at the end is cut off first.
+ */
+int index_writer_open(RecordingIndexWriter *writer, const char *index_file, const DaqPlan *plan,
+                      const DaqDecoder *decoder, RecordingClock clock);
+
+/**
+ * @brief Account for a frame about to be written at offset, before it is decoded.
+ */
+void index_writer_frame(RecordingIndexWriter *writer, uint64_t offset, size_t len);
+
+/**
+ * @brief Account for the samples decoded from the last frame.
+ */
+void index_writer_samples(RecordingIndexWriter *writer, const DaqSample *samples, int count);
+
+/**
+ * @brief With RECORDING_CLOCK_OFFSET, stamp chunks with DAQ time plus offset_ns.
+ * Used for frames written after they arrived, e.g. pre-trigger data.
+ */
+void index_writer_set_wall_offset(RecordingIndexWriter *writer, int64_t offset_ns);
+
+/**
+ * @brief Close the open chunk and record a capture covering the chunks written
+ * since the previous one.
+ */
+void index_writer_capture(RecordingIndexWriter *writer, const RecordingCapture *capture);
+
+void index_writer_flush(RecordingIndexWriter *writer);
+
+/**
+ * @brief Write out the open chunk and close the index.
+ * @note Chunk records are only written once a chunk closes. After a crash the
+ * last one, at most RECORDING_CHUNK_BYTES or RECORDING_CHUNK_NS of data, is
+ * in the recording but not in the index; XCP_QUERY -R recovers it.
+ */
+void index_writer_close(RecordingIndexWriter *writer);
+
+/**
+ * @brief Load a whole index into memory.
+ * @return 0 on success, -1 if the file is missing or corrupt, nothing is
+ * left loaded then. A record cut short at the end, as a crash mid-write
+ * leaves it, is ignored.
+ */
+int recording_index_load(RecordingIndex *index, const char *index_file);
+void recording_index_free(RecordingIndex *index);
+
+/**
+ * @brief Decode the samples of the given signals within [from_ns, to_ns].
+ * @param signals Signal names, or NULL / 0 for every signal.
+ * @param fn Called for every matching sample, in recording order.
+ * @return 0 on success, -1 if the data file could not be read.
+ * @note Only chunks overlapping the time range and holding a requested
+ * signal are read. Chunks are assumed to be appended in time order, which
+ * holds for XCP_DAQ recordings.
+ */
+int recording_query(const RecordingIndex *index, const char *data_file, uint64_t from_ns, uint64_t to_ns,
+                    const char *const *signals, int signal_count, RecordingSampleFn fn, void *ctx,
+                    RecordingQueryStats *stats);
+
+#endif // RECORDING_INDEX_H
@@ -0,0 +1,21 @@
+#ifndef TIME_UTILS_H
+#define TIME_UTILS_H
+
+#include <stdint.h>
+
+/**
+ * @brief Monotonic clock in nanoseconds.
+ */
+uint64_t time_now_ns(void);
+
+/**
+ * @brief Wall clock (CLOCK_REALTIME) in nanoseconds since the epoch.
+ */
+uint64_t time_wall_ns(void);
+
+/**
+ * @brief Sleep until the monotonic clock reaches deadline_ns.
+ */
+void time_sleep_until_ns(uint64_t deadline_ns);
+
+#endif // TIME_UTILS_H
@@ -1,10 +1,147 @@
 #include <stdbool.h>
+#include <string.h>
 
 #include "xcp_utils.h"
 
 bool is_daq_packet(const uint8_t *data, size_t len)
 {
-    // TODO - implement a proper check for DAQ packets.
-    // For now all packets are considered DAQ packets.
-    return true;
-}
\ No newline at end of file
+    if (len <= XCP_TCP_HEADER_SIZE)
+        return false;
+    return xcp_classify_pid(data[XCP_TCP_HEADER_SIZE]) == XCP_PACKET_DAQ;
+}
+
+XcpPacketType xcp_classify_pid(uint8_t pid)
+{
+    switch (pid)
+    {
+    case XCP_PID_RES:
+        return XCP_PACKET_RES;
+    case XCP_PID_ERR:
+        return XCP_PACKET_ERR;
+    case XCP_PID_EV:
+        return XCP_PACKET_EV;
+    case XCP_PID_SERV:
+        return XCP_PACKET_SERV;
+    default:
+        return XCP_PACKET_DAQ;
+    }
+}
+
+int xcp_parse_frame(const uint8_t *data, size_t len, XcpFrame *frame)
+{
+    if (len < XCP_TCP_HEADER_SIZE)
+        return 0;
+
+    uint16_t packet_len = (uint16_t)(data[0] | (data[1] << 8));
+    if (packet_len == 0 || packet_len > XCP_MAX_PACKET_SIZE)
+        return -1;
+    if (len < XCP_TCP_HEADER_SIZE + (size_t)packet_len)
+        return 0;
+
+    frame->len = packet_len;
+    frame->ctr = (uint16_t)(data[2] | (data[3] << 8));
+    frame->packet = data + XCP_TCP_HEADER_SIZE;
+    return XCP_TCP_HEADER_SIZE + packet_len;
+}
+
+void xcp_reader_init(XcpFrameReader *reader)
+{
+    reader->start = 0;
+    reader->end = 0;
+    reader->have_ctr = false;
+    reader->resyncing = false;
+    reader->skipped = 0;
+}
+
+uint8_t *xcp_reader_tail(XcpFrameReader *reader, size_t *space)
+{
+    // Move the partial frame to the front so the free space is contiguous.
+    if (reader->start > 0)
+    {
+        memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    *space = sizeof(reader->buf) - reader->end;
+    return reader->buf + reader->end;
+}
+
+void xcp_reader_commit(XcpFrameReader *reader, size_t len)
+{
+    reader->end += len;
+}
+
+size_t xcp_reader_push(XcpFrameReader *reader, const uint8_t *data, size_t len)
+{
+    size_t space;
+    uint8_t *tail = xcp_reader_tail(reader, &space);
+    if (len > space)
+        len = space;
+    memcpy(tail, data, len);
+    xcp_reader_commit(reader, len);
+    return len;
+}
+
+int xcp_plausible_header(const uint8_t *data, size_t len, bool have_ctr, uint16_t next_ctr)
+{
+    XcpFrame frame;
+    int n = xcp_parse_frame(data, len, &frame);
+    if (n < 0)
+        return -1;
+    if (len < XCP_TCP_HEADER_SIZE)
+        return 0;
+    uint16_t ctr = (uint16_t)(data[2] | (data[3] << 8));
+    if (have_ctr && (uint16_t)(ctr - next_ctr) < XCP_RESYNC_CTR_WINDOW)
+        return 1;
+    if (n == 0 || len < (size_t)n + XCP_TCP_HEADER_SIZE)
+        return 0;
+
+    XcpFrame next;
+    if (xcp_parse_frame(data + n, len - (size_t)n, &next) < 0)
+        return -1;
+    uint16_t following = (uint16_t)(data[n + 2] | (data[n + 3] << 8));
+    return following == (uint16_t)(ctr + 1) ? 1 : -1;
+}
+
+// Step past bytes until a plausible header. Returns 1 once found, 0 if more
+// data is needed first.
+static int resync(XcpFrameReader *reader)
+{
+    while (reader->start < reader->end)
+    {
+        int r = xcp_plausible_header(reader->buf + reader->start, reader->end - reader->start, reader->have_ctr,
+                                     reader->next_ctr);
+        // With the buffer full there is no more data to wait for, take the header as it is.
+        if (r > 0 || (r == 0 && reader->start == 0 && reader->end == sizeof(reader->buf)))
+        {
+            reader->resyncing = false;
+            return 1;
+        }
+        if (r == 0)
+            return 0;
+        reader->start++;
+        reader->skipped++;
+    }
+    return 0;
+}
+
+int xcp_reader_next(XcpFrameReader *reader, XcpFrame *frame)
+{
+    if (reader->resyncing && !resync(reader))
+        return 0;
+
+    int n = xcp_parse_frame(reader->buf + reader->start, reader->end - reader->start, frame);
+    if (n < 0)
+    {
+        reader->resyncing = true;
+        reader->start++;
+        reader->skipped++;
+        return -1;
+    }
+    if (n == 0)
+        return 0;
+    reader->start += (size_t)n;
+    reader->next_ctr = (uint16_t)(frame->ctr + 1);
+    reader->have_ctr = true;
+    return 1;
+}
@@ -5,6 +5,112 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+// XCP on TCP/IP frames every packet with a LEN (2 bytes) and CTR (2 bytes)
+// header, both little-endian.
+#define XCP_TCP_HEADER_SIZE 4
+
+// Largest frame we handle, header included. Matches the CMD cache slot size.
+#define XCP_MAX_FRAME_SIZE 256
+#define XCP_MAX_PACKET_SIZE (XCP_MAX_FRAME_SIZE - XCP_TCP_HEADER_SIZE)
+
+// XCP on UDP/IP uses the same header and may pack several frames into one
+// datagram. This is the largest datagram we accept, one Ethernet MTU.
+#define XCP_UDP_MAX_DATAGRAM 1472
+
+// While resynchronising, a header whose CTR is this far past the last good
+// one is still taken as the next frame (frames may have been lost with the
+// corrupt bytes).
+#define XCP_RESYNC_CTR_WINDOW 256
+
+// Packet identifiers >= 0xFC are reserved for RES/ERR/EV/SERV, so absolute
+// ODT numbers must stay below this.
+#define XCP_PID_SERV 0xFC
+#define XCP_PID_EV 0xFD
+#define XCP_PID_ERR 0xFE
+#define XCP_PID_RES 0xFF
+
+typedef enum
+{
+    XCP_PACKET_DAQ,
+    XCP_PACKET_SERV,
+    XCP_PACKET_EV,
+    XCP_PACKET_ERR,
+    XCP_PACKET_RES,
+} XcpPacketType;
+
+typedef struct
+{
+    uint16_t len; // Length of the XCP packet, header excluded
+    uint16_t ctr;
+    const uint8_t *packet;
+} XcpFrame;
+
+// Reassembles XCP on TCP frames from a byte stream.
+typedef struct
+{
+    uint8_t buf[XCP_MAX_FRAME_SIZE * 16];
+    size_t start; // First unconsumed byte
+    size_t end;   // One past the last received byte
+
+    uint16_t next_ctr; // CTR expected on the next frame
+    bool have_ctr;
+    bool resyncing;    // Looking for a frame header after a corrupt one
+    uint64_t skipped;  // Bytes dropped while resynchronising
+} XcpFrameReader;
+
+/**
+ * @brief Check whether a whole XCP on TCP frame (header included) carries a DTO.
+ */
 bool is_daq_packet(const uint8_t *data, size_t len);
 
-#endif // XCP_UTILS_H
\ No newline at end of file
+/**
+ * @brief Classify an XCP packet (slave to master) by its PID.
+ */
+XcpPacketType xcp_classify_pid(uint8_t pid);
+
+/**
+ * @brief Parse one XCP on TCP frame from the start of a buffer.
+ * @param data Buffer starting at a frame header.
+ * @param len Number of bytes available.
+ * @param frame Output, packet points into data.
+ * @return Number of bytes the frame occupies, 0 if more data is needed, or
+ * -1 if the header is invalid (zero or oversized length).
+ */
+int xcp_parse_frame(const uint8_t *data, size_t len, XcpFrame *frame);
+
+/**
+ * @brief Whether a frame header at data looks genuine when looking for one in
+ * a corrupt stream: its CTR continues the stream, or the frame after it has
+ * the next CTR.
+ * @param next_ctr CTR expected next, only used if have_ctr.
+ * @return 1 if plausible, 0 if more data is needed to tell, -1 if not.
+ */
+int xcp_plausible_header(const uint8_t *data, size_t len, bool have_ctr, uint16_t next_ctr);
+
+void xcp_reader_init(XcpFrameReader *reader);
+
+/**
+ * @brief Free space at the end of the reader, e.g. to recv() into directly.
+ * @param space Output, number of bytes that may be written.
+ * @return Pointer to write to, commit the written bytes with xcp_reader_commit().
+ */
+uint8_t *xcp_reader_tail(XcpFrameReader *reader, size_t *space);
+void xcp_reader_commit(XcpFrameReader *reader, size_t len);
+
+/**
+ * @brief Append bytes to the reader.
+ * @return Number of bytes taken, less than len if the reader is full.
+ */
+size_t xcp_reader_push(XcpFrameReader *reader, const uint8_t *data, size_t len);
+
+/**
+ * @brief Take the next complete frame from the reader.
+ * @return 1 if a frame was returned, 0 if more data is needed, -1 if a
+ * corrupt header was found. After -1 keep calling: the reader steps through
+ * the stream a byte at a time until a header is followed by another with the
+ * next CTR (or its CTR continues the stream), and carries on from there.
+ * @note frame->packet stays valid until the next tail/push call.
+ */
+int xcp_reader_next(XcpFrameReader *reader, XcpFrame *frame);
+
+#endif // XCP_UTILS_H